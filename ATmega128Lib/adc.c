@@ -11,6 +11,11 @@
 /* Buffer variable to store the conversion results */
 unsigned short int adcInputs[8];
 
+/* Windows checked by the interrupt mode conversions */
+static unsigned short int adcWindowLow[8];
+static unsigned short int adcWindowHigh[8];
+static void (*adcWindowFunctions[8])(byte channelNumber,unsigned short int reading);
+
 /*
 *
 * Name : Adc_Init
@@ -49,10 +54,12 @@ int Adc_ReadInput(byte channelNumber)
  ADCSRA=_BV(ADEN)|_BV(ADPS2)|_BV(ADPS1);
  if(channelNumber>7)
      return -1;
+ PROFILE_BEGIN(PROFILE_ADC_READ);
  ADMUX=channelNumber;
  ADCSRA|=_BV(ADSC);
  while(ADCSRA & _BV(ADSC));
  adcReading = (int)(ADCL | (ADCH << 8));
+ PROFILE_END(PROFILE_ADC_READ);
  return adcReading;
 }
 
@@ -71,6 +78,7 @@ int Adc_ReadInput(byte channelNumber)
 void Adc_ReadAllInputs()
 {
  byte muxValue=0;
+ PROFILE_BEGIN(PROFILE_ADC_READ);
  ADCSRA=_BV(ADEN)|_BV(ADPS2)|_BV(ADPS1);
  for(muxValue=0;muxValue<8;muxValue++)
  {
@@ -79,6 +87,7 @@ void Adc_ReadAllInputs()
   while(ADCSRA & _BV(ADSC));
   adcInputs[muxValue]= (unsigned short int)(ADCL | (ADCH << 8));
  }
+ PROFILE_END(PROFILE_ADC_READ);
 }
 
 /*
@@ -104,12 +113,56 @@ void Adc_TakeContinousReadings()
  ADCSRA|=_BV(ADSC);
 }
 
-SIGNAL(SIG_ADC)
+/*
+*
+* Name : Adc_SetWindow
+*
+* Watches a channel in interrupt mode ,see /Adc_TakeContinousReadings/ .As soon as a conversion of the channel is below
+* /low/ or above /high/ the handler function is called from the *ADC* interrupt with interrupts enabled ,see the
+* *INTERRUPT PRIORITIES* module ,and again for every conversion while the reading stays outside .This function does not
+* return a value .
+*
+* Parameters :
+*
+* /channelNumber/ - Range 0-7 .Channel to watch
+*
+* /low/ - Range 0-1023 .Lowest reading inside the window
+*
+* /high/ - Range 0-1023 .Highest reading inside the window
+*
+* /fptr/ - Function called with the channel and the reading ,NULL to stop watching the channel
+*
+* E.g. Usage :
+*
+* /Adc_SetWindow (2,0,800,BumperHit);/ - Calls BumperHit when the reading of channel 2 goes over 800
+*/
+void Adc_SetWindow(byte channelNumber,unsigned short int low,unsigned short int high,void (*fptr)(byte channelNumber,unsigned short int reading))
+{
+ byte sreg=SREG;
+ if(channelNumber>7)
+     return;
+ cli();
+ adcWindowLow[channelNumber]=low;
+ adcWindowHigh[channelNumber]=high;
+ adcWindowFunctions[channelNumber]=fptr;
+ SREG=sreg;
+}
+
+ISR_DEFERRABLE(SIG_ADC)
 {
  byte muxValue=ADMUX;
- adcInputs[muxValue]=(unsigned short int)(ADCL | (ADCH << 8));
+ byte channelNumber=muxValue&0x07;
+ unsigned short int reading;
+ PROFILE_BEGIN(PROFILE_ADC_ISR);
+ reading=(unsigned short int)(ADCL | (ADCH << 8));
+ adcInputs[muxValue]=reading;
  ADMUX=((++muxValue)&0x07);
  if(muxValue==7)
      muxValue=0;
  ADCSRA|=_BV(ADSC);
+ if(adcWindowFunctions[channelNumber]!=NULL &&
+    (reading<adcWindowLow[channelNumber] || reading>adcWindowHigh[channelNumber]))
+     ISR_DEFER_CALL_FLAG(ADCSRA,ADIE,ADIF,adcWindowFunctions[channelNumber],
+                         adcWindowFunctions[channelNumber](channelNumber,reading));
+ PROFILE_END(PROFILE_ADC_ISR);
 }
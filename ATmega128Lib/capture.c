@@ -0,0 +1,369 @@
+/****************************************************
+* Module: Input Capture
+*
+* The *CAPTURE* module uses the input capture units of the 16 bit timers to measure pulse widths and frequencies .The
+* timer value is latched by the hardware at the exact moment an edge arrives at the *ICP1* (pin 4 of PORTD) or *ICP3*
+* (pin 7 of PORTE) pin so the readings do not depend on how soon the interrupt is serviced .Timer overflows are counted
+* to extend the timestamps to 32 bits and the most recent edges are kept in a small ring buffer .This is useful for RC
+* receiver inputs ,tachometers ,wheel encoders etc .
+*
+* The timers are shared with the other modules through the *16 BIT TIMER CHANNELS* module ,input capture does not use
+* any of the compare channels so it works together with *SERVO* ,*STEPPER* and *DCMOTORS* .
+*
+****************************************************/
+
+/* Capture Settings */
+#define CAPTURE_TIMER1       0
+#define CAPTURE_TIMER3       1
+#define CAPTURE_RISING_EDGE  0
+#define CAPTURE_FALLING_EDGE 1
+#define CAPTURE_BOTH_EDGES   2
+#ifndef CAPTURERINGSIZE
+#define CAPTURERINGSIZE      8    /* power of 2 ,at most 8 */
+#endif
+
+/* Variables */
+static struct{
+unsigned long ring[CAPTURERINGSIZE];
+unsigned long lastRise;
+unsigned long lastEdge;
+unsigned long period;
+unsigned long highTime;
+byte ringLevels;
+byte ringHead;
+byte edgeMode;
+volatile byte newReading;
+}captureStruct[2];
+
+/* Functions */
+
+/*
+*
+* Name : Capture_Init
+*
+* Starts input capture on a 16 bit timer .Every edge on the *ICP* pin of the timer is timestamped in timer ticks ,0.5us
+* each with the default clock of the *16 BIT TIMER CHANNELS* module .This function does not return a value .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 (pin 4 of PORTD) or CAPTURE_TIMER3 (pin 7 of PORTE)
+*
+* /edgeMode/ - Takes the values
+*            - CAPTURE_RISING_EDGE  (period measured between rising edges)
+*            - CAPTURE_FALLING_EDGE (period measured between falling edges)
+*            - CAPTURE_BOTH_EDGES   (period between rising edges and the high time of the pulse)
+*
+* E.g. Usage :
+*
+* /Capture_Init (CAPTURE_TIMER1,CAPTURE_BOTH_EDGES);/ - Measures RC receiver pulses on the *ICP1* pin
+*/
+void Capture_Init(byte timerNumber,byte edgeMode)
+{
+ byte edgeBit;
+ if(timerNumber>CAPTURE_TIMER3)
+     return;
+ Timer16_Init();
+ memset(&captureStruct[timerNumber],0,sizeof(captureStruct[timerNumber]));
+ captureStruct[timerNumber].edgeMode=edgeMode;
+ if(edgeMode==CAPTURE_FALLING_EDGE)
+     edgeBit=0;
+ else
+     edgeBit=_BV(ICES1);
+ cli();
+ if(timerNumber==CAPTURE_TIMER1)
+  {
+   DDRD&=~_BV(4);
+   TCCR1B=(TCCR1B&0x07)|_BV(ICNC1)|edgeBit;
+   TIFR=_BV(ICF1);
+   TIMSK|=_BV(TICIE1);
+  }
+ else
+  {
+   DDRE&=~_BV(7);
+   TCCR3B=(TCCR3B&0x07)|_BV(ICNC3)|edgeBit;
+   ETIFR=_BV(ICF3);
+   ETIMSK|=_BV(TICIE3);
+  }
+ sei();
+}
+
+/*
+*
+* Name : Capture_Stop
+*
+* Disables the capture interrupt .The timer keeps running for the other modules and the last readings remain available .
+* This function does not return a value .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /Capture_Stop (CAPTURE_TIMER1);/ - Stops input capture on Timer1
+*/
+void Capture_Stop(byte timerNumber)
+{
+ if(timerNumber==CAPTURE_TIMER1)
+  {
+   TIMSK&=~_BV(TICIE1);
+  }
+ else if(timerNumber==CAPTURE_TIMER3)
+  {
+   ETIMSK&=~_BV(TICIE3);
+  }
+}
+
+/*
+*
+* Name : Capture_Now
+*
+* Returns the present 32 bit time of a capture timer in timer ticks .Compare it with the timestamps returned by
+* /Capture_ReadRing/ to find out how long ago an edge arrived ,e.g. to detect that a signal has been lost .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /unsigned long now=Capture_Now (CAPTURE_TIMER1);/ - Reads the present time of Timer1
+*/
+unsigned long Capture_Now(byte timerNumber)
+{
+ unsigned long time;
+ byte sreg=SREG;
+ cli();
+ if(timerNumber==CAPTURE_TIMER1)
+     time=Timer16_Extend(0,TCNT1,TIFR&_BV(TOV1));
+ else
+     time=Timer16_Extend(1,TCNT3,ETIFR&_BV(TOV3));
+ SREG=sreg;
+ return time;
+}
+
+/*
+*
+* Name : Capture_Available
+*
+* Returns 1 if a new period or pulse width has been measured since the last call to this function ,else returns 0 .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /if(Capture_Available (CAPTURE_TIMER1)) UpdateThrottle();/ - Updates the throttle only when a new pulse has arrived
+*/
+byte Capture_Available(byte timerNumber)
+{
+ byte available;
+ byte sreg=SREG;
+ cli();
+ available=captureStruct[timerNumber].newReading;
+ captureStruct[timerNumber].newReading=0;
+ SREG=sreg;
+ return available;
+}
+
+/*
+*
+* Name : Capture_GetPeriod
+*
+* Returns the time between the last two edges used for period measurement in timer ticks .Returns 0 until two edges have
+* been captured .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /unsigned long period=Capture_GetPeriod (CAPTURE_TIMER1);/ - Reads the last period measured on *ICP1*
+*/
+unsigned long Capture_GetPeriod(byte timerNumber)
+{
+ unsigned long period;
+ byte sreg=SREG;
+ cli();
+ period=captureStruct[timerNumber].period;
+ SREG=sreg;
+ return period;
+}
+
+/*
+*
+* Name : Capture_GetPulseWidth
+*
+* Returns the high time of the last pulse in timer ticks .Only available in CAPTURE_BOTH_EDGES mode .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /unsigned int pulse=Capture_GetPulseWidth (CAPTURE_TIMER1)/2;/ - Reads an RC receiver pulse in microseconds
+*/
+unsigned long Capture_GetPulseWidth(byte timerNumber)
+{
+ unsigned long highTime;
+ byte sreg=SREG;
+ cli();
+ highTime=captureStruct[timerNumber].highTime;
+ SREG=sreg;
+ return highTime;
+}
+
+/*
+*
+* Name : Capture_GetDutyCycle
+*
+* Returns the duty cycle of the signal in tenths of a percent (0-1000) .Only available in CAPTURE_BOTH_EDGES mode .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /Capture_GetDutyCycle (CAPTURE_TIMER3);/ - Returns 250 for a signal which is high a quarter of the time
+*/
+unsigned int Capture_GetDutyCycle(byte timerNumber)
+{
+ unsigned long period,highTime;
+ byte sreg=SREG;
+ cli();
+ period=captureStruct[timerNumber].period;
+ highTime=captureStruct[timerNumber].highTime;
+ SREG=sreg;
+ while(period>=0x400000UL)
+  {
+   period>>=1;
+   highTime>>=1;
+  }
+ if(period==0 || highTime>period)
+     return 0;
+ return (unsigned int)((highTime*1000UL)/period);
+}
+
+/*
+*
+* Name : Capture_GetFrequency
+*
+* Returns the frequency of the signal in hundredths of a Hz worked out from the last period .Returns 0 until two edges
+* have been captured .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* E.g. Usage :
+*
+* /unsigned long rpm=Capture_GetFrequency (CAPTURE_TIMER3)*60/100;/ - Reads a tachometer with one pulse per revolution
+*/
+unsigned long Capture_GetFrequency(byte timerNumber)
+{
+ unsigned long period=Capture_GetPeriod(timerNumber);
+ if(period==0)
+     return 0;
+ return ((F_CPU/TIMER16_DIVISOR)*100UL)/period;
+}
+
+/*
+*
+* Name : Capture_ReadRing
+*
+* Copies the timestamps of the most recent edges ,oldest first ,into an array .Up to CAPTURERINGSIZE (default 8) edges
+* are kept .The return value has bit i set if /timeStamps[i]/ was a rising edge and cleared if it was a falling edge .
+*
+* Parameters :
+*
+* /timerNumber/ - CAPTURE_TIMER1 or CAPTURE_TIMER3
+*
+* /timeStamps/ - Array to which the 32 bit timestamps will be copied
+*
+* /count/ - Range 1-CAPTURERINGSIZE .Number of edges to copy
+*
+* E.g. Usage :
+*
+* /byte levels=Capture_ReadRing (CAPTURE_TIMER1,edges,4);/ - Copies the last four edges captured on *ICP1*
+*/
+byte Capture_ReadRing(byte timerNumber,unsigned long * timeStamps,byte count)
+{
+ byte i,index,levels=0;
+ byte sreg=SREG;
+ if(count>CAPTURERINGSIZE)
+     count=CAPTURERINGSIZE;
+ cli();
+ index=(captureStruct[timerNumber].ringHead-count)&(CAPTURERINGSIZE-1);
+ for(i=0;i<count;i++)
+  {
+   timeStamps[i]=captureStruct[timerNumber].ring[index];
+   if(captureStruct[timerNumber].ringLevels&_BV(index))
+       levels|=_BV(i);
+   index=(index+1)&(CAPTURERINGSIZE-1);
+  }
+ SREG=sreg;
+ return levels;
+}
+
+/* Called from the capture interrupts with the latched timer value */
+static void Capture_Record(byte timerNumber,unsigned int icr,byte rising,byte overflowPending)
+{
+ unsigned long time=Timer16_Extend(timerNumber,icr,overflowPending);
+ byte head=captureStruct[timerNumber].ringHead;
+
+ captureStruct[timerNumber].ring[head]=time;
+ if(rising)
+     captureStruct[timerNumber].ringLevels|=_BV(head);
+ else
+     captureStruct[timerNumber].ringLevels&=~_BV(head);
+ captureStruct[timerNumber].ringHead=(head+1)&(CAPTURERINGSIZE-1);
+
+ if(captureStruct[timerNumber].edgeMode!=CAPTURE_BOTH_EDGES)
+  {
+   if(captureStruct[timerNumber].lastEdge!=0)
+    {
+     captureStruct[timerNumber].period=time-captureStruct[timerNumber].lastEdge;
+     captureStruct[timerNumber].newReading=1;
+    }
+  }
+ else if(rising)
+  {
+   if(captureStruct[timerNumber].lastRise!=0)
+       captureStruct[timerNumber].period=time-captureStruct[timerNumber].lastRise;
+   captureStruct[timerNumber].lastRise=time;
+  }
+ else if(captureStruct[timerNumber].lastRise!=0)
+  {
+   captureStruct[timerNumber].highTime=time-captureStruct[timerNumber].lastRise;
+   captureStruct[timerNumber].newReading=1;
+  }
+ captureStruct[timerNumber].lastEdge=time;
+}
+
+ISR_HARD(SIG_INPUT_CAPTURE1)
+{
+ PROFILE_BEGIN(PROFILE_CAPTURE_ISR);
+ Capture_Record(CAPTURE_TIMER1,ICR1,TCCR1B&_BV(ICES1),TIFR&_BV(TOV1));
+ if(captureStruct[CAPTURE_TIMER1].edgeMode==CAPTURE_BOTH_EDGES)
+  {
+   TCCR1B^=_BV(ICES1);
+   TIFR=_BV(ICF1);
+  }
+ PROFILE_END(PROFILE_CAPTURE_ISR);
+}
+
+ISR_HARD(SIG_INPUT_CAPTURE3)
+{
+ PROFILE_BEGIN(PROFILE_CAPTURE_ISR);
+ Capture_Record(CAPTURE_TIMER3,ICR3,TCCR3B&_BV(ICES3),ETIFR&_BV(TOV3));
+ if(captureStruct[CAPTURE_TIMER3].edgeMode==CAPTURE_BOTH_EDGES)
+  {
+   TCCR3B^=_BV(ICES3);
+   ETIFR=_BV(ICF3);
+  }
+ PROFILE_END(PROFILE_CAPTURE_ISR);
+}
@@ -1,19 +1,231 @@
 /****************************************************
 * Module: I2C Bus
-* 
-* The *I2C* module provides simple functions to communicate with *I2C* devices such as sonar sensors ,eeproms etc .To use   
+*
+* The *I2C* module provides simple functions to communicate with *I2C* devices such as sonar sensors ,eeproms etc .To use
 * the the functions provided there shud be atleast one *I2C* device connected on the *I2C* port .
 *
+* Every transfer on the bus is an /I2C_Transaction/ made of a list of segments .A segment writes bytes to the device or
+* reads bytes from it ,consecutive segments in the same direction are sent without a break and a repeated START is sent
+* automatically when the direction changes or when a segment has the I2C_RESTART flag .A whole register write followed
+* by a status read can therefore be done in a single bus transaction .
+*
+* Transactions handed to /I2C_Submit/ are queued and run by the *TWI* interrupt one after the other in the order they
+* were submitted .The function returns at once and the completion function of each transaction is called with global
+* interrupts enabled ,so the CPU is free while the bus is busy .The blocking functions /I2C_Transfer/ ,/I2C_WriteData/ ,
+* /I2C_WriteRegister/ ,/I2C_ReadData/ and /I2C_ReadRegister/ use the same queue and wait for their transaction .When
+* they are called with interrupts disabled (e.g. from an interrupt handler) they run the queue themselves by polling the
+* *TWI* flag .
+*
+* The bus runs at I2CFREQUENCY (100kHz standard mode unless defined before this module) and /I2C_SetFrequency/ changes
+* it up to 400kHz fast mode .A transaction can also carry its own bit rate so slow and fast devices share the bus ,each
+* at its best speed .
+*
+* No wait on the bus is endless .When a transaction makes no progress for I2CTIMEOUT milliseconds (10ms unless defined
+* before this module) it ends with I2C_TIMEOUT_ERROR and the bus is recovered :*SCL* is clocked until the device holding
+* *SDA* lets go ,a *STOP* is sent and the *TWI* is restarted .The number of recoveries is counted by
+* /I2C_GetRecoveryCount/ so a failing device or cable can be spotted .A transaction which cannot start ,e.g. because a
+* master keeps the MCU busy as a slave ,ends with I2C_TIMEOUT_ERROR I2CQUEUETIMEOUT milliseconds (100ms unless defined
+* before this module) after it was submitted .
+*
+* The MCU can also be an *I2C* slave at the same time ,see /I2C_SlaveInit/ .It then looks to a master on the bus like a
+* sensor with a register map :a write sets the register pointer with its first byte and stores the bytes which follow ,a
+* read returns the registers from the pointer on ,the pointer moving on by one for each byte .The first registers are
+* read only and double buffered ,your program fills the back buffer and /I2C_SlavePublish/ swaps it with the one the
+* master reads only between transfers ,so the master always reads a consistent set of values .The read write registers
+* follow them .
+*
+* /I2C_Scan/ finds the devices on the bus by addressing each one and sending a *STOP* at once .Addresses which do not
+* answer are marked in a bitmap so drivers check with /I2C_IsMissing/ in a few cycles instead of waiting for a failed
+* transaction ,and the devices found are kept in a small table with their type .
+*
+* Defining /_I2C_STATS_/ keeps statistics for each device address :transactions ,bytes ,start errors ,address and data
+* NACKs ,timeouts ,retries after a lost arbitration and a histogram of the time from /I2C_Submit/ to completion .They are
+* printed on *UART1* by /I2C_StatsDump/ .Without it no code ,time or memory is used .A lost arbitration is counted
+* where it ends up :when another master addresses the MCU the transaction is sent again afterwards and counts as a
+* retry ,any other lost arbitration ends the transaction with I2C_START_ERROR and counts as a start error .
+*
 */
 
+/* Segment Types */
+#define I2C_WRITE         0x00
+#define I2C_READ          0x01
+#define I2C_RESTART       0x80   /* OR with the type to send a repeated START before the segment */
+
+/* Bit Rate */
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#ifndef I2CFREQUENCY
+#define I2CFREQUENCY 100000UL
+#endif
+#define I2C_CYCLES(f)         ((F_CPU+(f)-1)/(f))      /* clock cycles per SCL period ,rounded up */
+#define I2C_TWBRFOR(f,p)      (I2C_CYCLES(f)>16UL?(I2C_CYCLES(f)-16UL+2UL*(p)-1UL)/(2UL*(p)):0UL)
+#define I2C_TWPS(f)           (I2C_TWBRFOR(f,1)<=255UL?0:I2C_TWBRFOR(f,4)<=255UL?1:I2C_TWBRFOR(f,16)<=255UL?2:3)
+#define I2C_TWBR(f)           ((byte)(I2C_TWBRFOR(f,1UL<<(2*I2C_TWPS(f)))>255UL?255:I2C_TWBRFOR(f,1UL<<(2*I2C_TWPS(f)))))
+#define I2C_BITRATE(f)        (((unsigned int)I2C_TWPS(f)<<8)|I2C_TWBR(f))
+#define I2C_SetFrequency(f)   I2C_SetBitRate(__builtin_constant_p(f)?I2C_BITRATE(f):I2C_SolveBitRate(f))
+
+/* Timeouts */
+#ifndef I2CTIMEOUT
+#define I2CTIMEOUT        10                        /* milliseconds without bus progress */
+#endif
+#ifndef I2CQUEUETIMEOUT
+#define I2CQUEUETIMEOUT   100                       /* milliseconds from submit to the START of the transaction */
+#endif
+#define I2C_STOPTICKS     TIMER16_MS(2)             /* longest STOP ,half an SCL period at the lowest bit rate */
+#define I2C_HALFBITTICKS  TIMER16_US(5)             /* bus recovery runs at 100kHz */
+#define I2C_SCLPIN        0                         /* PD0 */
+#define I2C_SDAPIN        1                         /* PD1 */
+
+/* Device Table */
+#ifndef I2CDEVICES
+#define I2CDEVICES        8
+#endif
+#define I2C_DEVICE_UNKNOWN 1                        /* answered but not identified */
+#define I2C_IsMissing(address) ((i2cMissing[(byte)(address)>>3]>>((address)&7))&1)
+
+/* Statistics */
+#ifndef I2CSTATSLOTS
+#define I2CSTATSLOTS      8                         /* addresses with their own statistics ,the last slot takes the rest */
+#endif
+#define I2CSTATBUCKETS    16
+#ifndef I2C_STATS_printf
+#define I2C_STATS_printf  Uart1_printf
+#endif
+#define I2C_STATS_OTHER   0x80                      /* address of the slot shared by the addresses which did not fit */
+
+/* Transaction Flags */
+#define I2C_HOLD_BUS      0x01   /* no STOP at the end ,the next transaction starts with a repeated START */
+
+/* Transaction Status */
+#define I2C_PENDING       0
+#ifndef I2C_BUSY_ERROR
+#define I2C_BUSY_ERROR    -4
+#endif
+#ifndef I2C_TIMEOUT_ERROR
+#define I2C_TIMEOUT_ERROR -5
+#endif
+
+/* TWI Status Codes */
+#ifndef I2C_MT_SLA_NACK
+#define I2C_MT_SLA_NACK   0x20
+#endif
+#ifndef I2C_MT_DATA_NACK
+#define I2C_MT_DATA_NACK  0x30
+#endif
+#ifndef I2C_MR_SLA_NACK
+#define I2C_MR_SLA_NACK   0x48
+#endif
+#ifndef I2C_MR_DATA_NACK
+#define I2C_MR_DATA_NACK  0x58
+#endif
+#define I2C_SR_SLA_ACK    0x60
+#define I2C_SR_ARB_SLA    0x68
+#define I2C_SR_GCALL_ACK  0x70
+#define I2C_SR_ARB_GCALL  0x78
+#define I2C_SR_DATA_ACK   0x80
+#define I2C_SR_DATA_NACK  0x88
+#define I2C_SR_GCALL_DATA 0x90
+#define I2C_SR_GCALL_NACK 0x98
+#define I2C_SR_STOP       0xA0
+#define I2C_ST_SLA_ACK    0xA8
+#define I2C_ST_ARB_SLA    0xB0
+#define I2C_ST_DATA_ACK   0xB8
+#define I2C_ST_DATA_NACK  0xC0
+#define I2C_ST_LAST_DATA  0xC8
+
+typedef struct{
+byte type;                                          /* I2C_WRITE or I2C_READ ,may be ORed with I2C_RESTART */
+byte size;                                          /* number of bytes ,segments of size 0 are skipped */
+byte * data;
+}I2C_Segment;
+
+typedef struct I2C_Transaction{
+byte address;                                       /* 7 bit slave address */
+byte flags;                                         /* I2C_HOLD_BUS or 0 */
+I2C_Segment * segments;
+byte segmentCount;                                  /* 0 only addresses the device */
+unsigned int bitRate;                               /* I2C_BITRATE(f) or 0 for the bus bit rate */
+volatile int status;                                /* I2C_PENDING ,I2C_SUCCESS or an error code */
+void (*callback)(struct I2C_Transaction * transaction);  /* called on completion ,may be NULL */
+struct I2C_Transaction * next;                      /* used by the queue */
+unsigned long submitTime;                           /* Timer16_Time of I2C_Submit */
+}I2C_Transaction;
+
+/* Variables */
+byte i2cMissing[16];                                /* bit set for each address which did not answer the last scan */
+static struct{
+byte address;
+byte type;                                          /* 0 for a free entry */
+}i2cDevices[I2CDEVICES];
+
+static struct{
+I2C_Transaction * head;                             /* transaction on the bus ,NULL if the queue is empty */
+I2C_Transaction * tail;
+byte segment;
+byte index;
+byte reading;
+byte running;                                       /* head transaction has been started */
+byte polled;                                        /* queue run by I2C_Transfer with interrupts disabled */
+unsigned int bitRate;                               /* bus bit rate set by I2C_SetFrequency */
+volatile byte progress;                             /* set on every bus event ,cleared by I2C_CheckTimeout */
+unsigned int checkedTime;
+unsigned long idleTicks;                            /* time without bus events */
+unsigned long timeout;
+unsigned int recoveries;
+#ifdef _PROFILE_
+byte probe;
+unsigned long startTime;
+#endif
+#ifdef _I2C_STATS_
+byte bytes;                                         /* bytes sent or received by the head transaction */
+#endif
+}i2cQueue;
+
+#ifdef _I2C_STATS_
+typedef struct{
+byte address;                                       /* 0 for a free slot */
+unsigned int transactions;
+unsigned long bytes;
+unsigned int startErrors;                           /* I2C_START_ERROR ,includes arbitration lost to an other master */
+unsigned int addressNacks;
+unsigned int dataNacks;
+unsigned int timeouts;
+unsigned int retries;                               /* sent again after arbitration lost to a master addressing us */
+unsigned int maximum;                               /* longest time from submit to completion in ticks */
+unsigned long total;
+unsigned int histogram[I2CSTATBUCKETS];
+}I2C_AddressStats;
+
+static I2C_AddressStats i2cStats[I2CSTATSLOTS];
+#endif
+
+static struct{
+byte control;                                       /* TWEA and TWIE while the slave is enabled */
+byte * front;                                       /* read only registers seen by the master */
+byte * back;                                        /* read only registers being filled by the program */
+byte readOnlySize;
+byte * readWrite;
+byte readWriteSize;
+byte pointer;
+byte first;                                         /* next byte written sets the pointer */
+volatile byte active;                               /* addressed by a master */
+volatile byte swapPending;
+volatile byte written;
+}i2cSlave;
+
+static void I2C_Complete(I2C_Transaction * transaction,int status);
+
 /* Functions */
 
 /*
 *
 * Name : I2C_Init
-* 
-* Initializes the *I2C* module .This function is already called by the /MegaBoardInit/ function so no need to call 
-* it explicitly unless you want to reinitialize the module .This function does not return any value.
+*
+* Initializes the *I2C* module .This function is already called by the /MegaBoardInit/ function so no need to call
+* it explicitly unless you want to reinitialize the module .The bus is set to I2CFREQUENCY and the timeout to I2CTIMEOUT
+* .The *16 BIT TIMER CHANNELS* module is started as the timeouts are measured with Timer1 .Transactions still in the
+* queue end with I2C_TIMEOUT_ERROR and their completion functions are called .This function does not return any value.
 *
 * E.g. Usage :
 *
@@ -21,21 +233,866 @@
 */
 void I2C_Init()
 {
- TWCR=_BV(TWEN)|_BV(TWEA);
- TWSR=0;
- TWBR=28;
+ I2C_Transaction * transaction;
+ byte sreg=SREG;
+ cli();
+ TWCR=_BV(TWEN)|_BV(TWEA)|i2cSlave.control;
+ i2cQueue.bitRate=I2C_BITRATE(I2CFREQUENCY);
+ TWSR=i2cQueue.bitRate>>8;
+ TWBR=(byte)i2cQueue.bitRate;
+ transaction=i2cQueue.head;
+ i2cQueue.head=NULL;
+ i2cQueue.running=0;
+ i2cQueue.timeout=TIMER16_MS(I2CTIMEOUT);
+ Timer16_Init();
+ while(transaction!=NULL)
+  {
+   I2C_Transaction * next=transaction->next;
+   I2C_Complete(transaction,I2C_TIMEOUT_ERROR);
+   transaction=next;
+  }
+ SREG=sreg;
+}
+
+/*
+*
+* Name : I2C_SetTimeout
+*
+* Sets how long a transaction may make no progress on the bus before it ends with I2C_TIMEOUT_ERROR and the bus is
+* recovered .This function does not return a value .
+*
+* Parameters :
+*
+* /milliSeconds/ - Range 1-65535 .Timeout in milliseconds
+*
+* E.g. Usage :
+*
+* /I2C_SetTimeout (50);/ - Allows slow devices to stretch the clock for up to 50ms
+*/
+void I2C_SetTimeout(unsigned int milliSeconds)
+{
+ byte sreg=SREG;
+ cli();
+ i2cQueue.timeout=TIMER16_MS(milliSeconds);
+ SREG=sreg;
+}
+
+/*
+*
+* Name : I2C_SetFrequency
+*
+* Sets the *SCL* frequency of the bus to the highest one not above the frequency requested .SCL frequency is
+* Main_Clock_Frequency/(16+2*TWBR*4^TWPS) and when the frequency is a constant TWBR and TWPS are worked out by the compiler
+* .Use 100000 for standard mode and 400000 for fast mode devices ,the lowest frequency is about 500Hz .Transactions which
+* are already queued use the new frequency when they start .This function does not return a value .
+*
+* The same calculation is available as macros : /I2C_TWBR(f)/ ,/I2C_TWPS(f)/ and /I2C_BITRATE(f)/ which gives the value
+* for the /bitRate/ field of a transaction .
+*
+* Parameters :
+*
+* /frequency/ - *SCL* frequency in Hz
+*
+* E.g. Usage :
+*
+* /I2C_SetFrequency (400000);/ - Runs the bus at 400kHz (TWBR 12 ,TWPS 0)
+*
+* void I2C_SetFrequency(unsigned long frequency)
+*/
+
+/*
+*
+* Name : I2C_SolveBitRate
+*
+* Works out TWBR and TWPS at run time for a frequency which is not a constant ,the same way as /I2C_BITRATE(f)/ .Returns
+* TWPS in the high byte and TWBR in the low byte ,ready for /I2C_SetBitRate/ or the /bitRate/ field of a transaction
+* .Frequencies below the lowest one get TWBR 255 and TWPS 3 .
+*
+* Parameters :
+*
+* /frequency/ - *SCL* frequency in Hz ,0 is taken as 1
+*
+* E.g. Usage :
+*
+* /transaction.bitRate=I2C_SolveBitRate (speed);/ - Runs one transaction at a frequency read from the user
+*/
+unsigned int I2C_SolveBitRate(unsigned long frequency)
+{
+ byte prescalar;
+ unsigned long cycles,twbr=0;
+ if(frequency==0)
+     frequency=1;
+ cycles=(F_CPU+frequency-1)/frequency;
+ for(prescalar=0;prescalar<4;prescalar++)
+  {
+   twbr=(cycles>16)?(cycles-16+(2UL<<(2*prescalar))-1)/(2UL<<(2*prescalar)):0;
+   if(twbr<=255)
+       break;
+  }
+ if(prescalar==4)
+  {
+   prescalar=3;
+   twbr=255;
+  }
+ return ((unsigned int)prescalar<<8)|(byte)twbr;
+}
+
+/*
+*
+* Name : I2C_SetBitRate
+*
+* Sets the bit rate used by transactions which do not give their own ,as worked out by /I2C_BITRATE(f)/ or
+* /I2C_SolveBitRate/ .Transactions which are already queued use it when they start .This function does not return a
+* value .
+*
+* Parameters :
+*
+* /bitRate/ - TWPS in the high byte and TWBR in the low byte
+*
+* E.g. Usage :
+*
+* /I2C_SetBitRate (I2C_BITRATE(400000));/ - Same as /I2C_SetFrequency (400000);/
+*/
+void I2C_SetBitRate(unsigned int bitRate)
+{
+ byte sreg=SREG;
+ cli();
+ i2cQueue.bitRate=bitRate;
+ SREG=sreg;
+}
+
+/* Returns the index of the first segment from first on which has bytes to transfer */
+static byte I2C_SkipEmpty(I2C_Transaction * transaction,byte first)
+{
+ while(first<transaction->segmentCount && transaction->segments[first].size==0)
+     first++;
+ return first;
+}
+
+/* Returns 1 if the segment continues the current transfer without a repeated START */
+static byte I2C_Continues(I2C_Transaction * transaction,byte next)
+{
+ byte type;
+ if(next>=transaction->segmentCount)
+     return 0;
+ type=transaction->segments[next].type;
+ return !(type&I2C_RESTART) && (type&I2C_READ)==i2cQueue.reading;
+}
+
+/* Starts the transaction at the head of the queue ,called with interrupts disabled */
+static void I2C_StartNext()
+{
+ unsigned int bitRate;
+ i2cQueue.segment=I2C_SkipEmpty(i2cQueue.head,0);
+ i2cQueue.index=0;
+ i2cQueue.reading=0;
+ i2cQueue.running=1;
+ i2cQueue.progress=1;
+#ifdef _I2C_STATS_
+ i2cQueue.bytes=0;
+#endif
+ bitRate=(i2cQueue.head->bitRate!=0)?i2cQueue.head->bitRate:i2cQueue.bitRate;
+ TWSR=bitRate>>8;
+ TWBR=(byte)bitRate;
+#ifdef _PROFILE_
+ i2cQueue.probe=PROFILE_I2C_WRITE;
+ i2cQueue.startTime=Timer16_Time();
+#endif
+ TWCR=_BV(TWINT)|_BV(TWSTA)|_BV(TWEN)|_BV(TWIE)|i2cSlave.control;
+}
+
+/* Waits about half an SCL period at 100kHz */
+static void I2C_HalfBit()
+{
+ unsigned int start=Timer16_Now(TIMER1_CHANNEL_A);
+ while((unsigned int)(Timer16_Now(TIMER1_CHANNEL_A)-start)<I2C_HALFBITTICKS);
+}
+
+/* Clocks SCL until the device holding SDA lets go ,sends a STOP and restarts the TWI ,called with interrupts disabled */
+static void I2C_ClockOut()
+{
+ byte i;
+ byte port=PORTD&(_BV(I2C_SCLPIN)|_BV(I2C_SDAPIN));
+ TWCR=0;                                            /* pins back to PORTD */
+ PORTD&=~(_BV(I2C_SCLPIN)|_BV(I2C_SDAPIN));         /* open drain ,a pin is pulled low by making it an output */
+ DDRD&=~(_BV(I2C_SCLPIN)|_BV(I2C_SDAPIN));
+ I2C_HalfBit();
+ for(i=0;i<9 && !(PIND&_BV(I2C_SDAPIN));i++)
+  {
+   DDRD|=_BV(I2C_SCLPIN);
+   I2C_HalfBit();
+   DDRD&=~_BV(I2C_SCLPIN);
+   I2C_HalfBit();
+  }
+ DDRD|=_BV(I2C_SCLPIN);                             /* STOP ,SDA rises while SCL is high */
+ I2C_HalfBit();
+ DDRD|=_BV(I2C_SDAPIN);
+ I2C_HalfBit();
+ DDRD&=~_BV(I2C_SCLPIN);
+ I2C_HalfBit();
+ DDRD&=~_BV(I2C_SDAPIN);
+ I2C_HalfBit();
+ PORTD|=port;
+ TWCR=_BV(TWEN)|_BV(TWEA)|i2cSlave.control;
+ i2cQueue.recoveries++;
+}
+
+/* Waits for the STOP to be sent ,returns 0 if the bus is held */
+static byte I2C_WaitStop()
+{
+ unsigned int start=Timer16_Now(TIMER1_CHANNEL_A);
+ while(TWCR&_BV(TWSTO))
+     if((unsigned int)(Timer16_Now(TIMER1_CHANNEL_A)-start)>I2C_STOPTICKS)
+         return 0;
+ return 1;
+}
+
+#ifdef _I2C_STATS_
+/* Returns the statistics slot of an address ,taking a free one the first time */
+static byte I2C_StatsSlot(byte address)
+{
+ byte slot;
+ for(slot=0;slot<I2CSTATSLOTS-1;slot++)
+     if(i2cStats[slot].address==address || i2cStats[slot].address==0)
+         break;
+ if(slot==I2CSTATSLOTS-1)
+     address=I2C_STATS_OTHER;
+ i2cStats[slot].address=address;
+ return slot;
+}
+
+/* Adds a completed transaction to the statistics of its address */
+static void I2C_StatsRecord(I2C_Transaction * transaction,int status,byte bytes)
+{
+ byte bucket=0;
+ unsigned long ticks=Timer16_Time()-transaction->submitTime;
+ unsigned int time=(ticks>0xFFFF)?0xFFFF:(unsigned int)ticks;
+ byte slot=I2C_StatsSlot(transaction->address);
+ i2cStats[slot].transactions++;
+ i2cStats[slot].bytes+=bytes;
+ if(status==I2C_START_ERROR)
+     i2cStats[slot].startErrors++;
+ else if(status==I2C_SLAVEACK_ERROR)
+     i2cStats[slot].addressNacks++;
+ else if(status==I2C_SLAVEDATA_ERROR)
+     i2cStats[slot].dataNacks++;
+ else if(status==I2C_TIMEOUT_ERROR)
+     i2cStats[slot].timeouts++;
+ while(bucket<I2CSTATBUCKETS-1 && (time>>(bucket+1))!=0)
+     bucket++;
+ if(time>i2cStats[slot].maximum)
+     i2cStats[slot].maximum=time;
+ i2cStats[slot].total+=time;
+ if(i2cStats[slot].histogram[bucket]!=0xFFFF)
+     i2cStats[slot].histogram[bucket]++;
+}
+#endif
+
+/* Sets the status of a transaction which is off the queue and calls its completion function ,called with interrupts
+   disabled */
+static void I2C_Complete(I2C_Transaction * transaction,int status)
+{
+ transaction->status=status;
+ if(transaction->callback!=NULL)
+  {
+   /* No master transfer is running so the completion function can run with interrupts enabled ,the slave is still
+      served meanwhile and transactions it submits start at once unless the slave is addressed */
+#ifndef _BLOCKING_CALLBACKS_
+   if(!i2cQueue.polled)
+    {
+     if(++isrDeferredDepth>isrDeferredMaxDepth)
+         isrDeferredMaxDepth=isrDeferredDepth;
+     sei();
+     transaction->callback(transaction);
+     cli();
+     isrDeferredDepth--;
+    }
+   else
+#endif
+     transaction->callback(transaction);
+  }
+}
+
+/* Ends the transaction at the head of the queue ,calls its completion function and starts the next one */
+static void I2C_Finish(int status)
+{
+ I2C_Transaction * transaction=i2cQueue.head;
+
+ if(status==I2C_TIMEOUT_ERROR)
+   ;                                                /* bus already recovered */
+ else if(status!=I2C_SUCCESS || !(transaction->flags&I2C_HOLD_BUS))
+  {
+   TWCR=_BV(TWINT)|_BV(TWSTO)|_BV(TWEN)|i2cSlave.control;
+   if(!I2C_WaitStop())
+    {
+     I2C_ClockOut();
+     status=I2C_TIMEOUT_ERROR;
+    }
+  }
+ else
+   TWCR=_BV(TWEN);                                  /* TWINT stays set and holds SCL low until the next START ,the
+                                                       slave cannot be addressed meanwhile */
+
+#ifdef _PROFILE_
+ Profile_Record(i2cQueue.probe,Timer16_Time()-i2cQueue.startTime);
+#endif
+#ifdef _I2C_STATS_
+ I2C_StatsRecord(transaction,status,i2cQueue.bytes);
+#endif
+ i2cQueue.head=transaction->next;
+ i2cQueue.running=0;
+ I2C_Complete(transaction,status);
+ if(!i2cQueue.running && i2cQueue.head!=NULL && !i2cSlave.active)
+     I2C_StartNext();
+}
+
+/* Moves on to the next segment after the current one is done */
+static void I2C_NextSegment(I2C_Transaction * transaction)
+{
+ byte next=transaction->segmentCount;
+ if(i2cQueue.segment<transaction->segmentCount)
+     next=I2C_SkipEmpty(transaction,i2cQueue.segment+1);
+ if(next>=transaction->segmentCount)
+  {
+   I2C_Finish(I2C_SUCCESS);
+   return;
+  }
+ if(!I2C_Continues(transaction,next))
+  {
+   i2cQueue.segment=next;
+   i2cQueue.index=0;
+   TWCR=_BV(TWINT)|_BV(TWSTA)|_BV(TWEN)|_BV(TWIE)|i2cSlave.control;
+   return;
+  }
+ i2cQueue.segment=next;                             /* another write segment ,bytes follow on */
+ i2cQueue.index=1;
+ TWDR=transaction->segments[next].data[0];
+ TWCR=_BV(TWINT)|_BV(TWEN)|_BV(TWIE);
+}
+
+/* Sets up the reception of the next byte ,ACKed unless it is the last one before a STOP or repeated START */
+static void I2C_ReadNext(I2C_Transaction * transaction)
+{
+ I2C_Segment * segment=transaction->segments+i2cQueue.segment;
+ if(i2cQueue.index>=segment->size)                 /* the read goes on into the next segment */
+  {
+   i2cQueue.segment=I2C_SkipEmpty(transaction,i2cQueue.segment+1);
+   i2cQueue.index=0;
+   segment=transaction->segments+i2cQueue.segment;
+  }
+ if(i2cQueue.index+1<segment->size || I2C_Continues(transaction,I2C_SkipEmpty(transaction,i2cQueue.segment+1)))
+     TWCR=_BV(TWINT)|_BV(TWEA)|_BV(TWEN)|_BV(TWIE);
+ else
+     TWCR=_BV(TWINT)|_BV(TWEN)|_BV(TWIE);
+}
+
+/* Swaps the read only register buffers if a swap is pending ,called between slave transfers */
+static void I2C_SlaveSwap()
+{
+ byte * buffer;
+ if(!i2cSlave.swapPending)
+     return;
+ buffer=i2cSlave.front;
+ i2cSlave.front=i2cSlave.back;
+ i2cSlave.back=buffer;
+ i2cSlave.swapPending=0;
+}
+
+/* Handles the slave status codes */
+static void I2C_SlaveStep(byte code)
+{
+ byte data,pointer;
+ switch(code)
+  {
+   case I2C_SR_SLA_ACK:
+   case I2C_SR_ARB_SLA:
+   case I2C_SR_GCALL_ACK:
+   case I2C_SR_ARB_GCALL:
+       i2cSlave.active=1;
+       i2cSlave.first=1;
+       break;
+
+   case I2C_SR_DATA_ACK:
+   case I2C_SR_GCALL_DATA:
+       data=TWDR;
+       if(i2cSlave.first)
+        {
+         i2cSlave.pointer=data;
+         i2cSlave.first=0;
+         break;
+        }
+       pointer=i2cSlave.pointer++;
+       if(pointer>=i2cSlave.readOnlySize && (byte)(pointer-i2cSlave.readOnlySize)<i2cSlave.readWriteSize)
+        {
+         i2cSlave.readWrite[pointer-i2cSlave.readOnlySize]=data;
+         i2cSlave.written=1;
+        }
+       break;
+
+   case I2C_ST_SLA_ACK:
+   case I2C_ST_ARB_SLA:
+       i2cSlave.active=1;
+       I2C_SlaveSwap();
+       /* fall through */
+   case I2C_ST_DATA_ACK:
+       pointer=i2cSlave.pointer++;
+       if(pointer<i2cSlave.readOnlySize)
+           TWDR=i2cSlave.front[pointer];
+       else if((byte)(pointer-i2cSlave.readOnlySize)<i2cSlave.readWriteSize)
+           TWDR=i2cSlave.readWrite[pointer-i2cSlave.readOnlySize];
+       else
+           TWDR=0xFF;
+       break;
+
+   case I2C_SR_STOP:
+   case I2C_ST_DATA_NACK:
+   case I2C_ST_LAST_DATA:
+       i2cSlave.active=0;
+       I2C_SlaveSwap();
+       if(!i2cQueue.running && i2cQueue.head!=NULL)
+        {
+         I2C_StartNext();                           /* START is sent as soon as the bus is free */
+         return;
+        }
+       break;
+  }
+ TWCR=_BV(TWINT)|_BV(TWEN)|i2cSlave.control;
+}
+
+/* Runs one step of the transaction at the head of the queue ,called when TWINT is set */
+static void I2C_Step()
+{
+ I2C_Transaction * transaction=i2cQueue.head;
+ I2C_Segment * segment;
+ byte i2cSlaveAdd;
+ byte code=I2C_SCODE;
+
+ i2cQueue.progress=1;
+#ifdef _I2C_STATS_
+ if(code==I2C_MT_DATA_ACK || code==I2C_MT_DATA_NACK || code==I2C_MR_DATA_ACK || code==I2C_MR_DATA_NACK)
+     i2cQueue.bytes++;
+#endif
+ if(code>=I2C_SR_SLA_ACK && code<=I2C_ST_LAST_DATA)
+  {
+   if(code==I2C_SR_ARB_SLA || code==I2C_SR_ARB_GCALL || code==I2C_ST_ARB_SLA)
+    {
+     i2cQueue.running=0;                            /* arbitration lost ,the transaction is sent again afterwards */
+#ifdef _I2C_STATS_
+     if(transaction!=NULL)
+         i2cStats[I2C_StatsSlot(transaction->address)].retries++;
+#endif
+    }
+   else if(code==I2C_SR_SLA_ACK || code==I2C_SR_GCALL_ACK || code==I2C_ST_SLA_ACK)
+     i2cQueue.running=0;                            /* a START waiting for the bus is cancelled when another master
+                                                       addresses us ,the transaction is started again afterwards */
+   I2C_SlaveStep(code);
+   return;
+  }
+ if(transaction==NULL || !i2cQueue.running)
+  {
+   TWCR=_BV(TWEN)|i2cSlave.control;
+   return;
+  }
+ i2cSlaveAdd=transaction->address;
+ segment=transaction->segments+i2cQueue.segment;
+
+ switch(code)
+  {
+   case I2C_START:
+   case I2C_REP_START:
+       i2cQueue.reading=(i2cQueue.segment<transaction->segmentCount)?(segment->type&I2C_READ):0;
+       if(i2cQueue.reading)
+        {
+#ifdef _PROFILE_
+         i2cQueue.probe=PROFILE_I2C_READ;
+#endif
+         TWDR=I2C_SLA_R;
+        }
+       else
+         TWDR=I2C_SLA_W;
+       TWCR=_BV(TWINT)|_BV(TWEN)|_BV(TWIE);
+       break;
+
+   case I2C_MT_SLA_ACK:
+   case I2C_MT_DATA_ACK:
+       if(i2cQueue.segment<transaction->segmentCount && i2cQueue.index<segment->size)
+        {
+         TWDR=segment->data[i2cQueue.index++];
+         TWCR=_BV(TWINT)|_BV(TWEN)|_BV(TWIE);
+        }
+       else
+         I2C_NextSegment(transaction);
+       break;
+
+   case I2C_MR_DATA_ACK:
+       segment->data[i2cQueue.index++]=TWDR;
+       /* fall through */
+   case I2C_MR_SLA_ACK:
+       I2C_ReadNext(transaction);
+       break;
+
+   case I2C_MR_DATA_NACK:
+       segment->data[i2cQueue.index]=TWDR;
+       I2C_NextSegment(transaction);
+       break;
+
+   case I2C_MT_SLA_NACK:
+   case I2C_MR_SLA_NACK:
+       I2C_Finish(I2C_SLAVEACK_ERROR);
+       break;
+
+   case I2C_MT_DATA_NACK:
+       I2C_Finish(I2C_SLAVEDATA_ERROR);
+       break;
+
+   case 0x00:                                       /* bus error ,illegal START or STOP */
+       I2C_ClockOut();
+       I2C_Finish(I2C_TIMEOUT_ERROR);
+       break;
+
+   default:                                         /* arbitration lost ,counted as a start error not a retry */
+       I2C_Finish(I2C_START_ERROR);
+       break;
+  }
+}
+
+ISR_DEFERRABLE(SIG_2WIRE_SERIAL)
+{
+ I2C_Step();
+}
+
+/*
+*
+* Name : I2C_RecoverBus
+*
+* Frees a bus which is held by a device .Up to nine clock pulses are sent on *SCL* until the device lets go of *SDA* ,then
+* a *STOP* is sent and the *TWI* is restarted .A transaction which is on the bus ends with I2C_TIMEOUT_ERROR .This is
+* done automatically when a transaction times out so you only need it after a power glitch on the devices .Returns 1 if
+* the bus is free afterwards else I2C_TIMEOUT_ERROR .
+*
+* E.g. Usage :
+*
+* /I2C_RecoverBus ();/ - Frees the bus
+*/
+int I2C_RecoverBus()
+{
+ int returnValue=I2C_SUCCESS;
+ byte sreg=SREG;
+ cli();
+ I2C_ClockOut();
+ if((PIND&(_BV(I2C_SCLPIN)|_BV(I2C_SDAPIN)))!=(_BV(I2C_SCLPIN)|_BV(I2C_SDAPIN)))
+     returnValue=I2C_TIMEOUT_ERROR;
+ if(i2cQueue.running)
+     I2C_Finish(I2C_TIMEOUT_ERROR);
+ SREG=sreg;
+ return returnValue;
+}
+
+/* Ends the first queued transaction which has not started I2CQUEUETIMEOUT after it was submitted ,returns 1 if one was
+   ended ,called with interrupts disabled */
+static byte I2C_Expire(unsigned long now)
+{
+ I2C_Transaction * previous=NULL;
+ I2C_Transaction * transaction=i2cQueue.head;
+ if(transaction!=NULL && i2cQueue.running)
+  {
+   previous=transaction;
+   transaction=transaction->next;
+  }
+ for(;transaction!=NULL;previous=transaction,transaction=transaction->next)
+   if(now-transaction->submitTime>TIMER16_MS(I2CQUEUETIMEOUT))
+    {
+     if(previous==NULL)
+         i2cQueue.head=transaction->next;
+     else
+         previous->next=transaction->next;
+     if(i2cQueue.tail==transaction)
+         i2cQueue.tail=previous;
+#ifdef _I2C_STATS_
+     I2C_StatsRecord(transaction,I2C_TIMEOUT_ERROR,0);
+#endif
+     I2C_Complete(transaction,I2C_TIMEOUT_ERROR);
+     return 1;
+    }
+ return 0;
+}
+
+/*
+*
+* Name : I2C_CheckTimeout
+*
+* Ends the transaction on the bus with I2C_TIMEOUT_ERROR and recovers the bus if there has been no bus activity for the
+* timeout .Queued transactions which have not started I2CQUEUETIMEOUT after /I2C_Submit/ also end with
+* I2C_TIMEOUT_ERROR .The blocking functions and /I2C_WaitFor/ call it while they wait .If you only use /I2C_Submit/ call
+* it regularly ,at least every 30ms ,e.g. from the *RTC* interrupt function .Returns I2C_TIMEOUT_ERROR if a transaction
+* was ended else 1 .
+*
+* E.g. Usage :
+*
+* /I2C_CheckTimeout ();/ - Checks the bus for a timeout
+*/
+int I2C_CheckTimeout()
+{
+ int returnValue=I2C_SUCCESS;
+ unsigned int now;
+ byte sreg=SREG;
+ cli();
+ now=Timer16_Now(TIMER1_CHANNEL_A);
+ if(!i2cQueue.running || i2cQueue.progress)
+  {
+   i2cQueue.progress=0;
+   i2cQueue.idleTicks=0;
+  }
+ else
+  {
+   i2cQueue.idleTicks+=(unsigned int)(now-i2cQueue.checkedTime);
+   if(i2cQueue.idleTicks>i2cQueue.timeout)
+    {
+     I2C_ClockOut();
+     I2C_Finish(I2C_TIMEOUT_ERROR);
+     returnValue=I2C_TIMEOUT_ERROR;
+    }
+  }
+ i2cQueue.checkedTime=now;
+ while(I2C_Expire(Timer16_Time()))
+     returnValue=I2C_TIMEOUT_ERROR;
+ SREG=sreg;
+ return returnValue;
+}
+
+/*
+*
+* Name : I2C_GetRecoveryCount
+*
+* Returns the number of times the bus has been recovered since the MCU was started .A growing count points to a failing
+* device or a loose cable .
+*
+* E.g. Usage :
+*
+* /Uart1_printf ("%u",I2C_GetRecoveryCount ());/ - Prints the number of bus recoveries
+*/
+unsigned int I2C_GetRecoveryCount()
+{
+ return i2cQueue.recoveries;
+}
+
+#ifdef _I2C_STATS_
+
+/*
+*
+* Name : I2C_StatsReset
+*
+* Clears the statistics of all the addresses .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /I2C_StatsReset ();/ - Starts a new measurement
+*/
+void I2C_StatsReset()
+{
+ byte sreg=SREG;
+ cli();
+ memset(i2cStats,0,sizeof(i2cStats));
+ SREG=sreg;
+}
+
+/*
+*
+* Name : I2C_StatsDump
+*
+* Prints the statistics of every address on *UART1* (or with I2C_STATS_printf if defined) .Each address is printed on
+* two lines ,first the address ,number of transactions and bytes ,start errors ,address NACKs ,data NACKs ,timeouts ,
+* retries and the maximum and mean time from submit to completion in ticks of 0.5us ,then the histogram where column n
+* counts the times from 2^n to 2^(n+1)-1 ticks .Retries only count the arbitrations lost to a master which addressed
+* the MCU ,the other lost arbitrations are start errors .Address 0x80 collects the addresses beyond the first
+* I2CSTATSLOTS-1 .
+* This function does not return a value .
+*
+* E.g. Usage :
+*
+* /I2C_StatsDump ();/ - Prints the bus statistics
+*/
+void I2C_StatsDump()
+{
+ byte slot,bucket,sreg;
+ I2C_AddressStats stats;
+ I2C_STATS_printf("addr count bytes start sla data timeout retry max mean (ticks of 0.5us)\r\n");
+ for(slot=0;slot<I2CSTATSLOTS;slot++)
+  {
+   sreg=SREG;
+   cli();
+   memcpy(&stats,&i2cStats[slot],sizeof(stats));
+   SREG=sreg;
+   if(stats.transactions==0)
+       continue;
+   I2C_STATS_printf("%02x %u %lu %u %u %u %u %u %u %lu\r\n",stats.address,stats.transactions,stats.bytes,
+                    stats.startErrors,stats.addressNacks,stats.dataNacks,stats.timeouts,stats.retries,stats.maximum,
+                    stats.total/stats.transactions);
+   for(bucket=0;bucket<I2CSTATBUCKETS;bucket++)
+       I2C_STATS_printf(" %u",stats.histogram[bucket]);
+   I2C_STATS_printf("\r\n");
+  }
+}
+
+#else
+
+#define I2C_StatsReset()
+#define I2C_StatsDump()
+
+#endif
+
+/*
+*
+* Name : I2C_Submit
+*
+* Adds a transaction to the end of the transfer queue and returns at once .The segments of the transaction are sent to
+* the device with the address /address/ and a STOP is sent at the end unless the flag I2C_HOLD_BUS is set .The last byte
+* of every read is NACKed .If the /bitRate/ field is not 0 the transaction runs at that bit rate ,e.g. I2C_BITRATE(400000)
+* ,instead of the bus frequency .The /status/ field is I2C_PENDING until the transaction is complete and then I2C_SUCCESS or an
+* error code ,after that the /callback/ function is called if it is not NULL .The transaction and its segments must not
+* be changed while it is queued .Returns I2C_SUCCESS or I2C_BUSY_ERROR if the transaction is already in the queue .
+*
+* Parameters :
+*
+* /transaction/ - Pointer to the transaction ,must stay valid until it is complete
+*
+* E.g. Usage :
+*
+* /I2C_Submit (&compassRead);/ - Queues the transaction compassRead
+*/
+int I2C_Submit(I2C_Transaction * transaction)
+{
+ I2C_Transaction * queued;
+ byte sreg=SREG;
+ cli();
+ for(queued=i2cQueue.head;queued!=NULL;queued=queued->next)
+     if(queued==transaction)
+      {
+       SREG=sreg;
+       return I2C_BUSY_ERROR;
+      }
+ transaction->status=I2C_PENDING;
+ transaction->next=NULL;
+ transaction->submitTime=Timer16_Time();
+ if(i2cQueue.head==NULL)
+     i2cQueue.head=transaction;
+ else
+     i2cQueue.tail->next=transaction;
+ i2cQueue.tail=transaction;
+ if(!i2cQueue.running && !i2cSlave.active)
+     I2C_StartNext();
+ SREG=sreg;
+ return I2C_SUCCESS;
+}
+
+/*
+*
+* Name : I2C_WaitFor
+*
+* Waits until a submitted transaction is complete and returns its status ,I2C_SUCCESS or an error code .If interrupts
+* are disabled the queue is run by polling so it may also be called from an interrupt handler .The wait ends with
+* I2C_TIMEOUT_ERROR if the bus makes no progress for the timeout or the transaction has not started I2CQUEUETIMEOUT
+* after it was submitted .
+*
+* Parameters :
+*
+* /transaction/ - Pointer to a transaction given to /I2C_Submit/
+*
+* E.g. Usage :
+*
+* /I2C_WaitFor (&compassRead);/ - Waits for the transaction compassRead
+*/
+int I2C_WaitFor(I2C_Transaction * transaction)
+{
+ byte polled;
+ if(SREG&_BV(SREG_I))
+  {
+   while(transaction->status==I2C_PENDING)
+       I2C_CheckTimeout();
+   return transaction->status;
+  }
+ polled=i2cQueue.polled;
+ i2cQueue.polled=1;
+ while(transaction->status==I2C_PENDING)
+  {
+   if(TWCR&_BV(TWINT))
+       I2C_Step();
+   else
+       I2C_CheckTimeout();
+  }
+ i2cQueue.polled=polled;
+ return transaction->status;
+}
+
+/*
+*
+* Name : I2C_Transfer
+*
+* Runs a transaction made of a list of segments and waits until it is complete .The return value is an integer which is
+* negative for error and has value 1 if the operation succeeds .
+*
+* Parameters :
+*
+* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address
+*
+* /segments/ - Array of segments
+*
+* /segmentCount/ - Number of segments in the array
+*
+* /flags/ - I2C_HOLD_BUS to leave out the *STOP* condition else 0
+*
+* Return Error Codes :
+*
+*  -1      - Start Condition problem
+*  -2      - Address Mismatch
+*  -3      - Data Transmission Error
+*  -5      - Bus timeout or bus error ,the bus has been recovered
+*
+* E.g. Usage :
+*
+* /I2C_Segment segments[3]={{I2C_WRITE,3,config},{I2C_WRITE|I2C_RESTART,1,&statusRegister},{I2C_READ,1,&status}};/
+*
+* /I2C_Transfer (0x70,segments,3,0);/ - Writes a register address and two configuration bytes ,then reads a status
+* register in the same bus transaction
+*/
+int I2C_Transfer(byte i2cSlaveAdd,I2C_Segment * segments,byte segmentCount,byte flags)
+{
+ I2C_Transaction transaction;
+ transaction.address=i2cSlaveAdd;
+ transaction.flags=flags;
+ transaction.segments=segments;
+ transaction.segmentCount=segmentCount;
+ transaction.bitRate=0;
+ transaction.callback=NULL;
+ I2C_Submit(&transaction);
+ return I2C_WaitFor(&transaction);
+}
+
+/*
+*
+* Name : I2C_IsIdle
+*
+* Returns 1 if the transfer queue is empty else returns 0 .
+*
+* E.g. Usage :
+*
+* /if (I2C_IsIdle ()) Sleep ();/ - Sleeps only when there is no bus activity
+*/
+byte I2C_IsIdle()
+{
+ return i2cQueue.head==NULL;
 }
 
 /*
 *
 * Name : I2C_WriteData
-* 
+*
 * This function writes an array of bytes to an i2c device .The return value is an integer which is negative for error and
 * has value 1 if the operation succeeds.
 *
 * Parameters
 *
-* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address 
+* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address
 * /i2cData/ - Array of bytes to be written
 * /i2cDataSize/ - Range 0-255 .Number of bytes to be written
 * /stopFlag/ - Range 0 or 1 . If 0 then *STOP* condition is not written on the bus else it is written
@@ -44,66 +1101,29 @@ void I2C_Init()
 *
 *  -1      - Start Condition problem
 *  -2      - Address Mismatch
-*  -3      - Data Transmission Error 
-* 
+*  -3      - Data Transmission Error
+*  -5      - Bus timeout or bus error ,the bus has been recovered
+*
 * E.g. Usage :
 *
-* /I2C_WriteData (0x70,"\x00\x50",2,1);/ - Writes bytes 0x00 and 0x50 to an *I2C* device with address 0x70 
+* /I2C_WriteData (0x70,"\x00\x50",2,1);/ - Writes bytes 0x00 and 0x50 to an *I2C* device with address 0x70
 */
 int I2C_WriteData(byte i2cSlaveAdd,byte * i2cData,byte i2cDataSize,byte stopFlag)
 {
-  byte i;
-  GEN_START();
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_START && I2C_SCODE!=I2C_REP_START)
-  {
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_START_ERROR;
-  }
-
-  TWDR=I2C_SLA_W;
-  CLR_TWINT();  
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MT_SLA_ACK)
-  {   
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_SLAVEACK_ERROR;
-  }
-
-  for(i=0;i<i2cDataSize;i++)
-  {
-   TWDR=i2cData[i];
-   CLR_TWINT();  
-   I2C_Wait();
-   if(I2C_SCODE!=I2C_MT_DATA_ACK)
-   {
-       GEN_STOP();
-       I2C_WaitForStop();
-       return I2C_SLAVEDATA_ERROR;
-   }
-  }
-  
-  if(stopFlag)
-  {
-   GEN_STOP();
-   I2C_WaitForStop();
-  }
-
- return I2C_SUCCESS;  
+ I2C_Segment segment={I2C_WRITE,i2cDataSize,i2cData};
+ return I2C_Transfer(i2cSlaveAdd,&segment,1,stopFlag?0:I2C_HOLD_BUS);
 }
 
 /*
 *
 * Name : I2C_WriteRegister
-* 
+*
 * This function writes an array of bytes to an i2c device register .The return value is an integer which is negative for error and
 * has value 1 if the operation succeeds.
 *
 * Parameters
 *
-* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address 
+* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address
 * /registerAddress/ - Range 0-255 . *I2C* device register address
 * /i2cData/ - Array of bytes to be written
 * /i2cDataSize/ - Range 0-255 .Number of bytes to be written
@@ -113,229 +1133,306 @@ int I2C_WriteData(byte i2cSlaveAdd,byte * i2cData,byte i2cDataSize,byte stopFlag
 *
 *  -1      - Start Condition problem
 *  -2      - Address Mismatch
-*  -3      - Data Transmission Error 
-* 
+*  -3      - Data Transmission Error
+*  -5      - Bus timeout or bus error ,the bus has been recovered
+*
 * E.g. Usage :
 *
-* /I2C_WriteRegister (0x70,0,"\x50",1,1);/ - Writes byte 0x50 to the register 0 of an *I2C* device with address 0x70 
+* /I2C_WriteRegister (0x70,0,"\x50",1,1);/ - Writes byte 0x50 to the register 0 of an *I2C* device with address 0x70
 */
 int I2C_WriteRegister(byte i2cSlaveAdd,byte registerAddress,byte * i2cData,byte i2cDataSize,byte stopFlag)
 {
-  byte i;
-  GEN_START();
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_START && I2C_SCODE!=I2C_REP_START)
-  {
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_START_ERROR;
-  }
-
-  TWDR=I2C_SLA_W;
-  CLR_TWINT();  
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MT_SLA_ACK)
-   {   
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_SLAVEACK_ERROR;
-   }
-
-  TWDR=registerAddress;
-  CLR_TWINT();  
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MT_DATA_ACK)
-   {
-       GEN_STOP();
-       I2C_WaitForStop();
-       return I2C_SLAVEDATA_ERROR;
-   }
-
-  for(i=0;i<i2cDataSize;i++)
-  {
-   TWDR=i2cData[i];
-   CLR_TWINT();  
-   I2C_Wait();
-   if(I2C_SCODE!=I2C_MT_DATA_ACK)
-   {
-       GEN_STOP();
-       I2C_WaitForStop();
-       return I2C_SLAVEDATA_ERROR;
-   }
-  }
-  
-  if(stopFlag)
-  {
-   GEN_STOP();
-   I2C_WaitForStop();
-  }
-
- return I2C_SUCCESS;  
-
+ I2C_Segment segments[2]={{I2C_WRITE,1,&registerAddress},{I2C_WRITE,i2cDataSize,i2cData}};
+ return I2C_Transfer(i2cSlaveAdd,segments,2,stopFlag?0:I2C_HOLD_BUS);
 }
 
 
 /*
 *
 * Name : I2C_ReadData
-* 
-* This function reads an array of bytes from an *I2C* device .The return value is an integer which is negative for error and
-* has value 1 if the operation succeeds.
+*
+* This function reads an array of bytes from an *I2C* device .The last byte is NACKed so the device releases the bus and
+* with /stopFlag/ 1 the *STOP* condition ends the read in the same transaction .The return value is an integer which is
+* negative for error and has value 1 if the operation succeeds.
 *
 * Parameters
 *
-* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address 
-* /registerAddress/ - Range 0-255 . *I2C* device register address
+* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address
 * /i2cData/ - Pointer to the array of bytes to which data will be read
-* /i2cDataSize/ - Range 0-255 .Number of bytes to be written
+* /i2cDataSize/ - Range 0-255 .Number of bytes to be read
 * /stopFlag/ - Range 0 or 1 . If 0 then *STOP* condition is not written on the bus else it is written
 *
 * Return Error Codes :
 *
 *  -1      - Start Condition problem
 *  -2      - Address Mismatch
-*  -3      - Data Transmission Error 
+*  -3      - Data Transmission Error
+*  -5      - Bus timeout or bus error ,the bus has been recovered
 *
 * E.g. Usage :
 *
-* /I2C_ReadRegister (0x70,2,inputArray,1,1);/ - Reads one byte from the register number 2 of an *I2C* device with address 0x70 and stores the byte in inputArray 
+* /I2C_ReadData (0x70,inputArray,2,1);/ - Reads two bytes from an *I2C* device with address 0x70 and stores them in the inputArray
 */
 int I2C_ReadData(byte i2cSlaveAdd,byte * i2cData,byte i2cDataSize,byte stopFlag)
 {
-  byte i;
-  GEN_START();
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_START && I2C_SCODE!=I2C_REP_START)
-   {
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_START_ERROR;
-   }
-  
-  TWDR=I2C_SLA_R;
-  CLR_TWINT(); 
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MR_SLA_ACK)
-   {  
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_SLAVEACK_ERROR;
-   }
-  
-  for(i=0;i<i2cDataSize;i++)
-   {
-    CLR_TWINT();  
-    I2C_Wait();
-    if(I2C_SCODE!=I2C_MR_DATA_ACK)
-     {
-       GEN_STOP();
-       I2C_WaitForStop();      
-       return I2C_SLAVEDATA_ERROR;
-     }
-    i2cData[i]=TWDR;
-   }
-  
-  if(stopFlag)
-   {
-    GEN_STOP();
-    I2C_WaitForStop();
-   }
- return I2C_SUCCESS;  
-} 
+ I2C_Segment segment={I2C_READ,i2cDataSize,i2cData};
+ return I2C_Transfer(i2cSlaveAdd,&segment,1,stopFlag?0:I2C_HOLD_BUS);
+}
 
 /*
 *
 * Name : I2C_ReadRegister
-* 
-* This function reads an array of bytes from a register of an *I2C* device .The return value is an integer which is negative for error and
-* has value 1 if the operation succeeds.
+*
+* This function reads an array of bytes from a register of an *I2C* device .The register address is written and the
+* bytes are read after a repeated START in the same transaction ,the last byte is NACKed and with /stopFlag/ 1 the
+* *STOP* condition follows at once .There is no need to release the bus with a separate /I2C_WriteData/ call .The return
+* value is an integer which is negative for error and has value 1 if the operation succeeds.
 *
 * Parameters
 *
-* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address 
+* /i2cSlaveAdd/ - Range 1-127 . *I2C* slave address
+* /registerAddress/ - Range 0-255 . *I2C* device register address
 * /i2cData/ - Pointer to the array of bytes to which data will be read
-* /i2cDataSize/ - Range 0-255 .Number of bytes to be written
+* /i2cDataSize/ - Range 0-255 .Number of bytes to be read
 * /stopFlag/ - Range 0 or 1 . If 0 then *STOP* condition is not written on the bus else it is written
 *
 * Return Error Codes :
 *
 *  -1      - Start Condition problem
 *  -2      - Address Mismatch
-*  -3      - Data Transmission Error 
+*  -3      - Data Transmission Error
+*  -5      - Bus timeout or bus error ,the bus has been recovered
 *
 * E.g. Usage :
 *
-* /I2C_ReadData (0x70,inputArray,2,1);/ - Reads two bytes from an *I2C* device with address 0x70 and stores them in the inputArray 
+* /I2C_ReadRegister (0x70,2,inputArray,1,1);/ - Reads one byte from the register number 2 of an *I2C* device with address 0x70 and stores the byte in inputArray
 */
 int I2C_ReadRegister(byte i2cSlaveAdd,byte registerAddress,byte * i2cData,byte i2cDataSize,byte stopFlag)
 {
-  byte i;
+ I2C_Segment segments[2]={{I2C_WRITE,1,&registerAddress},{I2C_READ,i2cDataSize,i2cData}};
+ return I2C_Transfer(i2cSlaveAdd,segments,2,stopFlag?0:I2C_HOLD_BUS);
+}
 
-  GEN_START();
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_START && I2C_SCODE!=I2C_REP_START)
+/*
+*
+* Name : I2C_Scan
+*
+* Finds the devices on the bus between two addresses .Each address gets a *START* ,the address with the write bit and a
+* *STOP* ,about 30 bit times .The addresses which answer are added to the device table and the others are marked as
+* missing for /I2C_IsMissing/ .If an identify function is given it is called for every device found and returns the
+* type stored in the table ,e.g. /I2C_IdentifySensor/ of the *I2C SENSORS* module .Devices which are busy ,like an
+* *SRF08* while ranging ,do not answer so scan when they are idle .Returns the number of devices found .
+*
+* Parameters :
+*
+* /firstAddress/ - Range 1-127 .First address to probe
+*
+* /lastAddress/ - Range 1-127 .Last address to probe
+*
+* /identify/ - Function which returns the type of the device at an address ,or NULL to store I2C_DEVICE_UNKNOWN
+*
+* E.g. Usage :
+*
+* /I2C_Scan (1,127,I2C_IdentifySensor);/ - Finds and identifies all the devices on the bus
+*
+* /I2C_Scan (0x70,0x7F,NULL);/ - Finds the *SRF08* sonars
+*/
+byte I2C_Scan(byte firstAddress,byte lastAddress,byte (*identify)(byte address))
+{
+ byte address,i,found=0;
+ for(i=0;i<I2CDEVICES;i++)
+     if(i2cDevices[i].address>=firstAddress && i2cDevices[i].address<=lastAddress)
+         i2cDevices[i].type=0;
+ for(address=firstAddress;address<=lastAddress && address<128;address++)
   {
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_START_ERROR;
+   if(I2C_Transfer(address,NULL,0,0)!=I2C_SUCCESS)
+    {
+     i2cMissing[address>>3]|=_BV(address&7);
+     continue;
+    }
+   i2cMissing[address>>3]&=~_BV(address&7);
+   found++;
+   for(i=0;i<I2CDEVICES && i2cDevices[i].type!=0;i++);
+   if(i<I2CDEVICES)
+    {
+     i2cDevices[i].address=address;
+     i2cDevices[i].type=(identify!=NULL)?identify(address):I2C_DEVICE_UNKNOWN;
+     if(i2cDevices[i].type==0)
+         i2cDevices[i].type=I2C_DEVICE_UNKNOWN;
+    }
   }
+ return found;
+}
+
+/*
+*
+* Name : I2C_IsMissing
+*
+* Returns 1 if the device did not answer the last scan which included its address else returns 0 ,also for addresses
+* never scanned .
+*
+* Parameters :
+*
+* /address/ - Range 1-127 . *I2C* slave address
+*
+* E.g. Usage :
+*
+* /if (I2C_IsMissing (0x70)) return;/ - Skips a sonar which is not on the bus
+*
+* byte I2C_IsMissing(byte address)
+*/
+
+/*
+*
+* Name : I2C_GetDeviceType
+*
+* Returns the type stored by /I2C_Scan/ for a device ,or 0 if it is not in the device table .
+*
+* Parameters :
+*
+* /address/ - Range 1-127 . *I2C* slave address
+*
+* E.g. Usage :
+*
+* /if (I2C_GetDeviceType (0x60)==CMPS03_DEVICE) .../ - Checks for a compass at 0x60
+*/
+byte I2C_GetDeviceType(byte address)
+{
+ byte i;
+ for(i=0;i<I2CDEVICES;i++)
+     if(i2cDevices[i].type!=0 && i2cDevices[i].address==address)
+         return i2cDevices[i].type;
+ return 0;
+}
 
-  TWDR=I2C_SLA_W;
-  CLR_TWINT();  
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MT_SLA_ACK)
-   {   
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_SLAVEACK_ERROR;
-   }
-
-  TWDR=registerAddress;
-  CLR_TWINT();  
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MT_DATA_ACK)
-   {
-       GEN_STOP();
-       I2C_WaitForStop();
-       return I2C_SLAVEDATA_ERROR;
-   }
-
-  GEN_START();
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_START && I2C_SCODE!=I2C_REP_START)
-   {
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_START_ERROR;
-   }
-  
-  TWDR=I2C_SLA_R;
-  CLR_TWINT(); 
-  I2C_Wait();
-  if(I2C_SCODE!=I2C_MR_SLA_ACK)
-   {  
-      GEN_STOP();
-      I2C_WaitForStop();
-      return I2C_SLAVEACK_ERROR;
-   }
-  
-  for(i=0;i<i2cDataSize;i++)
-   {
-    CLR_TWINT();  
-    I2C_Wait();
-    if(I2C_SCODE!=I2C_MR_DATA_ACK)
-     {
-       GEN_STOP();
-       I2C_WaitForStop();      
-       return I2C_SLAVEDATA_ERROR;
-     }
-    i2cData[i]=TWDR;
-   }
-  
-  if(stopFlag)
-   {
-    GEN_STOP();
-    I2C_WaitForStop();
-   }
- return I2C_SUCCESS;  
-} 
\ No newline at end of file
+/*
+*
+* Name : I2C_FindDevice
+*
+* Returns the address of a device of a type found by /I2C_Scan/ ,or 0 if there are not that many devices of the type .
+*
+* Parameters :
+*
+* /type/ - Device type e.g. SRF08_DEVICE
+*
+* /index/ - 0 for the first device of the type ,1 for the second and so on
+*
+* E.g. Usage :
+*
+* /for (i=0;(address=I2C_FindDevice (SRF08_DEVICE,i))!=0;i++) .../ - Goes through all the sonars
+*/
+byte I2C_FindDevice(byte type,byte index)
+{
+ byte i;
+ for(i=0;i<I2CDEVICES;i++)
+     if(i2cDevices[i].type==type && index--==0)
+         return i2cDevices[i].address;
+ return 0;
+}
+
+/*
+*
+* Name : I2C_SlaveInit
+*
+* Makes the MCU an *I2C* slave with a register map ,the master functions can still be used .Registers 0 to
+* readOnlySize-1 are read only and come from two buffers of readOnlySize bytes which are swapped by /I2C_SlavePublish/
+* ,registers from readOnlySize on are read write and come from /readWrite/ .Reading a register beyond the map returns
+* 0xFF and writes to it are ignored .This function does not return a value .
+*
+* Parameters :
+*
+* /ownAddress/ - Range 1-127 .Slave address of the MCU
+*
+* /readOnly/ - Array of readOnlySize bytes read by the master at first
+*
+* /readOnlyBack/ - Second array of readOnlySize bytes ,the first back buffer
+*
+* /readOnlySize/ - Number of read only registers
+*
+* /readWrite/ - Array of readWriteSize bytes ,may be NULL if readWriteSize is 0
+*
+* /readWriteSize/ - Number of read write registers
+*
+* E.g. Usage :
+*
+* /I2C_SlaveInit (0x30,sensors[0],sensors[1],16,settings,4);/ - Answers at address 0x30 with 16 read only and 4 read
+* write registers
+*/
+void I2C_SlaveInit(byte ownAddress,byte * readOnly,byte * readOnlyBack,byte readOnlySize,byte * readWrite,byte readWriteSize)
+{
+ byte sreg=SREG;
+ cli();
+ i2cSlave.front=readOnly;
+ i2cSlave.back=readOnlyBack;
+ i2cSlave.readOnlySize=readOnlySize;
+ i2cSlave.readWrite=readWrite;
+ i2cSlave.readWriteSize=readWriteSize;
+ i2cSlave.pointer=0;
+ i2cSlave.active=0;
+ i2cSlave.swapPending=0;
+ i2cSlave.written=0;
+ i2cSlave.control=_BV(TWEA)|_BV(TWIE);
+ TWAR=ownAddress<<1;
+ if(!i2cQueue.running)
+     TWCR=_BV(TWEN)|i2cSlave.control;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : I2C_SlaveGetBuffer
+*
+* Returns the back buffer of the read only registers which your program fills with new values before calling
+* /I2C_SlavePublish/ .Returns NULL while a publish is waiting for the master to finish a read ,try again later then .The
+* buffer returned is the one published two times before so all the registers have to be written .
+*
+* E.g. Usage :
+*
+* /byte *registers=I2C_SlaveGetBuffer ();/ - Gets the buffer for the next set of values
+*/
+byte * I2C_SlaveGetBuffer()
+{
+ return i2cSlave.swapPending?NULL:i2cSlave.back;
+}
+
+/*
+*
+* Name : I2C_SlavePublish
+*
+* Makes the values written to the back buffer visible to the master .The buffers are swapped at once if the master is
+* not reading ,else at the end of its read .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /I2C_SlavePublish ();/ - Publishes a new set of values
+*/
+void I2C_SlavePublish()
+{
+ byte sreg=SREG;
+ cli();
+ i2cSlave.swapPending=1;
+ if(!i2cSlave.active)
+     I2C_SlaveSwap();
+ SREG=sreg;
+}
+
+/*
+*
+* Name : I2C_SlaveWritten
+*
+* Returns 1 if the master has written to the read write registers since the last call else returns 0 .
+*
+* E.g. Usage :
+*
+* /if (I2C_SlaveWritten ()) ApplySettings ();/ - Applies new settings written by the master
+*/
+byte I2C_SlaveWritten()
+{
+ byte written;
+ byte sreg=SREG;
+ cli();
+ written=i2cSlave.written;
+ i2cSlave.written=0;
+ SREG=sreg;
+ return written;
+}
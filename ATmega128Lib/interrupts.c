@@ -0,0 +1,168 @@
+/****************************************************
+* Module: Interrupt Priorities
+*
+* The AVR has no interrupt priority levels ,an interrupt declared with SIGNAL runs with all the other interrupts disabled
+* until it returns .The library interrupts are therefore divided in two classes :
+*
+* + Hard real time - *SERVO* ,*STEPPER* and *CAPTURE* interrupts .These are short ,never call user functions and run
+*   with interrupts disabled (/ISR_HARD/) .
+* + Deferrable - *UART0* and *UART1* receive ,external interrupts ,*TIMER2* ,*RTC* and *ADC* .These first acknowledge the
+*   hardware and do any time critical register updates ,then mask their own interrupt source and enable the global
+*   interrupts before calling your interrupt handler function (/ISR_DEFER_CALL/) .A hard real time interrupt can then
+*   occur while your handler is running .As the source is masked the same handler cannot be entered again before it
+*   returns ,the source is unmasked afterwards unless your handler disabled its own interrupt .
+*
+* Define /_BLOCKING_CALLBACKS_/ to run all handlers with interrupts disabled as before ,e.g. to compare the servo pulse
+* jitter with /Servo_GetMaxLatency/ as HostSim/servotest.c does .This module must come before the modules which use it .
+*
+****************************************************/
+
+/* Variables */
+volatile byte isrDeferredDepth;
+byte isrDeferredMaxDepth;
+
+/* Interrupt Classes */
+#define ISR_HARD(vector)       SIGNAL(vector)
+#define ISR_DEFERRABLE(vector) SIGNAL(vector)
+
+#ifndef _BLOCKING_CALLBACKS_
+#define ISR_DEFER_CALL(maskRegister,maskBit,fptr,call) \
+ do{ \
+  maskRegister&=~_BV(maskBit); \
+  if(++isrDeferredDepth>isrDeferredMaxDepth) \
+      isrDeferredMaxDepth=isrDeferredDepth; \
+  sei(); \
+  call; \
+  cli(); \
+  isrDeferredDepth--; \
+  if((fptr)!=NULL) \
+      maskRegister|=_BV(maskBit); \
+ }while(0)
+#define ISR_DEFER_CALL_FLAG(maskRegister,maskBit,flagBit,fptr,call) \
+ do{ \
+  maskRegister&=~(_BV(maskBit)|_BV(flagBit)); \
+  if(++isrDeferredDepth>isrDeferredMaxDepth) \
+      isrDeferredMaxDepth=isrDeferredDepth; \
+  sei(); \
+  call; \
+  cli(); \
+  isrDeferredDepth--; \
+  if((fptr)!=NULL) \
+      maskRegister=(maskRegister&~_BV(flagBit))|_BV(maskBit); \
+ }while(0)
+#else
+#define ISR_DEFER_CALL(maskRegister,maskBit,fptr,call) \
+ do{ \
+  call; \
+ }while(0)
+#define ISR_DEFER_CALL_FLAG(maskRegister,maskBit,flagBit,fptr,call) \
+ do{ \
+  call; \
+ }while(0)
+#endif
+
+/*
+*
+* Name : ISR_HARD
+*
+* Declares a hard real time interrupt handler .Same as SIGNAL ,the handler runs with interrupts disabled .Keep these
+* handlers short as they delay every other interrupt .
+*
+* Parameters :
+*
+* /vector/ - Interrupt vector name e.g. SIG_OUTPUT_COMPARE1B
+*
+* E.g. Usage :
+*
+* /ISR_HARD (SIG_OUTPUT_COMPARE1B) { ... }/ - Servo pulse interrupt
+*
+* void ISR_HARD(vector)
+*/
+
+/*
+*
+* Name : ISR_DEFERRABLE
+*
+* Declares a deferrable interrupt handler .The handler starts with interrupts disabled and must use /ISR_DEFER_CALL/ for
+* the part which may be interrupted .
+*
+* Parameters :
+*
+* /vector/ - Interrupt vector name e.g. SIG_UART0_RECV
+*
+* E.g. Usage :
+*
+* /ISR_DEFERRABLE (SIG_INTERRUPT4) { ... }/ - External interrupt 4
+*
+* void ISR_DEFERRABLE(vector)
+*/
+
+/*
+*
+* Name : ISR_DEFER_CALL
+*
+* Runs a handler function with global interrupts enabled from inside a deferrable interrupt .The interrupt source is
+* masked by clearing its enable bit while the function runs so it cannot interrupt itself .The enable bit is set again
+* afterwards only if the handler function pointer is still set ,so a handler may disable its own interrupt .Must be
+* called after the hardware has been acknowledged (flag cleared or data register read) .
+*
+* Parameters :
+*
+* /maskRegister/ - Register with the enable bit of the interrupt source e.g. TIMSK
+*
+* /maskBit/ - Enable bit of the interrupt source e.g. OCIE2
+*
+* /fptr/ - Handler function pointer variable
+*
+* /call/ - The call to make
+*
+* E.g. Usage :
+*
+* /ISR_DEFER_CALL (UCSR0B,RXCIE0,rx0Interrupt,rx0Interrupt(data));/ - Calls the *UART0* receive handler with interrupts enabled
+*
+* void ISR_DEFER_CALL(maskRegister,maskBit,fptr,call)
+*/
+
+/*
+*
+* Name : ISR_DEFER_CALL_FLAG
+*
+* Same as /ISR_DEFER_CALL/ for a source whose interrupt flag is in the mask register and is cleared by writing a 1 ,like
+* ADIF in ADCSRA .The flag bit is written as 0 when the source is masked and unmasked ,so an interrupt which became
+* pending while the function ran is not cleared and runs as soon as the source is unmasked .
+*
+* Parameters :
+*
+* /maskRegister/ - Register with the enable bit and the flag of the interrupt source e.g. ADCSRA
+*
+* /maskBit/ - Enable bit of the interrupt source e.g. ADIE
+*
+* /flagBit/ - Interrupt flag of the source e.g. ADIF
+*
+* /fptr/ - Handler function pointer variable
+*
+* /call/ - The call to make
+*
+* E.g. Usage :
+*
+* /ISR_DEFER_CALL_FLAG (ADCSRA,ADIE,ADIF,adcFunction,adcFunction(reading));/ - Calls an *ADC* handler with interrupts
+* enabled without losing the next conversion
+*
+* void ISR_DEFER_CALL_FLAG(maskRegister,maskBit,flagBit,fptr,call)
+*/
+
+/*
+*
+* Name : Isr_GetMaxDepth
+*
+* Returns the largest number of deferred handlers which were running at the same time .Each level needs stack space for
+* one interrupt frame ,use this to check the stack size needed by your program .
+*
+* E.g. Usage :
+*
+* /Uart1_printf ("%d",Isr_GetMaxDepth ());/ - Prints the deepest nesting of deferred handlers
+*/
+byte Isr_GetMaxDepth()
+{
+ return isrDeferredMaxDepth;
+}
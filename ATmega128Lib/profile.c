@@ -0,0 +1,211 @@
+/****************************************************
+* Module: Profiling
+*
+* The *PROFILING* module measures how long interrupt handlers and blocking functions take on the MCU .Code between
+* /PROFILE_BEGIN/ and /PROFILE_END/ markers is timed with Timer1 of the *16 BIT TIMER CHANNELS* module (0.5us or 8 clock
+* cycles per tick) and the minimum ,maximum ,mean and a histogram of the times are kept for every probe .The results are
+* printed on *UART1* by /Profile_Dump/ .
+*
+* Profiling is enabled by defining /_PROFILE_/ .Without it the markers are empty and take no code ,time or memory .
+*
+* The library has the following probes built in :
+*
+* + PROFILE_ADC_ISR      (0)  - *ADC* conversion interrupt
+* + PROFILE_TIMER2_ISR   (1)  - *TIMER2* compare interrupt including your handler
+* + PROFILE_RTC_ISR      (2)  - *RTC* overflow interrupt including your handler
+* + PROFILE_UART0_ISR    (3)  - *UART0* receive interrupt including your handler
+* + PROFILE_UART1_ISR    (4)  - *UART1* receive interrupt including your handler
+* + PROFILE_EXTINT_ISR   (5)  - External interrupts including your handlers
+* + PROFILE_CAPTURE_ISR  (6)  - Input capture interrupts
+* + PROFILE_TIMER16_ISR  (7)  - 16 bit timer compare interrupts (*SERVO* ,*STEPPER* ,*DCMOTORS*)
+* + PROFILE_ADC_READ     (8)  - /Adc_ReadInput/ and /Adc_ReadAllInputs/
+* + PROFILE_I2C_WRITE    (9)  - *I2C* transactions which only write ,from the first START to the STOP
+* + PROFILE_I2C_READ     (10) - *I2C* transactions which read
+* + PROFILE_UART_WRITE   (11) - /Uart0_WriteBytes/ ,/Uart0_WriteString/ and the same *UART1* functions
+* + PROFILE_LCD          (12) - /Lcd_PrintString/
+*
+* Probe numbers from PROFILE_USER (13) up to PROFILEPROBES-1 are free for your own code .
+*
+****************************************************/
+
+/* Probe Numbers */
+#define PROFILE_ADC_ISR     0
+#define PROFILE_TIMER2_ISR  1
+#define PROFILE_RTC_ISR     2
+#define PROFILE_UART0_ISR   3
+#define PROFILE_UART1_ISR   4
+#define PROFILE_EXTINT_ISR  5
+#define PROFILE_CAPTURE_ISR 6
+#define PROFILE_TIMER16_ISR 7
+#define PROFILE_ADC_READ    8
+#define PROFILE_I2C_WRITE   9
+#define PROFILE_I2C_READ    10
+#define PROFILE_UART_WRITE  11
+#define PROFILE_LCD         12
+#define PROFILE_USER        13
+
+#ifndef PROFILEPROBES
+#define PROFILEPROBES 16
+#endif
+#define PROFILEBUCKETS 16
+
+#ifndef PROFILE_printf
+#define PROFILE_printf Uart1_printf
+#endif
+
+#ifdef _PROFILE_
+
+/* Markers */
+#define PROFILE_BEGIN(probe) unsigned long profileStart_##probe=Timer16_Time()
+#define PROFILE_END(probe)   Profile_Record(probe,Timer16_Time()-profileStart_##probe)
+
+/* Variables */
+static struct{
+unsigned long total;
+unsigned long count;
+unsigned int minimum;
+unsigned int maximum;
+unsigned int histogram[PROFILEBUCKETS];
+}profileProbes[PROFILEPROBES];
+
+/* Functions */
+
+/*
+*
+* Name : Profile_Record
+*
+* Adds one measured time to the results of a probe .Called by /PROFILE_END/ ,you only need it to record times which you
+* measured yourself .Times above 65535 ticks are recorded as 65535 .This function does not return a value .
+*
+* Parameters :
+*
+* /probe/ - Range 0-(PROFILEPROBES-1) .Probe number
+*
+* /ticks/ - Time in Timer1 ticks (0.5us each)
+*
+* E.g. Usage :
+*
+* /Profile_Record (PROFILE_USER,Capture_GetPulseWidth (CAPTURE_TIMER1));/ - Records a pulse width in the user probe
+*/
+void Profile_Record(byte probe,unsigned long ticks)
+{
+ byte bucket=0;
+ unsigned int time;
+ byte sreg=SREG;
+ if(probe>=PROFILEPROBES)
+     return;
+ time=(ticks>0xFFFF)?0xFFFF:(unsigned int)ticks;
+ while(bucket<PROFILEBUCKETS-1 && (time>>(bucket+1))!=0)
+     bucket++;
+ cli();
+ if(profileProbes[probe].count==0 || time<profileProbes[probe].minimum)
+     profileProbes[probe].minimum=time;
+ if(time>profileProbes[probe].maximum)
+     profileProbes[probe].maximum=time;
+ profileProbes[probe].total+=time;
+ profileProbes[probe].count++;
+ if(profileProbes[probe].histogram[bucket]!=0xFFFF)
+     profileProbes[probe].histogram[bucket]++;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Profile_Reset
+*
+* Clears the results of all the probes .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /Profile_Reset ();/ - Starts a new measurement
+*/
+void Profile_Reset()
+{
+ byte sreg=SREG;
+ cli();
+ memset(profileProbes,0,sizeof(profileProbes));
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Profile_Dump
+*
+* Prints the results of every probe which has recorded at least one time on *UART1* (or with PROFILE_printf if defined) .
+* Each probe is printed on two lines ,first the probe number ,number of times recorded and the minimum ,maximum and mean
+* time in ticks ,then the histogram where column n counts the times from 2^n to 2^(n+1)-1 ticks .This function does not
+* return a value .
+*
+* E.g. Usage :
+*
+* /Profile_Dump ();/ - Prints the profiling results
+*/
+void Profile_Dump()
+{
+ byte probe,bucket,sreg;
+ unsigned long total,count;
+ unsigned int minimum,maximum,histogram[PROFILEBUCKETS];
+ PROFILE_printf("probe count min max mean (ticks of 0.5us)\r\n");
+ for(probe=0;probe<PROFILEPROBES;probe++)
+  {
+   sreg=SREG;
+   cli();
+   total=profileProbes[probe].total;
+   count=profileProbes[probe].count;
+   minimum=profileProbes[probe].minimum;
+   maximum=profileProbes[probe].maximum;
+   memcpy(histogram,profileProbes[probe].histogram,sizeof(histogram));
+   SREG=sreg;
+   if(count==0)
+       continue;
+   PROFILE_printf("%2d %lu %u %u %lu\r\n",probe,count,minimum,maximum,total/count);
+   for(bucket=0;bucket<PROFILEBUCKETS;bucket++)
+       PROFILE_printf(" %u",histogram[bucket]);
+   PROFILE_printf("\r\n");
+  }
+}
+
+#else
+
+#define PROFILE_BEGIN(probe)
+#define PROFILE_END(probe)
+#define Profile_Record(probe,ticks)
+#define Profile_Reset()
+#define Profile_Dump()
+
+#endif
+
+/*
+*
+* Name : PROFILE_BEGIN
+*
+* Marks the start of the code to be timed .Must be followed by /PROFILE_END/ with the same probe number in the same block
+* ,each probe can be started only once in a block .Has no effect unless /_PROFILE_/ is defined .
+*
+* Parameters :
+*
+* /probe/ - Probe number .Must be a name or number written directly ,not a variable
+*
+* E.g. Usage :
+*
+* /PROFILE_BEGIN (PROFILE_USER);/ - Starts timing with the first user probe
+*
+* void PROFILE_BEGIN(probe)
+*/
+
+/*
+*
+* Name : PROFILE_END
+*
+* Marks the end of the code to be timed and records the time in the probe .Has no effect unless /_PROFILE_/ is defined .
+*
+* Parameters :
+*
+* /probe/ - Probe number given to /PROFILE_BEGIN/
+*
+* E.g. Usage :
+*
+* /PROFILE_END (PROFILE_USER);/ - Records the time since /PROFILE_BEGIN (PROFILE_USER)/
+*
+* void PROFILE_END(probe)
+*/
@@ -122,11 +122,13 @@ void RTC_Delay(unsigned int delayUnits)
 *
 * void RTC_Start()
 */ 
-SIGNAL(SIG_OVERFLOW0)
+ISR_DEFERRABLE(SIG_OVERFLOW0)
 {
+    PROFILE_BEGIN(PROFILE_RTC_ISR);
     if((rtcInterrupt!=NULL) && ((--rtcCount)==0))
     {
         rtcCount=rtcMax;
-        rtcInterrupt();
+        ISR_DEFER_CALL(TIMSK,TOIE0,rtcInterrupt,rtcInterrupt());
     }
+    PROFILE_END(PROFILE_RTC_ISR);
 }
@@ -0,0 +1,450 @@
+/****************************************************
+* Module: 16 Bit Timer Channels
+*
+* This module shares the two 16 bit timers ,Timer1 and Timer3 ,between the other modules .Both timers run continuously
+* from 0 to 65535 with the same clock and are never stopped or reprogrammed ,instead each of the six output compare
+* channels (A ,B and C of each timer) can be given to a different module .The owner of a channel schedules its next
+* interrupt relative to the timer count and can also let the hardware set ,clear or toggle the output compare pin at that
+* moment .This way *SERVO* ,*STEPPER* ,*DCMOTORS* and *CAPTURE* can all be used together .
+*
+* The channels are used as follows by the library :
+*
+* + TIMER1_CHANNEL_A - *STEPPER*
+* + TIMER1_CHANNEL_B - *SERVO* (with _SERVO_TIMER1_)
+* + TIMER3_CHANNEL_A - *SERVO* (with _SERVO_TIMER3_)
+* + TIMER3_CHANNEL_B - *DCMOTORS* left motor (pin 4 of PORTE)
+* + TIMER3_CHANNEL_C - *DCMOTORS* right motor (pin 5 of PORTE)
+*
+* Timer overflows are counted so Timer1 also serves as a 32 bit time base ,see /Timer16_Time/ .
+*
+****************************************************/
+
+/* Channel Numbers */
+#define TIMER1_CHANNEL_A 0
+#define TIMER1_CHANNEL_B 1
+#define TIMER1_CHANNEL_C 2
+#define TIMER3_CHANNEL_A 3
+#define TIMER3_CHANNEL_B 4
+#define TIMER3_CHANNEL_C 5
+#define TIMER16_CHANNELS 6
+
+/* Output Compare Pin Modes */
+#define TIMER16_PIN_DISCONNECTED 0
+#define TIMER16_PIN_TOGGLE       1
+#define TIMER16_PIN_CLEAR        2
+#define TIMER16_PIN_SET          3
+
+/* Error Codes */
+#define TIMER16_BUSY_ERROR -1
+
+/* Timer Clock */
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#ifndef TIMER16_CLOCK
+#define TIMER16_CLOCK   _BV(CS11)
+#define TIMER16_DIVISOR 8
+#endif
+#define TIMER16_TICKS_PER_MS (F_CPU/TIMER16_DIVISOR/1000)
+#define TIMER16_MS(ms) ((unsigned long)(ms)*TIMER16_TICKS_PER_MS)
+#define TIMER16_US(us) ((unsigned long)(us)*(F_CPU/TIMER16_DIVISOR/1000)/1000)
+
+/* Variables */
+void (*timer16Handlers[TIMER16_CHANNELS])();
+volatile unsigned int timer16Overflows[2];
+byte timer16Running;
+
+volatile unsigned int * const timer16Compare[TIMER16_CHANNELS]={&OCR1A,&OCR1B,&OCR1C,&OCR3A,&OCR3B,&OCR3C};
+volatile byte * const timer16MaskRegisters[TIMER16_CHANNELS]={&TIMSK,&TIMSK,&ETIMSK,&ETIMSK,&ETIMSK,&ETIMSK};
+volatile byte * const timer16FlagRegisters[TIMER16_CHANNELS]={&TIFR,&TIFR,&ETIFR,&ETIFR,&ETIFR,&ETIFR};
+const byte timer16MaskBits[TIMER16_CHANNELS]={_BV(OCIE1A),_BV(OCIE1B),_BV(OCIE1C),_BV(OCIE3A),_BV(OCIE3B),_BV(OCIE3C)};
+const byte timer16FlagBits[TIMER16_CHANNELS]={_BV(OCF1A),_BV(OCF1B),_BV(OCF1C),_BV(OCF3A),_BV(OCF3B),_BV(OCF3C)};
+
+/* Functions */
+
+/*
+*
+* Name : Timer16_Init
+*
+* Starts Timer1 and Timer3 counting continuously .The modules which use a timer channel call this function themselves
+* so there is no need to call it explicitly .Calling it again once the timers are running has no effect .This function
+* does not return a value .
+*
+* E.g. Usage :
+*
+* /Timer16_Init ();/ - Starts the 16 bit timers
+*/
+void Timer16_Init()
+{
+ byte i;
+ byte sreg=SREG;
+ if(timer16Running)
+     return;
+ cli();
+ for(i=0;i<TIMER16_CHANNELS;i++)
+     timer16Handlers[i]=NULL;
+ timer16Overflows[0]=timer16Overflows[1]=0;
+ TIMSK&=~(_BV(OCIE1A)|_BV(OCIE1B));
+ ETIMSK&=~(_BV(OCIE1C)|_BV(OCIE3A)|_BV(OCIE3B)|_BV(OCIE3C));
+ TCCR1A=0;
+ TCCR3A=0;
+ TCCR1C=0;
+ TCCR3C=0;
+ TCNT1=0;
+ TCNT3=0;
+ TIFR=_BV(TOV1);
+ ETIFR=_BV(TOV3);
+ TIMSK|=_BV(TOIE1);
+ ETIMSK|=_BV(TOIE3);
+ TCCR1B=TIMER16_CLOCK;
+ TCCR3B=TIMER16_CLOCK;
+ timer16Running=1;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_Allocate
+*
+* Reserves a timer channel and sets the function to be called when its compare interrupt occurs .The function returns 1 if
+* successful and TIMER16_BUSY_ERROR (-1) if the channel is already used by another module .
+*
+* Parameters :
+*
+* /channel/ - TIMER1_CHANNEL_A ,TIMER1_CHANNEL_B ,TIMER1_CHANNEL_C ,TIMER3_CHANNEL_A ,TIMER3_CHANNEL_B or TIMER3_CHANNEL_C
+*
+* /fptr/ - Function pointer of (void)(*)() type which is called from the compare interrupt .Keep it short as it runs with
+*          interrupts disabled
+*
+* E.g. Usage :
+*
+* /Timer16_Allocate (TIMER1_CHANNEL_C,BlinkHandler);/ - Uses Timer1 channel C for BlinkHandler
+*/
+int Timer16_Allocate(byte channel,void (*fptr)())
+{
+ if(channel>=TIMER16_CHANNELS || timer16Handlers[channel]!=NULL)
+     return TIMER16_BUSY_ERROR;
+ Timer16_Init();
+ timer16Handlers[channel]=fptr;
+ return 1;
+}
+
+/*
+*
+* Name : Timer16_Now
+*
+* Returns the present count of the timer to which a channel belongs .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /unsigned int start=Timer16_Now (TIMER1_CHANNEL_C);/ - Reads the count of Timer1
+*/
+unsigned int Timer16_Now(byte channel)
+{
+ unsigned int count;
+ byte sreg=SREG;
+ cli();
+ if(channel<TIMER3_CHANNEL_A)
+     count=TCNT1;
+ else
+     count=TCNT3;
+ SREG=sreg;
+ return count;
+}
+
+/*
+*
+* Name : Timer16_ScheduleAt
+*
+* Sets the timer count at which the next compare interrupt of a channel occurs and enables the interrupt .The interrupt
+* occurs once ,call one of the schedule functions again from the handler function for the next event .This function does
+* not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /count/ - Range 0-65535 .Timer count at which the interrupt occurs .If the count has just passed the interrupt occurs
+*           only after the timer has wrapped around (32.8ms with the default clock)
+*
+* E.g. Usage :
+*
+* /Timer16_ScheduleAt (TIMER1_CHANNEL_C,start+2000);/ - Interrupt 1ms after start
+*/
+void Timer16_ScheduleAt(byte channel,unsigned int count)
+{
+ byte sreg=SREG;
+ cli();
+ *timer16Compare[channel]=count;
+ *timer16FlagRegisters[channel]=timer16FlagBits[channel];
+ *timer16MaskRegisters[channel]|=timer16MaskBits[channel];
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_Schedule
+*
+* Schedules the next compare interrupt of a channel a number of ticks from now .One tick is 0.5us with the default clock
+* ,the macros /TIMER16_US(us)/ and /TIMER16_MS(ms)/ convert times to ticks .This function does not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /ticks/ - Range 32-65535 .Ticks from now
+*
+* E.g. Usage :
+*
+* /Timer16_Schedule (TIMER1_CHANNEL_C,TIMER16_US(1500));/ - Interrupt after 1.5ms
+*/
+void Timer16_Schedule(byte channel,unsigned int ticks)
+{
+ byte sreg=SREG;
+ cli();
+ Timer16_ScheduleAt(channel,Timer16_Now(channel)+ticks);
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_ScheduleNext
+*
+* Schedules the next compare interrupt of a channel a number of ticks after the previous one .Use this inside the handler
+* function for periodic events ,the period then does not drift with the interrupt latency .This function does not return
+* a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /ticks/ - Range 32-65535 .Ticks after the previous compare event
+*
+* E.g. Usage :
+*
+* /Timer16_ScheduleNext (TIMER1_CHANNEL_C,TIMER16_MS(20));/ - Next interrupt exactly 20ms after the last one
+*/
+void Timer16_ScheduleNext(byte channel,unsigned int ticks)
+{
+ byte sreg=SREG;
+ cli();
+ Timer16_ScheduleAt(channel,*timer16Compare[channel]+ticks);
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_Cancel
+*
+* Disables the compare interrupt of a channel without freeing it .This function does not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /Timer16_Cancel (TIMER1_CHANNEL_C);/ - No more interrupts from Timer1 channel C
+*/
+void Timer16_Cancel(byte channel)
+{
+ byte sreg=SREG;
+ cli();
+ *timer16MaskRegisters[channel]&=~timer16MaskBits[channel];
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_SetPinMode
+*
+* Selects what the hardware does with the output compare pin of a channel at the next compare event .This function does
+* not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /pinMode/ - Takes the values
+*           - TIMER16_PIN_DISCONNECTED (pin is used as normal I/O)
+*           - TIMER16_PIN_TOGGLE       (pin is toggled)
+*           - TIMER16_PIN_CLEAR        (pin is cleared)
+*           - TIMER16_PIN_SET          (pin is set)
+*
+* E.g. Usage :
+*
+* /Timer16_SetPinMode (TIMER3_CHANNEL_B,TIMER16_PIN_SET);/ - Pin 4 of PORTE goes high at the next compare event
+*/
+void Timer16_SetPinMode(byte channel,byte pinMode)
+{
+ byte shift=6-2*(channel%3);
+ byte sreg=SREG;
+ cli();
+ if(channel<TIMER3_CHANNEL_A)
+     TCCR1A=(TCCR1A&~(0x03<<shift))|((pinMode&0x03)<<shift);
+ else
+     TCCR3A=(TCCR3A&~(0x03<<shift))|((pinMode&0x03)<<shift);
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Timer16_ForcePin
+*
+* Applies the pin mode set by /Timer16_SetPinMode/ to the output compare pin immediately instead of waiting for the
+* compare event .No interrupt occurs .This function does not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /Timer16_ForcePin (TIMER3_CHANNEL_B);/ - Sets or clears pin 4 of PORTE now
+*/
+void Timer16_ForcePin(byte channel)
+{
+ byte bit=_BV(7-(channel%3));
+ if(channel<TIMER3_CHANNEL_A)
+     TCCR1C=bit;
+ else
+     TCCR3C=bit;
+}
+
+/*
+*
+* Name : Timer16_Free
+*
+* Cancels the interrupt of a timer channel ,disconnects its output pin and makes the channel available again .This
+* function does not return a value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel to free
+*
+* E.g. Usage :
+*
+* /Timer16_Free (TIMER1_CHANNEL_C);/ - Frees Timer1 channel C
+*/
+void Timer16_Free(byte channel)
+{
+ if(channel>=TIMER16_CHANNELS)
+     return;
+ Timer16_Cancel(channel);
+ Timer16_SetPinMode(channel,TIMER16_PIN_DISCONNECTED);
+ timer16Handlers[channel]=NULL;
+}
+
+/*
+*
+* Name : Timer16_Extend
+*
+* Extends a 16 bit count of Timer1 (timerNumber 0) or Timer3 (timerNumber 1) read with interrupts disabled to 32 bits
+* using the overflow count .Used by the modules which latch timer values such as *CAPTURE* .
+*
+* Parameters :
+*
+* /timerNumber/ - 0 for Timer1 ,1 for Timer3
+*
+* /count/ - Timer count
+*
+* /overflowPending/ - Non zero if the overflow flag of the timer was set when the count was read
+*
+* E.g. Usage :
+*
+* /time=Timer16_Extend (0,ICR1,TIFR&_BV(TOV1));/ - 32 bit timestamp of the last Timer1 capture
+*/
+unsigned long Timer16_Extend(byte timerNumber,unsigned int count,byte overflowPending)
+{
+ unsigned int overflows=timer16Overflows[timerNumber];
+ if(overflowPending && count<0x8000)
+     overflows++;
+ return ((unsigned long)overflows<<16)|count;
+}
+
+/*
+*
+* Name : Timer16_Time
+*
+* Returns the time since the timers were started in ticks of Timer1 (0.5us with the default clock) .The value wraps
+* around after about 35 minutes so compare times by subtracting them .
+*
+* E.g. Usage :
+*
+* /if(Timer16_Time ()-start>TIMER16_MS(65)) ReadSonar();/ - Reads the sonar 65ms after start
+*/
+unsigned long Timer16_Time()
+{
+ unsigned long time;
+ byte sreg=SREG;
+ cli();
+ time=Timer16_Extend(0,TCNT1,TIFR&_BV(TOV1));
+ SREG=sreg;
+ return time;
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE1A)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER1_CHANNEL_A]!=NULL)
+     timer16Handlers[TIMER1_CHANNEL_A]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE1B)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER1_CHANNEL_B]!=NULL)
+     timer16Handlers[TIMER1_CHANNEL_B]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE1C)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER1_CHANNEL_C]!=NULL)
+     timer16Handlers[TIMER1_CHANNEL_C]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE3A)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER3_CHANNEL_A]!=NULL)
+     timer16Handlers[TIMER3_CHANNEL_A]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE3B)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER3_CHANNEL_B]!=NULL)
+     timer16Handlers[TIMER3_CHANNEL_B]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OUTPUT_COMPARE3C)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ if(timer16Handlers[TIMER3_CHANNEL_C]!=NULL)
+     timer16Handlers[TIMER3_CHANNEL_C]();
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OVERFLOW1)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ timer16Overflows[0]++;
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
+
+ISR_HARD(SIG_OVERFLOW3)
+{
+ PROFILE_BEGIN(PROFILE_TIMER16_ISR);
+ timer16Overflows[1]++;
+ PROFILE_END(PROFILE_TIMER16_ISR);
+}
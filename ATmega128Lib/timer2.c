@@ -11,6 +11,30 @@
 byte prescalarValue;
 void (*timer2Interrupt)();
 
+/* Fractional Frequency (DDS) Variables */
+byte timer2DdsTop;
+byte timer2DdsFraction;
+byte timer2DdsPhase;
+
+/* Prescalar Table ,in flash */
+static const unsigned int timer2Divisors[5] PROGMEM={1,8,64,256,1024};
+static const byte timer2ClockModes[5] PROGMEM={PRESCALAR_1,PRESCALAR_8,PRESCALAR_64,PRESCALAR_256,PRESCALAR_1024};
+
+/* Frequency Solver */
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#define TIMER2_DDS_MINCYCLES 128
+#define TIMER2_HZ(f)          ((f)?(unsigned long)(f):1UL)     /* 0 is taken as 1Hz like Timer2_SolveFrequency */
+#define TIMER2_COUNTS(f,div)  ((F_CPU+((unsigned long)(div)*TIMER2_HZ(f))/2)/((unsigned long)(div)*TIMER2_HZ(f)))
+#define TIMER2_FITS(f,div)    (TIMER2_COUNTS(f,div)<=256UL)
+#define TIMER2_DIVISOR(f)     (TIMER2_FITS(f,1)?1UL:TIMER2_FITS(f,8)?8UL:TIMER2_FITS(f,64)?64UL:TIMER2_FITS(f,256)?256UL:1024UL)
+#define TIMER2_CLOCKMODE(f)   (TIMER2_FITS(f,1)?PRESCALAR_1:TIMER2_FITS(f,8)?PRESCALAR_8:TIMER2_FITS(f,64)?PRESCALAR_64:TIMER2_FITS(f,256)?PRESCALAR_256:PRESCALAR_1024)
+#define TIMER2_TOPVALUE(f)    ((byte)(TIMER2_COUNTS(f,TIMER2_DIVISOR(f))>256UL?255:TIMER2_COUNTS(f,TIMER2_DIVISOR(f))<1UL?0:TIMER2_COUNTS(f,TIMER2_DIVISOR(f))-1))
+#define TIMER2_FREQUENCY(f)   (F_CPU/(TIMER2_DIVISOR(f)*(TIMER2_TOPVALUE(f)+1UL)))
+#define TIMER2_ERROR(f)       ((long)TIMER2_FREQUENCY(f)-(long)TIMER2_HZ(f))
+#define Timer2_SetFrequency(f) (__builtin_constant_p(f)?(Timer2_Configure(TIMER2_CLOCKMODE(f),TIMER2_TOPVALUE(f)),TIMER2_ERROR(f)):Timer2_SolveFrequency(f))
+
 /* Functions */
 /*
 *
@@ -29,6 +53,8 @@ void Timer2_Init()
     OCR2=0;
     TIMSK&=~_BV(OCIE2);
     timer2Interrupt=NULL;
+    timer2DdsFraction=0;
+    timer2DdsPhase=0;
 }
 
 /*
@@ -72,11 +98,149 @@ void Timer2_Init()
 */
 void Timer2_Start(byte clockMode,byte topValue)
 {
+    timer2DdsFraction=0;
     OCR2=topValue;
     TCCR2|=(clockMode&0x07);
     prescalarValue=(clockMode&0x07);
 }
 
+/*
+* Name : Timer2_Configure
+*
+* Same as /Timer2_Start/ except that the previous clock setting is replaced instead of being combined with the new one ,
+* so it can be called on a running *TIMER2* to change its frequency .This function does not return a value . 
+*
+* Parameters :
+* 
+* /clockMode/ - Prescalar value or external clock selection .Takes the same values as for /Timer2_Start/ 
+*
+* /topValue/  - Numbers of clock cycles to count before the overflow interrupt occurs .
+*
+* E.g. Usage :
+*
+* /Timer2_Configure (PRESCALAR_64,249);/ - Runs *TIMER2* at 1000Hz replacing whatever clock setting was used before 
+*/
+void Timer2_Configure(byte clockMode,byte topValue)
+{
+    timer2DdsFraction=0;
+    OCR2=topValue;
+    TCCR2=(TCCR2&~0x07)|(clockMode&0x07);
+    prescalarValue=(clockMode&0x07);
+}
+
+/*
+* Name : Timer2_SetFrequency
+*
+* Starts the *TIMER2* at the frequency nearest to the one requested .The best prescalar value and top value are chosen
+* automatically so you dont have to work them out using the formula given for /Timer2_Start/ .When the frequency is a
+* constant the prescalar and top value are worked out by the compiler and no calculation is done on the MCU .The function
+* returns the error in Hz between the frequency actually achieved and the one requested .
+*
+* The lowest frequency which can be achieved is Main_Clock_Frequency/(1024*256) ,that is 61Hz for the *MegaBoard* ,and
+* lower frequencies ,0 included ,are set to that limit .Above Main_Clock_Frequency/256 (62500Hz) the top value gets small and the
+* error grows .Use /Timer2_SetFrequencyDds/ for frequencies which need better accuracy than the top value allows .
+*
+* The same calculation is also available to your own code as macros : /TIMER2_CLOCKMODE(f)/ ,/TIMER2_TOPVALUE(f)/ ,
+* /TIMER2_FREQUENCY(f)/ (achieved frequency) and /TIMER2_ERROR(f)/ .
+*
+* Parameters :
+*
+* /frequency/ - Frequency in Hz at which the *TIMER2* interrupt function is to be called 
+*
+* E.g. Usage :
+*
+* /Timer2_SetFrequency (250);/ - Starts *TIMER2* at 250Hz ,same as /Timer2_Start (PRESCALAR_256,249);/ and returns 0 
+*
+* /long error=Timer2_SetFrequency (3000);/ - Starts *TIMER2* at 3012Hz(PRESCALAR_64,82) and sets error to 12 
+*
+* long Timer2_SetFrequency(unsigned long frequency)
+*/
+
+/*
+* Name : Timer2_SolveFrequency
+*
+* Run time part of /Timer2_SetFrequency/ used when the frequency is not a constant .Better call /Timer2_SetFrequency/
+* which calls this function when needed .Returns the error in Hz between the achieved and requested frequency .
+*
+* Parameters :
+*
+* /frequency/ - Frequency in Hz at which the *TIMER2* interrupt function is to be called 
+*
+* E.g. Usage :
+*
+* /Timer2_SolveFrequency (beepFrequency);/ - Starts *TIMER2* at the frequency nearest to /beepFrequency/ 
+*/
+long Timer2_SolveFrequency(unsigned long frequency)
+{
+    byte i;
+    unsigned long divisor=1;
+    unsigned long counts=256;
+    if(frequency==0)
+        frequency=1;
+    for(i=0;i<5;i++)
+    {
+        divisor=pgm_read_word(&timer2Divisors[i]);
+        counts=(F_CPU+(divisor*frequency)/2)/(divisor*frequency);
+        if(counts<=256)
+            break;
+    }
+    if(i==5)
+    {
+        i=4;
+        counts=256;
+    }
+    if(counts<1)
+        counts=1;
+    Timer2_Configure(pgm_read_byte(&timer2ClockModes[i]),(byte)(counts-1));
+    return (long)(F_CPU/(divisor*counts))-(long)frequency;
+}
+
+/*
+* Name : Timer2_SetFrequencyDds
+*
+* Starts the *TIMER2* at a fractional frequency .The top value is switched between two neighbouring values from one 
+* cycle to the next using a phase accumulator ,so single cycles are off by at most one timer count but the average 
+* frequency is accurate to 1/256th of a count .Useful for beepers and sample clocks whose frequencies do not divide the
+* main clock .The *TIMER2* compare interrupt is enabled by this function as the top value is updated in it ,your own 
+* interrupt function if set by /Timer2_SetInterrupt/ is still called every cycle .The function returns 1 on success and
+* -1 if the frequency is too high or too low to be achieved .
+*
+* Parameters :
+*
+* /centiHertz/ - Frequency in hundredths of a Hz .The highest frequency is Main_Clock_Frequency/128 
+*
+* E.g. Usage :
+*
+* /Timer2_SetFrequencyDds (44000);/ - Starts *TIMER2* at 440.00Hz 
+*
+* /Timer2_SetFrequencyDds (1102500);/ - Starts *TIMER2* at 11025Hz for audio sampling
+*/
+int Timer2_SetFrequencyDds(unsigned long centiHertz)
+{
+    byte i;
+    unsigned long divisor=1;
+    unsigned long clock=0,counts=0,remainder;
+    if(centiHertz==0)
+        return -1;
+    for(i=0;i<5;i++)
+    {
+        divisor=pgm_read_word(&timer2Divisors[i]);
+        clock=(F_CPU/divisor)*100UL;
+        counts=clock/centiHertz;
+        if(counts<=255)
+            break;
+    }
+    if(i==5 || counts<1 || counts*divisor<TIMER2_DDS_MINCYCLES)
+        return -1;
+    remainder=clock-counts*centiHertz;
+    Timer2_Configure(pgm_read_byte(&timer2ClockModes[i]),(byte)(counts-1));
+    timer2DdsTop=(byte)(counts-1);
+    timer2DdsPhase=0;
+    timer2DdsFraction=(byte)((remainder*256UL)/centiHertz);
+    TIMSK|=_BV(OCIE2);
+    return 1;
+}
+
 /*
 *
 * Name : Timer2_SetInterrupt
@@ -145,8 +309,17 @@ void Timer2_ResetInterrupt()
 *
 * void Timer2_Resume()
 */ 
-SIGNAL(SIG_OUTPUT_COMPARE2 )
+ISR_DEFERRABLE(SIG_OUTPUT_COMPARE2)
 {
+    byte phase;
+    PROFILE_BEGIN(PROFILE_TIMER2_ISR);
+    if(timer2DdsFraction!=0)
+    {
+        phase=timer2DdsPhase+timer2DdsFraction;
+        OCR2=timer2DdsTop+(phase<timer2DdsPhase);
+        timer2DdsPhase=phase;
+    }
     if(timer2Interrupt!=NULL)
-        timer2Interrupt();
+        ISR_DEFER_CALL(TIMSK,OCIE2,timer2Interrupt,timer2Interrupt());
+    PROFILE_END(PROFILE_TIMER2_ISR);
 }
\ No newline at end of file
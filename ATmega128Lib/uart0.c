@@ -111,11 +111,13 @@ void Uart0_WriteByte(byte data)
 void Uart0_WriteBytes(byte * txData,byte size)
 {
  int i;
+ PROFILE_BEGIN(PROFILE_UART_WRITE);
  for(i=0;i<size;i++)
  {
   while (!(UCSR0A & _BV(UDRE0)));
   UDR0=txData[i];
  }
+ PROFILE_END(PROFILE_UART_WRITE);
 }
 
 /*
@@ -138,11 +140,13 @@ void Uart0_WriteBytes(byte * txData,byte size)
 void Uart0_WriteString(char * txChars)
 {
  int i;
+ PROFILE_BEGIN(PROFILE_UART_WRITE);
  for(i=0;i<strlen(txChars);i++)
  {
   while (!(UCSR0A & _BV(UDRE0)));
   UDR0=txChars[i];
  }
+ PROFILE_END(PROFILE_UART_WRITE);
 }
 
 /*
@@ -336,19 +340,21 @@ void Uart0_ResetReceiveInterrupt()
 //void Uart0_scanf(char termChar,char * format,...)
 
 /* UART0 Send Interrupt */
-SIGNAL(SIG_UART0_RECV)
+ISR_DEFERRABLE(SIG_UART0_RECV)
 {
  byte data;
+ PROFILE_BEGIN(PROFILE_UART0_ISR);
  if(rx0Interrupt!=NULL)
    {
      data=UDR0;
-     rx0Interrupt(data);
+     ISR_DEFER_CALL(UCSR0B,RXCIE0,rx0Interrupt,rx0Interrupt(data));
    }
+ PROFILE_END(PROFILE_UART0_ISR);
 }
 
 /* UART0 Send Interrupt */
 
-SIGNAL(SIG_UART0_TRANS)
+ISR_DEFERRABLE(SIG_UART0_TRANS)
 {
 
 }
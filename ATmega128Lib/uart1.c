@@ -111,11 +111,13 @@ void Uart1_WriteByte(byte data)
 void Uart1_WriteBytes(byte * txData,byte size)
 {
  int i;
+ PROFILE_BEGIN(PROFILE_UART_WRITE);
  for(i=0;i<size;i++)
  {
   while (!(UCSR1A & _BV(UDRE1)));
   UDR1=txData[i];
  }
+ PROFILE_END(PROFILE_UART_WRITE);
 }
 
 /*
@@ -138,11 +140,13 @@ void Uart1_WriteBytes(byte * txData,byte size)
 void Uart1_WriteString(char * txChars)
 {
  int i;
+ PROFILE_BEGIN(PROFILE_UART_WRITE);
  for(i=0;i<strlen(txChars);i++)
  {
   while (!(UCSR1A & _BV(UDRE1)));
   UDR1=txChars[i];
  }
+ PROFILE_END(PROFILE_UART_WRITE);
 }
 
 /*
@@ -337,19 +341,21 @@ void Uart1_ResetReceiveInterrupt()
 //void Uart1_scanf(char termChar,char * format,...)
 
 /* UART1 Send Interrupt */
-SIGNAL(SIG_UART1_RECV)
+ISR_DEFERRABLE(SIG_UART1_RECV)
 {
  byte data;
+ PROFILE_BEGIN(PROFILE_UART1_ISR);
  if(rx1Interrupt!=NULL)
    {
      data=UDR1;
-     rx1Interrupt(data);
+     ISR_DEFER_CALL(UCSR1B,RXCIE1,rx1Interrupt,rx1Interrupt(data));
    }
+ PROFILE_END(PROFILE_UART1_ISR);
 }
 
 /* UART1 Send Interrupt */
 
-SIGNAL(SIG_UART1_TRANS)
+ISR_DEFERRABLE(SIG_UART1_TRANS)
 {
 
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+/****************************************************
+* Test: Adaptive Sonar Range
+*
+* Pings an *SRF08* model back to back ,first at the full range and then with /Srf08_SetAdaptive/ ,and prints the ping
+* period ,the range and gain registers and the range of every ping .The obstacle is at 85cm ,then moves out of range
+* so the range has to grow back .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o adapttest HostSim/adapttest.c HostSim/megasim.c && ./adapttest
+*
+****************************************************/
+
+#include "megasim.h"
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+
+/* Variables */
+static SimSrf08 sonar;
+
+/* Pings the sonar count times back to back ,returns the mean ping period in ms */
+static double PingPeriod(Srf08_Ranging * ranging,byte count,int expected)
+{
+ byte i,passed=1;
+ unsigned long long start=Sim_GetCycles();
+ for(i=0;i<count;i++)
+  {
+   Srf08_StartRanging(ranging,0x70,SRF08_CM,NULL);
+   while(!Srf08_Poll(ranging))
+       Sim_Run(F_CPU/10000);
+   if(ranging->range!=expected)
+       passed=0;
+   printf(" ping %u range %d register %u gain %u\n",i,ranging->range,sonar.range,sonar.gain);
+  }
+ Sim_Check("ranges",passed);
+ return (Sim_GetCycles()-start)/(F_CPU/1000.0)/count;
+}
+
+int main()
+{
+ unsigned int echoes[1]={85};
+ Srf08_Ranging ranging;
+ double fixed,adaptive,open;
+
+ Sim_Init();
+ Sim_AddSrf08(&sonar,0x70);
+ Sim_SetEchoes(&sonar,echoes,1);
+ I2C_Init();
+ sei();
+ Srf08_InitRanging(&ranging);
+
+ printf("full range\n");
+ fixed=PingPeriod(&ranging,4,85);
+ printf("full range ping period %.1fms\n",fixed);
+ Sim_Check("full range period",fixed>=65 && fixed<75);
+
+ printf("adaptive range 0.5m-6m\n");
+ Srf08_SetAdaptive(&ranging,500,6000);
+ PingPeriod(&ranging,2,85);                         /* range and gain settle */
+ adaptive=PingPeriod(&ranging,8,85);
+ printf("adaptive ping period %.1fms\n",adaptive);
+ Sim_Check("adaptive range register",sonar.range==(1575-43)/43 && sonar.gain==8+35*23/255);
+ Sim_Check("adaptive period",adaptive<15);
+
+ /* Nothing in range :the range doubles until it reaches the maximum */
+ Sim_SetEchoes(&sonar,echoes,0);
+ printf("obstacle gone\n");
+ PingPeriod(&ranging,4,0);
+ open=PingPeriod(&ranging,2,0);
+ printf("open ping period %.1fms\n",open);
+ Sim_Check("range grows back",sonar.range==(6000-43)/43);
+ return Sim_GetFailures();
+}
@@ -0,0 +1,67 @@
+/****************************************************
+* Test: Sensor Cache
+*
+* Reads a *CMPS03* model through the *SENSOR CACHE* module :a miss starts a reading ,a second request joins it and is
+* counted once however many times it is polled ,a request within the age limit is a hit and a missing compass returns its
+* error .The sizes of a cache entry and of a /Sensor/ are printed .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o cachetest HostSim/cachetest.c HostSim/megasim.c && ./cachetest
+*
+****************************************************/
+
+#include "megasim.h"
+
+/* The ADC driver is not used ,its registers only have to exist */
+static byte ADCSRA,ADMUX,ADCL,ADCH;
+#define ADEN  7
+#define ADSC  6
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+#include "../MegaBoardLib/sensors.c"
+#include "../MegaBoardLib/sensorcache.c"
+
+/* Variables */
+static SimCmps03 compass;
+
+int main()
+{
+ int first,second;
+ unsigned int polls=0;
+
+ Sim_Init();
+ Sim_AddCmps03(&compass,0x60);
+ compass.heading=1234;
+ I2C_Init();
+ sei();
+ printf("cache entry %u bytes ,sensor %u bytes on this host\n",(unsigned int)sizeof(SensorCache_Entry),
+        (unsigned int)sizeof(Sensor));
+
+ /* Two parts of the program ask for the heading at the same time */
+ Sim_Check("first request starts a reading",SensorCache_Request(&sensorCmps03,0x60,0,100,&first)==0);
+ Sim_Check("second request joins it",SensorCache_Request(&sensorCmps03,0x60,0,100,&second)==0);
+ while(SensorCache_Poll(&sensorCmps03,0x60,0,&first)==0)
+  {
+   polls++;
+   Sim_Run(F_CPU/100000);
+  }
+ Sim_Check("second poll",SensorCache_Poll(&sensorCmps03,0x60,0,&second)==1);
+ printf("reading done after %u polls\n",polls);
+ Sim_Check("both readings",first==1234 && second==1234);
+ Sim_Check("one miss and one join",SensorCache_GetMissCount()==1 && SensorCache_GetJoinCount()==1 && polls>1);
+
+ /* A young reading comes from the cache */
+ compass.heading=2000;
+ Sim_Check("hit",SensorCache_Read(&sensorCmps03,0x60,0,100)==1234 && SensorCache_GetHitCount()==1);
+ Sim_Check("age 0 reads again",SensorCache_Read(&sensorCmps03,0x60,0,0)==2000 && SensorCache_GetMissCount()==2);
+
+ Sim_Check("missing compass",SensorCache_Read(&sensorCmps03,0x61,0,100)==I2C_SLAVEACK_ERROR);
+ Sim_Check("error not cached",SensorCache_Request(&sensorCmps03,0x61,0,100,&first)==0);
+ return Sim_GetFailures();
+}
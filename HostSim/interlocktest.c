@@ -0,0 +1,218 @@
+/****************************************************
+* Test: Interlock
+*
+* Drives the stepper motors ,the DC motors and the servos while an *SRF08* model watched by the *INTERLOCK* module sees
+* a wall at 120cm ,then moves the wall to 10cm at a different moment of each trial .The times are measured on the
+* simulated clock from the last byte of the reading which tripped the interlock to the trip ,to the DC motor brake pins
+* set ,to the brakes fully on (both PWM pins held high) and to the steppers stopped after their ramp .A bumper on an
+* external interrupt is timed the same way from the interrupt request .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o interlocktest HostSim/interlocktest.c HostSim/megasim.c && ./interlocktest
+*
+****************************************************/
+
+#include "megasim.h"
+
+/* The ADC is not used ,its registers only have to exist */
+static byte ADCSRA,ADMUX,ADCL,ADCH;
+#define ADEN  7
+#define ADSC  6
+#define ADIE  3
+#define ADPS2 2
+#define ADPS1 1
+
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+#include "../MegaBoardLib/sensors.c"
+#include "../MegaBoardLib/servo.c"
+#include "../MegaBoardLib/stepper.c"
+#include "../MegaBoardLib/dcmotors.c"
+
+/* The bumper stands for external interrupt 1 (INT5) ,EIMSK and the handler set by IO_SetExtInterrupt */
+#define INT_NEG_EDGE 2
+static volatile byte EIMSK=_BV(5);
+static void (*bumperFunction)();
+
+void IO_SetExtInterrupt(byte interruptNumber,byte interruptMode,void (* fptr)())
+{
+ (void)interruptNumber;
+ (void)interruptMode;
+ bumperFunction=fptr;
+}
+
+void Adc_SetWindow(byte channelNumber,unsigned short int low,unsigned short int high,void (*fptr)(byte channelNumber,unsigned short int reading))
+{
+ (void)channelNumber;
+ (void)low;
+ (void)high;
+ (void)fptr;
+}
+
+ISR_DEFERRABLE(SIG_BUMPER)
+{
+ ISR_DEFER_CALL(EIMSK,5,bumperFunction,bumperFunction());
+}
+
+#include "../MegaBoardLib/interlock.c"
+
+/* Cycles the sonar is left to see the far wall again before a trial */
+#define SETTLECYCLES (F_CPU/1000*150)
+
+/* Variables */
+static SimSrf08 sonar;
+static byte (*sonarRead)(SimDevice * device);
+static unsigned long long lastByte;                 /* cycle of the last byte read from the sonar before the trip */
+static Sensor front;
+
+/* Read function of the sonar model which notes when the reading arrives */
+static byte SonarRead(SimDevice * device)
+{
+ if(!Interlock_GetStatus())
+     lastByte=Sim_GetCycles();
+ return sonarRead(device);
+}
+
+typedef struct{
+double trip,brake,pwm,stop,worstTrip,worstBrake,worstPwm,worstStop;
+unsigned int steps,worstSteps;
+unsigned int trials;
+}Times;
+
+/* Adds the times of one trial in us ,from the start cycle */
+static void Add(Times * times,unsigned long long start,unsigned long long trip,unsigned long long brake,
+                unsigned long long pwm,unsigned long long stop,unsigned int steps)
+{
+ double us=F_CPU/1000000.0;
+ double t[4]={(trip-start)/us,(brake-start)/us,(pwm-start)/us,(stop-start)/us};
+ times->trip+=t[0];
+ times->brake+=t[1];
+ times->pwm+=t[2];
+ times->stop+=t[3];
+ times->steps+=steps;
+ if(t[0]>times->worstTrip) times->worstTrip=t[0];
+ if(t[1]>times->worstBrake) times->worstBrake=t[1];
+ if(t[2]>times->worstPwm) times->worstPwm=t[2];
+ if(t[3]>times->worstStop) times->worstStop=t[3];
+ if(steps>times->worstSteps) times->worstSteps=steps;
+ times->trials++;
+}
+
+static void Print(const char * name,Times * times)
+{
+ double n=times->trials;
+ printf("%s ,%u trials ,mean/worst :trip %.1f/%.1fus ,brake pins %.1f/%.1fus ,brakes fully on %.1f/%.1fus ,steppers "
+        "stopped %.2f/%.2fms after %.1f/%u steps\n",name,times->trials,times->trip/n,times->worstTrip,times->brake/n,
+        times->worstBrake,times->pwm/n,times->worstPwm,times->stop/n/1000,times->worstStop/1000,times->steps/n,
+        times->worstSteps);
+}
+
+/* Runs the motors until the interlock trips and everything has stopped ,returns 1 if it tripped .The cycles of the
+   trip ,brake pins ,brakes fully on and steppers stopped are stored with the steps taken after the trip .A source may
+   only be added once ,so each bumper trial has its own */
+static byte Trial(unsigned long runCycles,SimInterrupt * bumper,unsigned long long * times,unsigned int * steps)
+{
+ unsigned long long start,brake=0;
+ unsigned int i=0;
+ int left,right,tripLeft=0;
+ /* The ping of the last trial may still see the wall at 10cm */
+ Sim_SetEchoes(&sonar,(unsigned int []){120},1);
+ for(start=Sim_GetCycles();Sim_GetCycles()-start<SETTLECYCLES;Sim_Run(F_CPU/10000))
+     Sensors_Update();
+ start=Sim_GetCycles();
+ Interlock_Reset();
+ DCmotors_SetLeftMotor(50,FORWARD);
+ DCmotors_SetRightMotor(50,FORWARD);
+ Stepper_MoveStraight(30000,FORWARD);
+ if(bumper!=NULL)
+     Sim_AddInterrupt(bumper,SIG_BUMPER,&EIMSK,5,runCycles,0);
+ else
+  {
+   while(Sim_GetCycles()-start<runCycles)
+    {
+     Sim_Run(F_CPU/10000);
+     Sensors_Update();
+    }
+   if(Interlock_GetStatus())
+       return 0;
+   Sim_SetEchoes(&sonar,(unsigned int []){10},1);
+  }
+ while(stepperStruct.running || brake==0 || Sim_GetCycles()-brake<F_CPU/1000)
+  {
+   Sim_Run(F_CPU/1000000);                          /* 1us */
+   if(++i%100==0)
+       Sensors_Update();
+   if(brake==0 && (PORTD&0xF0)==0xF0)
+    {
+     brake=Sim_GetCycles();
+     Stepper_GetStepCounts(&tripLeft,&right);
+    }
+   if(times[3]==0 && brake!=0 && !stepperStruct.running)
+       times[3]=Sim_GetCycles();
+   if(Sim_GetCycles()-start>F_CPU*2)
+       return 0;
+  }
+ Stepper_GetStepCounts(&left,&right);
+ times[0]=(unsigned long long)Interlock_GetTripTime()*TIMER16_DIVISOR;
+ times[1]=brake;
+ times[2]=(Sim_GetPinTime(TIMER3_CHANNEL_B)>Sim_GetPinTime(TIMER3_CHANNEL_C))?Sim_GetPinTime(TIMER3_CHANNEL_B):
+          Sim_GetPinTime(TIMER3_CHANNEL_C);
+ *steps=(unsigned int)(left-tripLeft);
+ return Sim_GetPin(TIMER3_CHANNEL_B) && Sim_GetPin(TIMER3_CHANNEL_C);
+}
+
+int main()
+{
+ Times sonarTimes,bumperTimes;
+ unsigned long long times[4];
+ unsigned int i,steps;
+ byte passed=1;
+ SimInterrupt bumpers[20];
+
+ memset(&sonarTimes,0,sizeof(sonarTimes));
+ memset(&bumperTimes,0,sizeof(bumperTimes));
+ Sim_Init();
+ Sim_AddSrf08(&sonar,0x70);
+ sonarRead=sonar.device.read;
+ sonar.device.read=SonarRead;
+ I2C_Init();
+ sei();
+ Servo_Init();
+ Servo_Start();
+ Stepper_Init(_HALFSTEPPINGMODE_);
+ DCmotors_Init();
+ Sensors_Add(&front,&sensorSrf08,0x70,SRF08_CM,70);
+ Interlock_WatchSensor(&front,15,32767);
+ Interlock_WatchInput(1,INT_NEG_EDGE);
+
+ for(i=0;i<20;i++)
+  {
+   memset(times,0,sizeof(times));
+   if(!Trial(F_CPU/1000*(200+37*i/10),NULL,times,&steps) || Interlock_GetStatus()!=INTERLOCK_SENSOR)
+       passed=0;
+   else
+       Add(&sonarTimes,lastByte,times[0],times[1],times[2],times[3],steps);
+  }
+ Sim_Check("sonar trips",passed && sonarTimes.trials==20);
+ Print("sonar from the last byte read",&sonarTimes);
+
+ passed=1;
+ for(i=0;i<20;i++)
+  {
+   unsigned long long request;
+   memset(times,0,sizeof(times));
+   request=Sim_GetCycles()+SETTLECYCLES+F_CPU/1000*(200+37*i/10);
+   if(!Trial(F_CPU/1000*(200+37*i/10),&bumpers[i],times,&steps) || !(Interlock_GetStatus()&INTERLOCK_INPUT))
+       passed=0;
+   else
+       Add(&bumperTimes,request,times[0],times[1],times[2],times[3],steps);
+  }
+ Sim_Check("bumper trips",passed && bumperTimes.trials==20);
+ Print("bumper from the interrupt request",&bumperTimes);
+ printf("Interlock_Trip took at most %u ticks of 0.5us\n",Interlock_GetMaxCommandTime());
+ Sim_Check("brakes fully on within a PWM period",sonarTimes.worstPwm-sonarTimes.worstTrip<DCMOTORPERIOD/2.0+10 &&
+           bumperTimes.worstPwm<DCMOTORPERIOD/2.0+50);
+ return Sim_GetFailures();
+}
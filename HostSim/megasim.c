@@ -0,0 +1,1329 @@
+/****************************************************
+* Module: Host Simulator
+*
+* Simulated MCU clock ,*TWI* peripheral ,bus and device models .See megasim.h for how to build a program with it .
+*
+* Each access to a simulated register first takes the write of the previous access ,a register is written when its
+* value has changed since then .TWCR is kept with SIM_MARKER in its upper byte so that writing the value it already
+* has ,e.g. TWINT to clear the flag again ,is seen as well .The access then adds SIM_ACCESSCYCLES to the clock ,completes
+* the bus operation if its time has come and calls the *TWI* interrupt if it is due .
+*
+* A byte on the bus takes nine SCL periods of 16+2*TWBR*4^TWPS clock cycles ,a START one period and a STOP half a
+* period .
+*
+* Timer1 and Timer3 count the simulated clock divided by TIMER16_DIVISOR and are both 0 at /Sim_Init/ .A channel matches
+* each time the count reaches its compare value ,sets its flag and applies its pin mode to its output compare pin .The
+* interrupts are taken in the order of the MCU vectors :the sources added with /Sim_AddInterrupt/ ,like the external
+* interrupts ,then the timer channels and the *TWI* last .
+*
+****************************************************/
+
+#include "megasim.h"
+
+/* Bus Operations */
+#define SIM_IDLE    0
+#define SIM_START   1
+#define SIM_ADDRESS 2
+#define SIM_WRITE   3
+#define SIM_READ    4
+#define SIM_STOP    5
+
+/* Bus Phases ,what the next cleared TWINT sends */
+#define SIM_PHASE_FREE    0
+#define SIM_PHASE_ADDRESS 1
+#define SIM_PHASE_WRITE   2
+#define SIM_PHASE_READ    3
+#define SIM_PHASE_NACKED  4
+
+/* Steps of the other master */
+#define SIM_MASTER_START    0
+#define SIM_MASTER_WADDRESS 1
+#define SIM_MASTER_WRITE    2
+#define SIM_MASTER_RESTART  3
+#define SIM_MASTER_RADDRESS 4
+#define SIM_MASTER_READ     5
+#define SIM_MASTER_STOP     6
+
+#define SIM_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+/* Model Settings */
+#define SIM_SRF08_REVISION  10
+#define SIM_CMPS03_REVISION 14
+
+/* Variables */
+SimStats simStats;
+static int simFailures;
+
+static struct{
+unsigned long long cycles;
+volatile byte registers[SIM_REGISTERS];
+byte shadow[SIM_REGISTERS];                         /* register values after the last access */
+volatile unsigned int twcrStore;
+byte twcr;                                          /* TWCR as the hardware has it */
+byte status;                                        /* TWSR status bits */
+byte operation;
+unsigned long long doneAt;
+unsigned long long startedAt;
+byte phase;
+byte owned;                                         /* START sent and no STOP yet */
+SimDevice * device;                                 /* device addressed */
+SimDevice * devices;
+byte stuckClocks;                                   /* clocks until the device holding SDA lets go */
+byte inSync;
+struct{
+void (*handler)();
+unsigned int compare;
+unsigned long long match;                           /* cycle of the next compare match */
+byte enabled;
+byte flag;
+byte pinMode;
+byte pin;
+unsigned long long pinTime;                         /* cycle at which the pin last changed */
+}channels[TIMER16_CHANNELS];
+SimInterrupt * interrupts;
+SimMaster * master;                                 /* other master on the bus ,NULL if none */
+unsigned long long masterDue;                       /* cycle of its next bus action */
+byte masterStep;
+byte masterIndex;
+byte masterWait;                                    /* waiting for the MCU to clear TWINT ,SCL is held low */
+byte foreign;                                       /* bus held by the other master */
+}sim;
+
+/* Local Functions */
+static void Sim_Access(void);
+
+/* Functions */
+
+/* Clock cycles of one SCL period */
+static unsigned long Sim_Period()
+{
+ return 16UL+2UL*sim.registers[SIM_TWBR]*(1UL<<(2*(sim.registers[SIM_TWSR]&0x03)));
+}
+
+/* Level of the bus lines as read on PIND */
+static byte Sim_Pins()
+{
+ byte pins=_BV(0)|_BV(1);
+ byte driven=sim.registers[SIM_DDRD]&~sim.registers[SIM_PORTD];
+ pins&=~(driven&(_BV(0)|_BV(1)));
+ if(sim.stuckClocks)
+     pins&=~_BV(1);
+ return (sim.registers[SIM_PIND]&~(_BV(0)|_BV(1)))|pins;
+}
+
+/* Starts a bus operation which completes after the given number of clock cycles */
+static void Sim_Begin(byte operation,unsigned long long cycles)
+{
+ sim.operation=operation;
+ sim.startedAt=sim.cycles;
+ sim.doneAt=(cycles==SIM_NEVER)?SIM_NEVER:sim.cycles+cycles;
+}
+
+/* Finds the device with the address in an address byte */
+static SimDevice * Sim_FindDevice(byte addressByte)
+{
+ SimDevice * device;
+ for(device=sim.devices;device!=NULL;device=device->next)
+     if(device->address==(addressByte>>1))
+         return device;
+ return NULL;
+}
+
+/* Ends the bus operation in progress ,sets TWINT and the status */
+static void Sim_Complete()
+{
+ byte operation=sim.operation;
+ byte ack;
+ simStats.busyCycles+=sim.cycles-sim.startedAt;
+ sim.operation=SIM_IDLE;
+ switch(operation)
+  {
+   case SIM_START:
+       if(sim.owned)
+           simStats.restarts++;
+       else
+           simStats.starts++;
+       sim.status=sim.owned?0x10:0x08;
+       sim.owned=1;
+       sim.phase=SIM_PHASE_ADDRESS;
+       simStats.sclClocks++;
+       break;
+
+   case SIM_ADDRESS:
+       simStats.addressBytes++;
+       simStats.sclClocks+=9;
+       sim.device=Sim_FindDevice(sim.registers[SIM_TWDR]);
+       ack=sim.device!=NULL && sim.device->start(sim.device,sim.registers[SIM_TWDR]&1);
+       if(!ack)
+        {
+         simStats.nacks++;
+         sim.phase=SIM_PHASE_NACKED;
+        }
+       else
+         sim.phase=(sim.registers[SIM_TWDR]&1)?SIM_PHASE_READ:SIM_PHASE_WRITE;
+       if(sim.registers[SIM_TWDR]&1)
+           sim.status=ack?0x40:0x48;
+       else
+           sim.status=ack?0x18:0x20;
+       break;
+
+   case SIM_WRITE:
+       simStats.dataBytes++;
+       simStats.sclClocks+=9;
+       ack=sim.device->write(sim.device,sim.registers[SIM_TWDR]);
+       if(!ack)
+           simStats.nacks++;
+       sim.status=ack?0x28:0x30;
+       break;
+
+   case SIM_READ:
+       simStats.dataBytes++;
+       simStats.sclClocks+=9;
+       sim.registers[SIM_TWDR]=sim.shadow[SIM_TWDR]=sim.device->read(sim.device);
+       sim.status=(sim.twcr&_BV(TWEA))?0x50:0x58;
+       break;
+
+   case SIM_STOP:
+       simStats.stops++;
+       if(sim.device!=NULL && sim.device->stop!=NULL)
+           sim.device->stop(sim.device);
+       sim.device=NULL;
+       sim.owned=0;
+       sim.phase=SIM_PHASE_FREE;
+       sim.status=0xF8;
+       sim.twcr&=~_BV(TWSTO);
+       return;                                      /* TWINT is not set after a STOP */
+  }
+ sim.twcr|=_BV(TWINT);
+}
+
+/* Sets TWINT with a slave status ,the other master waits until the MCU clears it */
+static void Sim_SlaveStatus(byte status)
+{
+ sim.status=status;
+ sim.twcr|=_BV(TWINT);
+ sim.masterWait=1;
+}
+
+/* Takes the next bus action of the other master */
+static void Sim_MasterAction()
+{
+ SimMaster * master=sim.master;
+ byte step=sim.masterStep;
+ switch(step)
+  {
+   case SIM_MASTER_START:
+       if(sim.owned || sim.stuckClocks || (sim.operation!=SIM_IDLE && sim.doneAt!=SIM_NEVER))
+        {
+         sim.masterDue+=Sim_Period();               /* waits for the bus to be free */
+         return;
+        }
+       sim.foreign=1;
+       sim.masterStep=master->writeSize?SIM_MASTER_WADDRESS:SIM_MASTER_RADDRESS;
+       sim.masterDue=sim.cycles+10*Sim_Period();    /* START and the address byte */
+       return;
+
+   case SIM_MASTER_WADDRESS:
+   case SIM_MASTER_RADDRESS:
+       if((sim.twcr&(_BV(TWEN)|_BV(TWEA)))!=(_BV(TWEN)|_BV(TWEA)) || (sim.registers[SIM_TWAR]>>1)!=master->address)
+        {
+         sim.masterStep=SIM_MASTER_STOP;            /* not answered */
+         sim.masterDue=sim.cycles+Sim_Period()/2;
+         return;
+        }
+       master->acked=1;
+       if(sim.operation==SIM_START)
+           sim.operation=SIM_IDLE;                  /* the START waiting for the bus is dropped unless TWSTA is
+                                                       written again */
+       sim.masterIndex=0;
+       sim.masterStep=(step==SIM_MASTER_WADDRESS)?SIM_MASTER_WRITE:SIM_MASTER_READ;
+       Sim_SlaveStatus((step==SIM_MASTER_WADDRESS)?0x60:0xA8);
+       return;
+
+   case SIM_MASTER_WRITE:
+       sim.registers[SIM_TWDR]=sim.shadow[SIM_TWDR]=master->write[sim.masterIndex++];
+       if(sim.masterIndex==master->writeSize)
+           sim.masterStep=master->readSize?SIM_MASTER_RESTART:SIM_MASTER_STOP;
+       Sim_SlaveStatus((sim.twcr&_BV(TWEA))?0x80:0x88);
+       return;
+
+   case SIM_MASTER_RESTART:
+       sim.masterStep=SIM_MASTER_RADDRESS;
+       Sim_SlaveStatus(0xA0);
+       return;
+
+   case SIM_MASTER_READ:
+       if(++sim.masterIndex<master->readSize)
+           Sim_SlaveStatus(0xB8);
+       else
+        {
+         sim.masterStep=SIM_MASTER_STOP;
+         Sim_SlaveStatus(0xC0);                     /* the last byte is not acknowledged */
+        }
+       return;
+
+   case SIM_MASTER_STOP:
+       sim.foreign=0;
+       master->done=1;
+       sim.master=NULL;
+       if(sim.operation==SIM_START && sim.doneAt==SIM_NEVER && !sim.stuckClocks)
+           sim.doneAt=sim.cycles+Sim_Period();      /* the START waiting for the bus goes out */
+       if(master->acked && master->readSize==0)
+        {
+         sim.status=0xA0;                           /* the MCU is still addressed and sees the STOP */
+         sim.twcr|=_BV(TWINT);
+        }
+       return;
+  }
+}
+
+/* Takes a write to TWCR */
+static void Sim_WriteTwcr(byte value)
+{
+ if(!(value&_BV(TWEN)))
+  {
+   sim.twcr=value&~_BV(TWINT);
+   sim.operation=SIM_IDLE;
+   sim.owned=0;
+   sim.device=NULL;
+   sim.phase=SIM_PHASE_FREE;
+   sim.status=0xF8;
+   return;
+  }
+ sim.twcr=(sim.twcr&_BV(TWINT))|(value&~(_BV(TWINT)|_BV(TWWC)));
+ if(sim.masterWait && (value&_BV(TWINT)))
+  {
+   sim.twcr&=~_BV(TWINT);
+   sim.masterWait=0;
+   if(sim.masterStep==SIM_MASTER_READ)
+       sim.master->read[sim.masterIndex]=sim.registers[SIM_TWDR];
+   if(sim.masterStep==SIM_MASTER_STOP)
+       sim.masterDue=sim.cycles+Sim_Period()/2;
+   else if(sim.masterStep==SIM_MASTER_RESTART)
+       sim.masterDue=sim.cycles+Sim_Period();
+   else
+       sim.masterDue=sim.cycles+9*Sim_Period();
+   if(value&_BV(TWSTA))
+       Sim_Begin(SIM_START,SIM_NEVER);              /* sent when the other master lets the bus go */
+   return;
+  }
+ if(!(value&_BV(TWINT)) || sim.operation!=SIM_IDLE)
+     return;
+ sim.twcr&=~(_BV(TWINT)|_BV(TWWC));
+ if(value&_BV(TWSTA))
+     Sim_Begin(SIM_START,sim.owned?Sim_Period():((sim.stuckClocks || sim.foreign)?SIM_NEVER:Sim_Period()));
+ else if(value&_BV(TWSTO))
+     Sim_Begin(SIM_STOP,Sim_Period()/2);
+ else if(sim.phase==SIM_PHASE_ADDRESS)
+     Sim_Begin(SIM_ADDRESS,9*Sim_Period());
+ else if(sim.phase==SIM_PHASE_WRITE)
+     Sim_Begin(SIM_WRITE,9*Sim_Period());
+ else if(sim.phase==SIM_PHASE_READ)
+     Sim_Begin(SIM_READ,9*Sim_Period());
+}
+
+/* Takes the writes made since the last access */
+static void Sim_Sync()
+{
+ byte n;
+ if(sim.inSync)
+     return;
+ sim.inSync=1;
+ for(n=0;n<SIM_REGISTERS;n++)
+  {
+   byte value=sim.registers[n];
+   if(value==sim.shadow[n])
+       continue;
+   switch(n)
+    {
+     case SIM_TWSR:
+         sim.registers[n]=(value&0x03);             /* only the prescaler bits can be written */
+         break;
+
+     case SIM_TWDR:
+         if(sim.operation!=SIM_IDLE)
+          {
+           sim.registers[n]=sim.shadow[n];          /* write collision ,the write is ignored */
+           sim.twcr|=_BV(TWWC);
+          }
+         break;
+
+     case SIM_DDRD:
+         if((sim.shadow[n]&_BV(0)) && !(value&_BV(0)))
+          {
+           simStats.sclClocks++;                    /* SCL released by bit banging */
+           if(sim.stuckClocks)
+               sim.stuckClocks--;
+          }
+         break;
+
+     case SIM_PIND:
+         sim.registers[n]=sim.shadow[n];            /* input register */
+         break;
+    }
+  }
+ if((sim.twcrStore&0xFF00)!=SIM_MARKER)
+     Sim_WriteTwcr((byte)sim.twcrStore);
+ sim.registers[SIM_TWSR]=sim.status|(sim.registers[SIM_TWSR]&0x03);
+ sim.registers[SIM_PIND]=Sim_Pins();
+ for(n=0;n<SIM_REGISTERS;n++)
+     sim.shadow[n]=sim.registers[n];
+ sim.twcrStore=SIM_MARKER|sim.twcr;
+ sim.inSync=0;
+}
+
+/* Cycle of the first match after now of a timer channel with the given compare value */
+static unsigned long long Sim_NextMatch(unsigned int compare)
+{
+ unsigned long long tick=sim.cycles/TIMER16_DIVISOR;
+ unsigned int ahead=(unsigned int)(compare-(unsigned int)tick-1U);   /* a match on the present count is blocked */
+ return (tick+ahead+1ULL)*TIMER16_DIVISOR;
+}
+
+/* Sets or clears an output compare pin ,as at a compare match or by Timer16_ForcePin */
+static void Sim_PinAction(byte channel)
+{
+ byte pin=sim.channels[channel].pin;
+ switch(sim.channels[channel].pinMode)
+  {
+   case TIMER16_PIN_TOGGLE:
+       pin^=1;
+       break;
+
+   case TIMER16_PIN_CLEAR:
+       pin=0;
+       break;
+
+   case TIMER16_PIN_SET:
+       pin=1;
+       break;
+  }
+ if(pin!=sim.channels[channel].pin)
+  {
+   sim.channels[channel].pin=pin;
+   sim.channels[channel].pinTime=sim.cycles;
+  }
+}
+
+/* Completes the bus operation and raises the timer and interrupt flags whose time has come */
+static void Sim_Events()
+{
+ byte n;
+ SimInterrupt * source;
+ if(sim.operation!=SIM_IDLE && sim.cycles>=sim.doneAt)
+  {
+   Sim_Complete();
+   Sim_Sync();
+  }
+ if(sim.master!=NULL && !sim.masterWait && sim.cycles>=sim.masterDue)
+  {
+   Sim_MasterAction();
+   Sim_Sync();
+  }
+ for(n=0;n<TIMER16_CHANNELS;n++)
+     while(sim.cycles>=sim.channels[n].match)
+      {
+       sim.channels[n].flag=1;
+       Sim_PinAction(n);
+       sim.channels[n].match+=65536ULL*TIMER16_DIVISOR;
+      }
+ for(source=sim.interrupts;source!=NULL;source=source->next)
+     while(sim.cycles>=source->due)
+      {
+       source->pending=1;
+       source->due=source->period?source->due+source->period:SIM_NEVER;
+      }
+}
+
+/* Cycle of the next event which can change a flag or a pin */
+static unsigned long long Sim_NextEvent()
+{
+ unsigned long long next=(sim.operation!=SIM_IDLE)?sim.doneAt:SIM_NEVER;
+ byte n;
+ SimInterrupt * source;
+ if(sim.master!=NULL && !sim.masterWait && sim.masterDue<next)
+     next=sim.masterDue;
+ for(n=0;n<TIMER16_CHANNELS;n++)
+     if((sim.channels[n].enabled || sim.channels[n].pinMode) && sim.channels[n].match<next)
+         next=sim.channels[n].match;
+ for(source=sim.interrupts;source!=NULL;source=source->next)
+     if(source->due<next)
+         next=source->due;
+ return next;
+}
+
+/* Calls the interrupts which are enabled and flagged ,highest priority first ,while interrupts are enabled */
+static void Sim_Dispatch()
+{
+ SimInterrupt * source;
+ byte n;
+ while(sim.registers[SIM_SREG]&_BV(SREG_I))
+  {
+   for(source=sim.interrupts;source!=NULL;source=source->next)
+       if(source->pending && (source->mask==NULL || (*source->mask&_BV(source->maskBit))))
+           break;
+   for(n=0;source==NULL && n<TIMER16_CHANNELS;n++)
+       if(sim.channels[n].flag && sim.channels[n].enabled)
+           break;
+   if(source==NULL && n==TIMER16_CHANNELS &&
+      (sim.twcr&(_BV(TWINT)|_BV(TWEN)|_BV(TWIE)))!=(_BV(TWINT)|_BV(TWEN)|_BV(TWIE)))
+       return;
+   sim.cycles+=SIM_ISRCYCLES;
+   sim.registers[SIM_SREG]&=~_BV(SREG_I);
+   sim.shadow[SIM_SREG]=sim.registers[SIM_SREG];
+   if(source!=NULL)
+    {
+     source->pending=0;                             /* the flag is cleared when the interrupt is taken */
+     source->vector();
+    }
+   else if(n<TIMER16_CHANNELS)
+    {
+     sim.channels[n].flag=0;
+     if(sim.channels[n].handler!=NULL)
+         sim.channels[n].handler();
+    }
+   else
+    {
+     simStats.interrupts++;
+     SIG_2WIRE_SERIAL();
+    }
+   Sim_Sync();
+   sim.registers[SIM_SREG]|=_BV(SREG_I);            /* reti */
+   sim.shadow[SIM_SREG]=sim.registers[SIM_SREG];
+  }
+}
+
+/* One register access by the program */
+static void Sim_Access()
+{
+ Sim_Sync();
+ sim.cycles+=SIM_ACCESSCYCLES;
+ Sim_Events();
+ Sim_Dispatch();
+}
+
+/*
+*
+* Name : Sim_Register
+*
+* Used by the register macros of megasim.h ,each use is one access which moves the simulation on .Returns a pointer to
+* the simulated register .
+*
+* Parameters :
+*
+* /number/ - Register number ,e.g. SIM_TWDR
+*
+* E.g. Usage :
+*
+* /TWDR=0xE0;/ - Same as *Sim_Register (SIM_TWDR)=0xE0
+*/
+volatile byte * Sim_Register(byte number)
+{
+ Sim_Access();
+ return &sim.registers[number];
+}
+
+/*
+*
+* Name : Sim_Twcr
+*
+* Used by the TWCR macro of megasim.h .Returns a pointer to the simulated TWCR with SIM_MARKER in the upper byte .
+*
+* E.g. Usage :
+*
+* /TWCR=_BV(TWEN);/ - Same as *Sim_Twcr ()=_BV(TWEN)
+*/
+volatile unsigned int * Sim_Twcr()
+{
+ Sim_Access();
+ return &sim.twcrStore;
+}
+
+/*
+*
+* Name : Sim_Init
+*
+* Resets the simulated MCU and removes all the devices from the bus .Call it first .This function does not return a
+* value .
+*
+* E.g. Usage :
+*
+* /Sim_Init ();/ - Starts a new simulation
+*/
+void Sim_Init()
+{
+ byte n;
+ memset(&sim,0,sizeof(sim));
+ memset(&simStats,0,sizeof(simStats));
+ for(n=0;n<TIMER16_CHANNELS;n++)
+     sim.channels[n].match=Sim_NextMatch(0);
+ sim.status=0xF8;
+ sim.registers[SIM_TWSR]=sim.shadow[SIM_TWSR]=0xF8;
+ sim.registers[SIM_PIND]=sim.shadow[SIM_PIND]=_BV(0)|_BV(1);
+ sim.twcrStore=SIM_MARKER;
+}
+
+/*
+*
+* Name : Sim_Run
+*
+* Lets simulated time pass without register accesses ,as if the program was busy elsewhere .Bus operations complete ,the
+* timer channels match and the interrupts which are enabled are called in the meantime .Called from an interrupt
+* function it stands for the time the function takes ,other interrupts are only taken if it has enabled them .This
+* function does not return a value .
+*
+* Parameters :
+*
+* /cycles/ - Number of clock cycles
+*
+* E.g. Usage :
+*
+* /Sim_Run (F_CPU/1000);/ - Lets 1ms pass
+*/
+void Sim_Run(unsigned long cycles)
+{
+ unsigned long long end=sim.cycles+cycles;
+ unsigned long long next;
+ Sim_Sync();
+ Sim_Dispatch();
+ while((next=Sim_NextEvent())<=end)
+  {
+   if(next>sim.cycles)
+       sim.cycles=next;
+   Sim_Events();
+   Sim_Dispatch();
+  }
+ if(sim.cycles<end)
+     sim.cycles=end;
+ Sim_Events();
+ Sim_Dispatch();
+}
+
+/*
+*
+* Name : Sim_GetCycles
+*
+* Returns the number of clock cycles simulated since /Sim_Init/ .
+*
+* E.g. Usage :
+*
+* /start=Sim_GetCycles ();/ - Remembers the time before a transfer
+*/
+unsigned long long Sim_GetCycles()
+{
+ Sim_Sync();
+ return sim.cycles;
+}
+
+/*
+*
+* Name : Sim_StickBus
+*
+* Makes a device hold *SDA* low ,as after a reset in the middle of a read .No START can be sent until *SCL* has been
+* clocked the given number of times by bit banging ,see /I2C_RecoverBus/ .This function does not return a value .
+*
+* Parameters :
+*
+* /clocks/ - Range 1-9 .Clocks until the device lets go
+*
+* E.g. Usage :
+*
+* /Sim_StickBus (5);/ - Holds the bus until five clocks are sent
+*/
+void Sim_StickBus(byte clocks)
+{
+ Sim_Sync();
+ sim.stuckClocks=clocks;
+ sim.registers[SIM_PIND]=sim.shadow[SIM_PIND]=Sim_Pins();
+}
+
+/*
+*
+* Name : Sim_AddDevice
+*
+* Connects a device model to the bus .The address ,start ,write and read functions must be set ,stop may be NULL .This
+* function does not return a value .
+*
+* Parameters :
+*
+* /device/ - Pointer to the device
+*
+* E.g. Usage :
+*
+* /Sim_AddDevice (&eeprom.device);/ - Connects a device model of your own
+*/
+void Sim_AddDevice(SimDevice * device)
+{
+ device->next=sim.devices;
+ sim.devices=device;
+}
+
+/* Fills the echo registers of an SRF08 after a ranging command */
+static void Sim_Srf08Range(SimSrf08 * sonar,byte command)
+{
+ byte i;
+ unsigned long maximum=((unsigned long)sonar->range+1)*43/10;   /* cm */
+ memset(sonar->registers+2,0,34);
+ for(i=0;i<sonar->echoCount && i<17;i++)
+  {
+   unsigned long value=sonar->echoes[i];
+   if(value>maximum)
+       break;
+   if(command==0x50)
+       value=value*100/254;
+   else if(command==0x52)
+       value=value*58;
+   if(value>0xFFFF)
+       value=0xFFFF;
+   sonar->registers[2+2*i]=value>>8;
+   sonar->registers[3+2*i]=(byte)value;
+  }
+ sonar->registers[1]=sonar->light;
+ sonar->pings++;
+ if(!sonar->instant)
+     sonar->busyUntil=sim.cycles+((unsigned long long)sonar->range+1)*(F_CPU/4000);
+}
+
+static byte Sim_Srf08Start(SimDevice * device,byte read)
+{
+ SimSrf08 * sonar=(SimSrf08 *)device;
+ if(sim.cycles<sonar->busyUntil)
+     return 0;                                      /* no answer while ranging */
+ sonar->first=!read;
+ return 1;
+}
+
+static byte Sim_Srf08Write(SimDevice * device,byte data)
+{
+ SimSrf08 * sonar=(SimSrf08 *)device;
+ if(sonar->first)
+  {
+   sonar->pointer=data;
+   sonar->first=0;
+   return 1;
+  }
+ switch(sonar->pointer)
+  {
+   case 0:
+       if(data>=0x50 && data<=0x52)
+        {
+         Sim_Srf08Range(sonar,data);
+         sonar->changeStep=0;
+        }
+       else if(sonar->changeStep==3)
+        {
+         device->address=data>>1;
+         sonar->changeStep=0;
+        }
+       else if(data==(sonar->changeStep==0?0xA0:sonar->changeStep==1?0xAA:0xA5))
+         sonar->changeStep++;
+       else
+         sonar->changeStep=0;
+       break;
+
+   case 1:
+       sonar->gain=data;
+       break;
+
+   case 2:
+       sonar->range=data;
+       break;
+  }
+ sonar->pointer++;
+ return 1;
+}
+
+static byte Sim_Srf08Read(SimDevice * device)
+{
+ SimSrf08 * sonar=(SimSrf08 *)device;
+ byte pointer=sonar->pointer++;
+ if(pointer==0)
+     return SIM_SRF08_REVISION;
+ return (pointer<36)?sonar->registers[pointer]:0;
+}
+
+/*
+*
+* Name : Sim_AddSrf08
+*
+* Connects an *SRF08* model to the bus .It has the register map of the real sonar :0 the software revision ,1 the light
+* sensor and 2-35 the 17 echoes ,written 0 the ranging commands 0x50-0x52 and the address change sequence ,1 the gain and
+* 2 the range .Ranging takes (range+1)*0.25ms ,65ms for the default range ,during which the model does not answer .Set
+* the /instant/ field to 1 to finish ranging at once for code which waits in plain delay loops ,they take no simulated
+* time .This function does not return a value .
+*
+* Parameters :
+*
+* /sonar/ - Pointer to the model
+*
+* /address/ - Range 0x70-0x7F .*I2C* address
+*
+* E.g. Usage :
+*
+* /Sim_AddSrf08 (&sonar,0x70);/ - Connects a sonar at the factory address
+*/
+void Sim_AddSrf08(SimSrf08 * sonar,byte address)
+{
+ memset(sonar,0,sizeof(*sonar));
+ sonar->device.address=address;
+ sonar->device.start=Sim_Srf08Start;
+ sonar->device.write=Sim_Srf08Write;
+ sonar->device.read=Sim_Srf08Read;
+ sonar->gain=31;
+ sonar->range=255;
+ sonar->light=0x80;
+ Sim_AddDevice(&sonar->device);
+}
+
+/*
+*
+* Name : Sim_SetEchoes
+*
+* Sets the distances the next pings of an *SRF08* model will measure .Echoes beyond the range setting are not heard .
+* This function does not return a value .
+*
+* Parameters :
+*
+* /sonar/ - Pointer to the model
+*
+* /distances/ - Array of distances in centimetres ,nearest first
+*
+* /count/ - Range 0-17 .Number of echoes
+*
+* E.g. Usage :
+*
+* /Sim_SetEchoes (&sonar,(unsigned int[]){85,240},2);/ - Two obstacles at 85cm and 2.4m
+*/
+void Sim_SetEchoes(SimSrf08 * sonar,unsigned int * distances,byte count)
+{
+ if(count>17)
+     count=17;
+ memcpy(sonar->echoes,distances,count*sizeof(unsigned int));
+ sonar->echoCount=count;
+}
+
+static byte Sim_Cmps03Start(SimDevice * device,byte read)
+{
+ ((SimCmps03 *)device)->first=!read;
+ return 1;
+}
+
+static byte Sim_Cmps03Write(SimDevice * device,byte data)
+{
+ SimCmps03 * compass=(SimCmps03 *)device;
+ if(compass->first)
+  {
+   compass->pointer=data;
+   compass->first=0;
+   return 1;
+  }
+ if(compass->pointer==15 && data==0xFF)
+     compass->calibrationPoints++;
+ compass->pointer++;
+ return 1;
+}
+
+static byte Sim_Cmps03Read(SimDevice * device)
+{
+ SimCmps03 * compass=(SimCmps03 *)device;
+ switch(compass->pointer++)
+  {
+   case 0:
+       return SIM_CMPS03_REVISION;
+   case 1:
+       return (unsigned long)compass->heading*255/3600;
+   case 2:
+       return compass->heading>>8;
+   case 3:
+       return (byte)compass->heading;
+  }
+ return 0;
+}
+
+/*
+*
+* Name : Sim_AddCmps03
+*
+* Connects a *CMPS03* model to the bus .Register 0 is the software revision ,1 the bearing as a byte and 2-3 the bearing
+* in tenths of a degree ,set with the /heading/ field .Writing 0xFF to register 15 counts a calibration point in the
+* /calibrationPoints/ field .This function does not return a value .
+*
+* Parameters :
+*
+* /compass/ - Pointer to the model
+*
+* /address/ - *I2C* address ,0x60 for the real compass
+*
+* E.g. Usage :
+*
+* /Sim_AddCmps03 (&compass,0x60);compass.heading=900;/ - Connects a compass pointing east
+*/
+void Sim_AddCmps03(SimCmps03 * compass,byte address)
+{
+ memset(compass,0,sizeof(*compass));
+ compass->device.address=address;
+ compass->device.start=Sim_Cmps03Start;
+ compass->device.write=Sim_Cmps03Write;
+ compass->device.read=Sim_Cmps03Read;
+ Sim_AddDevice(&compass->device);
+}
+
+/*
+*
+* Name : Sim_AddInterrupt
+*
+* Adds an interrupt source ,e.g. an external interrupt or a receive interrupt .Its flag is set after /delay/ cycles and
+* then every /period/ cycles ,and the interrupt function is called like the vector of the MCU when the enable bit is set
+* and interrupts are enabled .A request made while the flag is still set is lost ,as on the MCU .The function may be
+* declared with ISR_DEFERRABLE or ISR_HARD .This function does not return a value .
+*
+* Parameters :
+*
+* /source/ - Pointer to the source
+*
+* /vector/ - Interrupt function
+*
+* /mask/ - Register with the enable bit ,e.g. a variable of the program standing for EIMSK ,NULL if always enabled
+*
+* /maskBit/ - Enable bit in /mask/
+*
+* /delay/ - Cycles from now to the first request
+*
+* /period/ - Cycles between requests ,0 for a single request
+*
+* E.g. Usage :
+*
+* /Sim_AddInterrupt (&bumper,SIG_INTERRUPT5,&EIMSK,INT5,F_CPU/10,0);/ - Bumper switch closing after 100ms
+*/
+void Sim_AddInterrupt(SimInterrupt * source,void (*vector)(void),volatile byte * mask,byte maskBit,unsigned long delay,
+                      unsigned long period)
+{
+ Sim_Sync();
+ source->vector=vector;
+ source->mask=mask;
+ source->maskBit=maskBit;
+ source->period=period;
+ source->due=sim.cycles+delay;
+ source->pending=0;
+ source->next=sim.interrupts;
+ sim.interrupts=source;
+}
+
+/*
+*
+* Name : Sim_AddMaster
+*
+* Makes another master on the bus address the MCU as a slave after /delay/ cycles ,or as soon as the bus is free after
+* that .It writes the /write/ bytes ,then reads /readSize/ bytes into /read/ after a repeated START ,or sends a STOP if
+* /readSize/ is 0 .It holds SCL low while TWINT is set ,as a slave transfer does on the MCU .The /acked/ field is set if
+* the MCU answered and /done/ after the STOP .Only one master may be added at a time .This function does not return a
+* value .
+*
+* Parameters :
+*
+* /master/ - Pointer to the master with the address of the MCU and the bytes to send and receive
+*
+* /delay/ - Cycles from now to the START
+*
+* E.g. Usage :
+*
+* /Sim_AddMaster (&host,F_CPU/1000);/ - Another master reads the register map of the MCU in 1ms
+*/
+void Sim_AddMaster(SimMaster * master,unsigned long delay)
+{
+ Sim_Sync();
+ master->acked=0;
+ master->done=0;
+ sim.master=master;
+ sim.masterStep=SIM_MASTER_START;
+ sim.masterWait=0;
+ sim.masterDue=sim.cycles+delay;
+}
+
+/*
+*
+* Name : Sim_GetPin
+*
+* Returns the level ,0 or 1 ,of the output compare pin of a timer channel .
+*
+* Parameters :
+*
+* /channel/ - Timer channel ,e.g. TIMER3_CHANNEL_B for pin 4 of PORTE
+*
+* E.g. Usage :
+*
+* /if (Sim_GetPin (TIMER3_CHANNEL_B)) .../ - Checks the left motor PWM pin
+*/
+byte Sim_GetPin(byte channel)
+{
+ Sim_Sync();
+ return sim.channels[channel].pin;
+}
+
+/*
+*
+* Name : Sim_GetPinTime
+*
+* Returns the simulated clock cycle at which the output compare pin of a timer channel last changed .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /edge=Sim_GetPinTime (TIMER3_CHANNEL_C);/ - Time of the last edge of the right motor PWM
+*/
+unsigned long long Sim_GetPinTime(byte channel)
+{
+ Sim_Sync();
+ return sim.channels[channel].pinTime;
+}
+
+/*
+*
+* Name : Sim_ResetStats
+*
+* Clears the bus statistics in /simStats/ .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /Sim_ResetStats ();/ - Starts counting for a new benchmark
+*/
+void Sim_ResetStats()
+{
+ Sim_Sync();
+ memset(&simStats,0,sizeof(simStats));
+}
+
+/*
+*
+* Name : Sim_PrintStats
+*
+* Prints the bus statistics since /Sim_ResetStats/ .The bus use is the share of the simulated time the bus was busy .
+* This function does not return a value .
+*
+* Parameters :
+*
+* /title/ - Text printed before the statistics
+*
+* E.g. Usage :
+*
+* /Sim_PrintStats ("sonar array");/ - Prints the statistics of a benchmark
+*/
+void Sim_PrintStats(const char * title)
+{
+ Sim_Sync();
+ printf("%s: %lu starts %lu restarts %lu stops %lu address %lu data %lu nacks %lu clocks %lu interrupts %llu busy cycles"
+        " of %llu\n",title,simStats.starts,simStats.restarts,simStats.stops,simStats.addressBytes,simStats.dataBytes,
+        simStats.nacks,simStats.sclClocks,simStats.interrupts,simStats.busyCycles,sim.cycles);
+}
+
+/*
+*
+* Name : Sim_Check
+*
+* Prints the result of a check made by a test program and counts the failures .Returns /passed/ .
+*
+* Parameters :
+*
+* /name/ - What is checked
+*
+* /passed/ - Non zero if the check passed
+*
+* E.g. Usage :
+*
+* /Sim_Check ("first echo",range==85);/ - Prints PASS or FAIL with the name
+*/
+int Sim_Check(const char * name,int passed)
+{
+ printf("%s %s\n",passed?"PASS":"FAIL",name);
+ if(!passed)
+     simFailures++;
+ return passed;
+}
+
+/*
+*
+* Name : Sim_GetFailures
+*
+* Returns the number of failed checks ,use it as the exit status of a test program .
+*
+* E.g. Usage :
+*
+* /return Sim_GetFailures ();/ - Ends a test program
+*/
+int Sim_GetFailures()
+{
+ return simFailures;
+}
+
+/*
+*
+* Name : Timer16_Init
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function ,the timers always run from the simulated clock .
+*
+* E.g. Usage :
+*
+* /Timer16_Init ();/ - Has no effect
+*/
+void Timer16_Init()
+{
+ Sim_Access();
+}
+
+/*
+*
+* Name : Timer16_Allocate
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .The handler function is called from the simulated compare
+* interrupt of the channel .Returns 1 ,or TIMER16_BUSY_ERROR (-1) if the channel is already used .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /fptr/ - Handler function
+*
+* E.g. Usage :
+*
+* /Timer16_Allocate (TIMER1_CHANNEL_C,BlinkHandler);/ - Uses Timer1 channel C for BlinkHandler
+*/
+int Timer16_Allocate(byte channel,void (*fptr)())
+{
+ Sim_Access();
+ if(channel>=TIMER16_CHANNELS || sim.channels[channel].handler!=NULL)
+     return TIMER16_BUSY_ERROR;
+ sim.channels[channel].handler=fptr;
+ return 1;
+}
+
+/*
+*
+* Name : Timer16_Now
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Returns the simulated clock in Timer1 ticks (0.5us) .
+*
+* Parameters :
+*
+* /channel/ - Any channel ,all read the same clock
+*
+* E.g. Usage :
+*
+* /now=Timer16_Now (TIMER1_CHANNEL_A);/ - Reads the timer
+*/
+unsigned int Timer16_Now(byte channel)
+{
+ (void)channel;
+ Sim_Access();
+ return (unsigned int)(sim.cycles/TIMER16_DIVISOR);
+}
+
+/*
+*
+* Name : Timer16_ScheduleAt
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Sets the compare value ,clears the flag and enables the
+* interrupt of the channel .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /count/ - Timer count at which the interrupt occurs
+*
+* E.g. Usage :
+*
+* /Timer16_ScheduleAt (TIMER1_CHANNEL_C,start+2000);/ - Interrupt 1ms after start
+*/
+void Timer16_ScheduleAt(byte channel,unsigned int count)
+{
+ Sim_Access();
+ sim.channels[channel].compare=count;
+ sim.channels[channel].match=Sim_NextMatch(count);
+ sim.channels[channel].flag=0;
+ sim.channels[channel].enabled=1;
+}
+
+/*
+*
+* Name : Timer16_Schedule
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Schedules the next interrupt a number of ticks from now .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /ticks/ - Ticks from now
+*
+* E.g. Usage :
+*
+* /Timer16_Schedule (TIMER1_CHANNEL_C,TIMER16_US(1500));/ - Interrupt after 1.5ms
+*/
+void Timer16_Schedule(byte channel,unsigned int ticks)
+{
+ Timer16_ScheduleAt(channel,Timer16_Now(channel)+ticks);
+}
+
+/*
+*
+* Name : Timer16_ScheduleNext
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Schedules the next interrupt a number of ticks after the
+* previous compare value .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /ticks/ - Ticks after the previous compare event
+*
+* E.g. Usage :
+*
+* /Timer16_ScheduleNext (TIMER1_CHANNEL_C,TIMER16_MS(20));/ - Next interrupt 20ms after the last one
+*/
+void Timer16_ScheduleNext(byte channel,unsigned int ticks)
+{
+ Timer16_ScheduleAt(channel,sim.channels[channel].compare+ticks);
+}
+
+/*
+*
+* Name : Timer16_Cancel
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Disables the interrupt of the channel ,the compare matches
+* go on .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /Timer16_Cancel (TIMER1_CHANNEL_C);/ - No more interrupts from Timer1 channel C
+*/
+void Timer16_Cancel(byte channel)
+{
+ Sim_Access();
+ sim.channels[channel].enabled=0;
+}
+
+/*
+*
+* Name : Timer16_SetPinMode
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Selects what the next compare matches do to the output
+* compare pin of the channel ,see /Sim_GetPin/ .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* /pinMode/ - TIMER16_PIN_DISCONNECTED ,TIMER16_PIN_TOGGLE ,TIMER16_PIN_CLEAR or TIMER16_PIN_SET
+*
+* E.g. Usage :
+*
+* /Timer16_SetPinMode (TIMER3_CHANNEL_B,TIMER16_PIN_SET);/ - Pin 4 of PORTE goes high at the next compare event
+*/
+void Timer16_SetPinMode(byte channel,byte pinMode)
+{
+ Sim_Access();
+ sim.channels[channel].pinMode=pinMode&0x03;
+}
+
+/*
+*
+* Name : Timer16_ForcePin
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Applies the pin mode to the output compare pin now without
+* an interrupt .
+*
+* Parameters :
+*
+* /channel/ - Timer channel
+*
+* E.g. Usage :
+*
+* /Timer16_ForcePin (TIMER3_CHANNEL_B);/ - Sets or clears pin 4 of PORTE now
+*/
+void Timer16_ForcePin(byte channel)
+{
+ Sim_Access();
+ Sim_PinAction(channel);
+}
+
+/*
+*
+* Name : Timer16_Free
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Cancels the interrupt ,disconnects the pin and makes the
+* channel available again .
+*
+* Parameters :
+*
+* /channel/ - Timer channel to free
+*
+* E.g. Usage :
+*
+* /Timer16_Free (TIMER1_CHANNEL_C);/ - Frees Timer1 channel C
+*/
+void Timer16_Free(byte channel)
+{
+ if(channel>=TIMER16_CHANNELS)
+     return;
+ Timer16_Cancel(channel);
+ Timer16_SetPinMode(channel,TIMER16_PIN_DISCONNECTED);
+ sim.channels[channel].handler=NULL;
+}
+
+/*
+*
+* Name : Timer16_Time
+*
+* Simulated version of the *16 BIT TIMER CHANNELS* function .Returns the simulated clock in Timer1 ticks (0.5us) as a
+* 32 bit count .
+*
+* E.g. Usage :
+*
+* /start=Timer16_Time ();/ - Reads the time
+*/
+unsigned long Timer16_Time()
+{
+ Sim_Access();
+ return (unsigned long)(sim.cycles/TIMER16_DIVISOR);
+}
+
+/*
+*
+* Name : Lcd_GotoXY
+*
+* Simulated *LCD* ,starts a new line on the standard output .
+*
+* E.g. Usage :
+*
+* /Lcd_GotoXY (2,14);/ - Moves to the second row
+*/
+void Lcd_GotoXY(byte row,byte column)
+{
+ (void)row;
+ (void)column;
+ putchar('\n');
+}
+
+/*
+*
+* Name : Lcd_putchar
+*
+* Simulated *LCD* ,prints the character on the standard output .
+*
+* E.g. Usage :
+*
+* /Lcd_putchar ('3');/ - Prints 3
+*/
+void Lcd_putchar(char character)
+{
+ putchar(character);
+ fflush(stdout);
+}
@@ -0,0 +1,286 @@
+/****************************************************
+* Module: Host Simulator
+*
+* The *HOST SIMULATOR* runs the *I2C* module and the *I2C SENSORS* module on a Linux PC without a *MegaBoard* .It takes
+* the place of the MegaIDE headers :the *TWI* registers and SREG become accessor macros ,every access costs a few
+* simulated clock cycles and moves the simulated bus on ,and the *TWI* interrupt is called whenever it is enabled and
+* TWINT is set just like on the MCU .*SRF08* and *CMPS03* models answer on the simulated bus and every START ,STOP ,byte
+* and SCL clock is counted so transfers can be compared .
+*
+* The library files are used unchanged .Include this header ,then the library files in the usual order and link with
+* megasim.c ,e.g. for a program sonartest.c which starts with
+*
+* #include "megasim.h"
+* #include "../ATmega128Lib/interrupts.c"
+* #include "../ATmega128Lib/i2c.c"
+* #include "../MegaBoardLib/i2c_sensors.c"
+*
+* build with gcc -I HostSim -o sonartest HostSim/sonartest.c HostSim/megasim.c .The *16 BIT TIMER CHANNELS* functions
+* are provided by the simulator from the simulated clock ,with the compare interrupts and output compare pins of the six
+* channels ,so the *SERVO* ,*STEPPER* and *DCMOTORS* modules run as well on PORTA ,PORTC and PORTE .Other interrupt
+* sources ,like an external interrupt ,are added with /Sim_AddInterrupt/ .Another master which addresses the MCU as a
+* slave is added with /Sim_AddMaster/ .Loops which do not touch a register ,like a delay loop counting a variable down
+* ,take no simulated time .
+*
+* The test programs in this directory print PASS or FAIL for each check and return the number of failures :
+*
+* + sonartest.c - *SRF08* and *CMPS03* reads ,address change and bus recovery
+* + servotest.c - servo pulse jitter with a deferred or a blocking interrupt handler
+* + queuetest.c - deadline of the queued *I2C* transactions which cannot start
+* + adapttest.c - ping period ,range and gain of an *SRF08* with an adaptive range
+* + cachetest.c - hits ,misses and joins of the *SENSOR CACHE* module
+* + odomtest.c - *ODOMETRY* with 32 bit longs on large step counts ,build it with -fwrapv
+* + interlocktest.c - times from a reading or a bumper to the brakes on and the steppers stopped
+* + slavetest.c - register map reads by another master while master transactions are queued
+*
+****************************************************/
+
+#ifndef MEGASIM_H
+#define MEGASIM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned char byte;
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#define _BV(bit) (1<<(bit))
+
+/* Simulated Clock */
+#define SIM_ACCESSCYCLES 2                          /* cycles per register access */
+#define SIM_ISRCYCLES    20                         /* interrupt entry and exit */
+#define SIM_MARKER       0xA500                     /* set in TWCR until the program writes it */
+
+/* Register Numbers */
+#define SIM_SREG  0
+#define SIM_TWBR  1
+#define SIM_TWSR  2
+#define SIM_TWAR  3
+#define SIM_TWDR  4
+#define SIM_PORTD 5
+#define SIM_DDRD  6
+#define SIM_PIND  7
+#define SIM_PORTA 8
+#define SIM_DDRA  9
+#define SIM_PORTC 10
+#define SIM_DDRC  11
+#define SIM_PORTE 12
+#define SIM_DDRE  13
+#define SIM_REGISTERS 14
+
+/* Registers */
+#define SREG  (*Sim_Register(SIM_SREG))
+#define TWBR  (*Sim_Register(SIM_TWBR))
+#define TWSR  (*Sim_Register(SIM_TWSR))
+#define TWAR  (*Sim_Register(SIM_TWAR))
+#define TWDR  (*Sim_Register(SIM_TWDR))
+#define PORTD (*Sim_Register(SIM_PORTD))
+#define DDRD  (*Sim_Register(SIM_DDRD))
+#define PIND  (*Sim_Register(SIM_PIND))
+#define PORTA (*Sim_Register(SIM_PORTA))
+#define DDRA  (*Sim_Register(SIM_DDRA))
+#define PORTC (*Sim_Register(SIM_PORTC))
+#define DDRC  (*Sim_Register(SIM_DDRC))
+#define PORTE (*Sim_Register(SIM_PORTE))
+#define DDRE  (*Sim_Register(SIM_DDRE))
+#define TWCR  (*Sim_Twcr())
+
+/* Register Bits */
+#define SREG_I 7
+#define TWINT  7
+#define TWEA   6
+#define TWSTA  5
+#define TWSTO  4
+#define TWWC   3
+#define TWEN   2
+#define TWIE   0
+
+/* Interrupts */
+#define SIGNAL(vector) void vector(void)
+#define sei() (SREG|=_BV(SREG_I))
+#define cli() (SREG&=~_BV(SREG_I))
+void SIG_2WIRE_SERIAL(void);
+
+/* I2C Definitions */
+#define I2C_SUCCESS         1
+#define I2C_START_ERROR     -1
+#define I2C_SLAVEACK_ERROR  -2
+#define I2C_SLAVEDATA_ERROR -3
+#define I2C_START           0x08
+#define I2C_REP_START       0x10
+#define I2C_MT_SLA_ACK      0x18
+#define I2C_MT_DATA_ACK     0x28
+#define I2C_MR_SLA_ACK      0x40
+#define I2C_MR_DATA_ACK     0x50
+#define I2C_SCODE           (TWSR&0xF8)
+#define I2C_SLA_W           (i2cSlaveAdd<<1)
+#define I2C_SLA_R           ((i2cSlaveAdd<<1)|1)
+#define GEN_START()         (TWCR=_BV(TWINT)|_BV(TWSTA)|_BV(TWEN))
+#define GEN_STOP()          (TWCR=_BV(TWINT)|_BV(TWSTO)|_BV(TWEN))
+#define CLR_TWINT()         (TWCR=_BV(TWINT)|_BV(TWEN))
+#define I2C_Wait()          while(!(TWCR&_BV(TWINT)))
+#define I2C_WaitForStop()   while(TWCR&_BV(TWSTO))
+
+/* Board Settings ,stand in for the MegaIDE project settings ,define your own before this header to change them */
+#ifndef START_VALUE
+#define START_VALUE        2000                     /* servo pulse at 0 degrees in timer ticks */
+#define END_VALUE          4400                     /* servo pulse at 180 degrees */
+#endif
+#if !defined _SERVO_TIMER1_ && !defined _SERVO_TIMER3_
+#define _SERVO_TIMER1_
+#endif
+#define _SERVO_PORT_       PORTC
+#define _SERVO_DIR_PORT_   DDRC
+#ifndef RAMPSTAGES
+#define RAMPSTAGES         4
+#define RAMPARRAY          {4000,3000,2000,1000}    /* step half periods in ticks of mainclock/8 */
+#define RAMPDURATION       40
+#define RAMPINTERVAL       10
+#endif
+#define _HALFSTEPPINGMODE_ 0
+#define _FULLSTEPPINGMODE_ 1
+#define FORWARD            0
+#define BACKWARD           1
+#define CLOCKWISE          0
+#define ANTICLOCKWISE      1
+#define LEFT               0
+#define RIGHT              1
+#define PWMREGISTER        1000
+#define MAXPWM             1000.0
+
+/* Program Memory ,the tables stay in RAM */
+#define PROGMEM
+#define pgm_read_byte(address) (*(address))
+#define pgm_read_word(address) (*(address))
+
+/* 16 Bit Timer Channels */
+#define TIMER1_CHANNEL_A     0
+#define TIMER1_CHANNEL_B     1
+#define TIMER1_CHANNEL_C     2
+#define TIMER3_CHANNEL_A     3
+#define TIMER3_CHANNEL_B     4
+#define TIMER3_CHANNEL_C     5
+#define TIMER16_CHANNELS     6
+#define TIMER16_PIN_DISCONNECTED 0
+#define TIMER16_PIN_TOGGLE   1
+#define TIMER16_PIN_CLEAR    2
+#define TIMER16_PIN_SET      3
+#define TIMER16_BUSY_ERROR   -1
+#define TIMER16_DIVISOR      8
+#define TIMER16_TICKS_PER_MS (F_CPU/TIMER16_DIVISOR/1000)
+#define TIMER16_MS(ms)       ((unsigned long)(ms)*TIMER16_TICKS_PER_MS)
+#define TIMER16_US(us)       ((unsigned long)(us)*(F_CPU/TIMER16_DIVISOR/1000)/1000)
+void Timer16_Init(void);
+int Timer16_Allocate(byte channel,void (*fptr)());
+unsigned int Timer16_Now(byte channel);
+void Timer16_ScheduleAt(byte channel,unsigned int count);
+void Timer16_Schedule(byte channel,unsigned int ticks);
+void Timer16_ScheduleNext(byte channel,unsigned int ticks);
+void Timer16_Cancel(byte channel);
+void Timer16_SetPinMode(byte channel,byte pinMode);
+void Timer16_ForcePin(byte channel);
+void Timer16_Free(byte channel);
+unsigned long Timer16_Time(void);
+
+/* LCD */
+#define Lcd_printf(...) printf(__VA_ARGS__)
+void Lcd_GotoXY(byte row,byte column);
+void Lcd_putchar(char character);
+
+/* UART */
+#define Uart0_printf(...) printf(__VA_ARGS__)
+#define Uart1_printf(...) printf(__VA_ARGS__)
+
+/* Devices */
+typedef struct SimDevice{
+byte address;
+byte (*start)(struct SimDevice * device,byte read);     /* returns 1 to ACK the address */
+byte (*write)(struct SimDevice * device,byte data);     /* returns 1 to ACK the byte */
+byte (*read)(struct SimDevice * device);
+void (*stop)(struct SimDevice * device);
+struct SimDevice * next;
+}SimDevice;
+
+typedef struct{
+SimDevice device;
+byte registers[36];                                 /* 0 revision ,1 light ,2-35 echoes */
+byte pointer;
+byte first;
+byte gain;
+byte range;
+byte light;
+byte changeStep;
+unsigned int echoes[17];                            /* distances in cm set with Sim_SetEchoes */
+byte echoCount;
+byte instant;                                       /* 1 to finish ranging at once */
+unsigned long long busyUntil;
+unsigned long pings;
+}SimSrf08;
+
+typedef struct{
+SimDevice device;
+byte pointer;
+byte first;
+unsigned int heading;                               /* tenths of a degree */
+byte calibrationPoints;
+}SimCmps03;
+
+typedef struct{
+byte address;                                       /* slave address of the MCU */
+byte * write;                                       /* bytes written ,the first is the register pointer */
+byte writeSize;
+byte * read;                                        /* receives the bytes read after a repeated START */
+byte readSize;
+byte acked;                                         /* set when the MCU answered its address */
+byte done;                                          /* set after the STOP */
+}SimMaster;
+
+typedef struct SimInterrupt{
+void (*vector)(void);                               /* interrupt function */
+volatile byte * mask;                               /* register with the enable bit ,NULL if always enabled */
+byte maskBit;
+unsigned long period;                               /* cycles between requests ,0 for a single request */
+unsigned long long due;                             /* cycle of the next request */
+byte pending;                                       /* interrupt flag */
+struct SimInterrupt * next;
+}SimInterrupt;
+
+typedef struct{
+unsigned long starts;
+unsigned long restarts;
+unsigned long stops;
+unsigned long addressBytes;
+unsigned long dataBytes;
+unsigned long nacks;
+unsigned long sclClocks;
+unsigned long interrupts;
+unsigned long long busyCycles;
+}SimStats;
+
+extern SimStats simStats;
+
+/* Simulator Functions */
+volatile byte * Sim_Register(byte number);
+volatile unsigned int * Sim_Twcr(void);
+void Sim_Init(void);
+void Sim_Run(unsigned long cycles);
+unsigned long long Sim_GetCycles(void);
+void Sim_StickBus(byte clocks);
+void Sim_AddDevice(SimDevice * device);
+void Sim_AddSrf08(SimSrf08 * sonar,byte address);
+void Sim_SetEchoes(SimSrf08 * sonar,unsigned int * distances,byte count);
+void Sim_AddCmps03(SimCmps03 * compass,byte address);
+void Sim_AddInterrupt(SimInterrupt * source,void (*vector)(void),volatile byte * mask,byte maskBit,unsigned long delay,
+                      unsigned long period);
+void Sim_AddMaster(SimMaster * master,unsigned long delay);
+byte Sim_GetPin(byte channel);
+unsigned long long Sim_GetPinTime(byte channel);
+int Sim_Check(const char * name,int passed);
+int Sim_GetFailures(void);
+void Sim_ResetStats(void);
+void Sim_PrintStats(const char * title);
+
+#endif
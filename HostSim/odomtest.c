@@ -0,0 +1,94 @@
+/****************************************************
+* Test: Odometry
+*
+* Runs the *ODOMETRY* module with a long of 32 bits ,as on the MCU ,on step counts given by the test .A straight run of
+* 20000 steps must end 23.56m along ,and a spin on the spot and arcs taken in one update must end where updates as large
+* as the parts /Odometry_Update/ splits them into end .
+* The host int stays at 32 bits so the 16 bit sums are covered by the casts to long in /Odometry_Update/ ,not by this
+* test .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -fwrapv -I HostSim -o odomtest HostSim/odomtest.c HostSim/megasim.c && ./odomtest
+*
+****************************************************/
+
+#include <stdlib.h>
+#include "megasim.h"
+
+/* No TWI in this test */
+void SIG_2WIRE_SERIAL(void)
+{
+}
+
+/* Step counts and compass given by the test */
+static int leftCount,rightCount;
+
+void Stepper_GetStepCounts(int * left,int * right)
+{
+ *left=leftCount;
+ *right=rightCount;
+}
+
+unsigned int Compass_GetSampleCount()
+{
+ return 0;
+}
+
+int Compass_GetHeading()
+{
+ return -1;
+}
+
+#define long int
+#include "../MegaBoardLib/odometry.c"
+#undef long
+
+/* Takes the steps in updates of at most step steps per wheel ,returns the pose */
+static Odometry_Pose Run(int left,int right,int step)
+{
+ Odometry_Pose pose;
+ int done=0,most=(abs(left)>abs(right))?abs(left):abs(right);
+ leftCount=0;
+ rightCount=0;
+ Odometry_Init(1178,150,0);
+ while(done<most)
+  {
+   done=(done+step<most)?done+step:most;
+   leftCount=(int)((long long)left*done/most);
+   rightCount=(int)((long long)right*done/most);
+   Odometry_Update();
+  }
+ Odometry_GetPose(&pose);
+ return pose;
+}
+
+/* Runs a move in one update and in updates as large as the parts it is split into ,which must end within 1mm and 0.01
+   radians ,and prints it in updates of 50 steps as well to show how closely the curve is followed */
+static void Check(const char * name,int left,int right)
+{
+ Odometry_Pose once=Run(left,right,32767);
+ Odometry_Pose parts=Run(left,right,odometry.maxSteps);
+ Odometry_Pose steps=Run(left,right,50);
+ long long turn=llabs((long long)once.theta-parts.theta);
+ if(turn>ODOMETRY_PI)
+     turn=ODOMETRY_TWOPI-turn;
+ printf("%s %d/%d steps :x y theta %.1f %.1f %.3f in one update ,%.1f %.1f %.3f in updates of %u ,%.1f %.1f %.3f in "
+        "updates of 50\n",name,left,right,once.x/65536.0,once.y/65536.0,once.theta/65536.0,parts.x/65536.0,
+        parts.y/65536.0,parts.theta/65536.0,odometry.maxSteps,steps.x/65536.0,steps.y/65536.0,steps.theta/65536.0);
+ Sim_Check(name,llabs((long long)once.x-parts.x)<65536 && llabs((long long)once.y-parts.y)<65536 && turn<656);
+}
+
+int main()
+{
+ Odometry_Pose pose;
+ pose=Run(20000,20000,32767);
+ printf("long is %u bytes ,%u steps per part\n",(unsigned int)sizeof(odometry.stepLength),odometry.maxSteps);
+ Sim_Check("straight 23.56m",pose.x==0 && llabs((long long)pose.y-23560LL*65536)<65536 && pose.theta==0);
+ Check("straight",20000,20000);
+ Check("spin",10000,-10000);
+ Check("arc",3000,2000);
+ Check("long arc",30000,20000);
+ Check("reverse arc",-12000,-16000);
+ return Sim_GetFailures();
+}
@@ -0,0 +1,101 @@
+/****************************************************
+* Test: I2C Queue
+*
+* Checks that no transaction waits for ever in the *I2C* queue :a transaction which cannot start because the MCU stays
+* busy as a slave ends with I2C_TIMEOUT_ERROR I2CQUEUETIMEOUT after it was submitted ,both when it is waited for and
+* when only /I2C_CheckTimeout/ is called ,and /I2C_Init/ ends the transactions left in the queue .Returns the number of
+* failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o queuetest HostSim/queuetest.c HostSim/megasim.c && ./queuetest
+*
+****************************************************/
+
+#include "megasim.h"
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+
+/* Variables */
+static SimCmps03 compass;
+static byte completed;
+
+/* Completion function of the queued transactions */
+static void Completed(I2C_Transaction * transaction)
+{
+ (void)transaction;
+ completed++;
+}
+
+/* Makes a one byte read of the compass */
+static void MakeRead(I2C_Transaction * transaction,I2C_Segment * segment,byte * data)
+{
+ segment->type=I2C_READ;
+ segment->size=1;
+ segment->data=data;
+ transaction->address=0x60;
+ transaction->flags=0;
+ transaction->segments=segment;
+ transaction->segmentCount=1;
+ transaction->bitRate=0;
+ transaction->callback=Completed;
+}
+
+int main()
+{
+ I2C_Transaction first,second;
+ I2C_Segment firstSegment,secondSegment;
+ byte firstData,secondData;
+ unsigned long long start;
+ double waited;
+
+ Sim_Init();
+ Sim_AddCmps03(&compass,0x60);
+ compass.heading=1234;
+ I2C_Init();
+ sei();
+ Sim_Check("compass bearing",Cmps03_GetReading(0x60)==1234);
+
+ /* A master keeps the MCU addressed as a slave ,the blocking read gives up */
+ i2cSlave.active=1;
+ start=Sim_GetCycles();
+ Sim_Check("blocking read times out",Cmps03_GetReading(0x60)==I2C_TIMEOUT_ERROR);
+ waited=(Sim_GetCycles()-start)/(F_CPU/1000.0);
+ printf("blocking read ended after %.1fms\n",waited);
+ Sim_Check("blocking read deadline",waited>=I2CQUEUETIMEOUT && waited<I2CQUEUETIMEOUT+2);
+
+ /* Submitted transactions end when I2C_CheckTimeout is called after the deadline */
+ MakeRead(&first,&firstSegment,&firstData);
+ MakeRead(&second,&secondSegment,&secondData);
+ start=Sim_GetCycles();
+ I2C_Submit(&first);
+ Sim_Run(F_CPU/1000*10);
+ I2C_Submit(&second);
+ while(first.status==I2C_PENDING)
+  {
+   Sim_Run(F_CPU/1000);
+   I2C_CheckTimeout();
+  }
+ waited=(Sim_GetCycles()-start)/(F_CPU/1000.0);
+ printf("queued transaction ended after %.1fms\n",waited);
+ Sim_Check("queued transaction times out",first.status==I2C_TIMEOUT_ERROR && completed==1);
+ Sim_Check("later transaction still queued",second.status==I2C_PENDING);
+ while(second.status==I2C_PENDING)
+  {
+   Sim_Run(F_CPU/1000);
+   I2C_CheckTimeout();
+  }
+ Sim_Check("later transaction times out",second.status==I2C_TIMEOUT_ERROR && completed==2);
+ Sim_Check("queue empty",I2C_IsIdle());
+
+ /* I2C_Init ends whatever is left in the queue */
+ I2C_Submit(&first);
+ I2C_Submit(&second);
+ I2C_Init();
+ Sim_Check("init ends the queue",first.status==I2C_TIMEOUT_ERROR && second.status==I2C_TIMEOUT_ERROR && completed==4);
+
+ i2cSlave.active=0;
+ Sim_Check("bus usable again",Cmps03_GetReading(0x60)==1234);
+ return Sim_GetFailures();
+}
@@ -0,0 +1,83 @@
+/****************************************************
+* Test: Servo Jitter
+*
+* Measures the worst servo pulse jitter while a deferrable interrupt ,standing for a *UART* receive or an external
+* interrupt ,calls a user handler function which takes HANDLERTIME cycles .The servo edges are timed by their compare
+* interrupt and /Servo_GetMaxLatency/ gives the longest delay between an edge being due and the servo interrupt changing
+* the pin ,see the *INTERRUPT PRIORITIES* module .Build it twice ,with and without _BLOCKING_CALLBACKS_ ,to compare the
+* handler running with interrupts disabled ,as before ,and deferred .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o servotest HostSim/servotest.c HostSim/megasim.c && ./servotest
+* gcc -I HostSim -D_BLOCKING_CALLBACKS_ -o servotest HostSim/servotest.c HostSim/megasim.c && ./servotest
+*
+****************************************************/
+
+#include "megasim.h"
+#include "../ATmega128Lib/interrupts.c"
+#include "../MegaBoardLib/servo.c"
+
+/* Test Settings */
+#define HANDLERTIME   (F_CPU/10000)                 /* 100us in the user handler */
+#define HANDLERPERIOD (F_CPU/770)                   /* about 1.3ms between interrupts ,not a multiple of the servo frame */
+#define TESTTIME      (F_CPU*2)                     /* 2s ,100 servo frames */
+
+/* Variables */
+static volatile byte testMask=_BV(7);               /* stands for the receive interrupt enable bit */
+static void (*testHandler)();
+static SimInterrupt testSource;
+static unsigned long handlerCalls;
+
+/* User handler function ,busy for HANDLERTIME */
+static void TestHandler()
+{
+ handlerCalls++;
+ Sim_Run(HANDLERTIME);
+}
+
+/* The deferrable interrupt ,acknowledged by taking the interrupt like a receive interrupt reading its data */
+ISR_DEFERRABLE(SIG_TEST)
+{
+ if(testHandler!=NULL)
+     ISR_DEFER_CALL(testMask,7,testHandler,testHandler());
+}
+
+/* No TWI in this test */
+void SIG_2WIRE_SERIAL(void)
+{
+}
+
+int main()
+{
+ unsigned int latency;
+ Sim_Init();
+ sei();
+ Servo_Init();
+ Servo_SetAngles(0,30,60,90,120,150,180,45);
+ Servo_Start();
+
+ Sim_Run(TESTTIME/10);
+ Servo_ResetMaxLatency();
+ Sim_Run(TESTTIME);
+ latency=Servo_GetMaxLatency();
+ printf("servos alone: worst jitter %u ticks (%.1fus)\n",latency,latency/2.0);
+ Sim_Check("servo jitter without other interrupts",latency<TIMER16_US(10));
+
+ testHandler=TestHandler;
+ Sim_AddInterrupt(&testSource,SIG_TEST,&testMask,7,0,HANDLERPERIOD);
+ Servo_ResetMaxLatency();
+ Sim_Run(TESTTIME);
+ latency=Servo_GetMaxLatency();
+#ifdef _BLOCKING_CALLBACKS_
+ printf("blocking handler of %luus ,%lu calls: worst jitter %u ticks (%.1fus)\n",HANDLERTIME/(F_CPU/1000000),
+        handlerCalls,latency,latency/2.0);
+ Sim_Check("blocking handler delays the servo edges",latency>=TIMER16_US(50));
+#else
+ printf("deferred handler of %luus ,%lu calls: worst jitter %u ticks (%.1fus) ,deepest nesting %d\n",
+        HANDLERTIME/(F_CPU/1000000),handlerCalls,latency,latency/2.0,Isr_GetMaxDepth());
+ Sim_Check("deferred handler does not delay the servo edges",latency<TIMER16_US(10));
+#endif
+ Sim_Check("handler called",handlerCalls>=TESTTIME/HANDLERPERIOD-1);
+ return Sim_GetFailures();
+}
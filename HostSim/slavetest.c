@@ -0,0 +1,118 @@
+/****************************************************
+* Test: I2C Slave
+*
+* Another master reads and writes the register map of the MCU made a slave with /I2C_SlaveInit/ .The read sets the
+* register pointer and reads after a repeated START ,the way a host reads a sensor .It is checked once with the queue
+* empty ,once while a master transaction to a *CMPS03* model is waiting for the bus ,which must be sent after the
+* slave transfer and not time out ,and once after a *TWI* interrupt with no transaction running ,which must leave the
+* slave answering .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o slavetest HostSim/slavetest.c HostSim/megasim.c && ./slavetest
+*
+****************************************************/
+
+#include "megasim.h"
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+
+#define SLAVEADDRESS 0x30
+
+/* Variables */
+static SimCmps03 compass;
+static byte readOnly[2][8]={{10,11,12,13,14,15,16,17},{0}};
+static byte readWrite[4];
+
+/* Makes another master read three registers from register 2 and waits until it is done */
+static byte ReadRegisters(SimMaster * host,byte * data)
+{
+ static byte pointer=2;
+ host->address=SLAVEADDRESS;
+ host->write=&pointer;
+ host->writeSize=1;
+ host->read=data;
+ host->readSize=3;
+ Sim_AddMaster(host,0);
+ while(!host->done)
+     Sim_Run(F_CPU/100000);
+ return host->acked && data[0]==12 && data[1]==13 && data[2]==14;
+}
+
+int main()
+{
+ SimMaster host;
+ I2C_Transaction transaction;
+ I2C_Segment segment;
+ byte data[3],revision;
+ byte write[2]={9,0x5A};
+ unsigned long long start;
+ unsigned long recoveries;
+ double waited;
+
+ Sim_Init();
+ Sim_AddCmps03(&compass,0x60);
+ compass.heading=1234;
+ I2C_Init();
+ I2C_SlaveInit(SLAVEADDRESS,readOnly[0],readOnly[1],8,readWrite,4);
+ sei();
+
+ Sim_Check("register read",ReadRegisters(&host,data));
+
+ /* Register 9 is the second read write register */
+ host.write=write;
+ host.writeSize=2;
+ host.readSize=0;
+ Sim_AddMaster(&host,0);
+ while(!host.done)
+     Sim_Run(F_CPU/100000);
+ Sim_Check("register write",host.acked && readWrite[1]==0x5A && I2C_SlaveWritten());
+
+ /* The compass read is submitted while the MCU is addressed ,its START waits for the bus and is cancelled when the
+    other master addresses the MCU again after its repeated START .A read with no register pointer gets register 0
+    ,the software revision 14 of the model */
+ memset(data,0,sizeof(data));
+ recoveries=I2C_GetRecoveryCount();
+ host.address=SLAVEADDRESS;
+ host.write=write;
+ host.writeSize=1;
+ host.read=data;
+ host.readSize=3;
+ write[0]=2;
+ Sim_AddMaster(&host,0);
+ while(!i2cSlave.active)
+     Sim_Run(F_CPU/100000);
+ segment.type=I2C_READ;
+ segment.size=1;
+ segment.data=&revision;
+ transaction.address=0x60;
+ transaction.flags=0;
+ transaction.segments=&segment;
+ transaction.segmentCount=1;
+ transaction.bitRate=0;
+ transaction.callback=NULL;
+ I2C_Submit(&transaction);
+ while(!host.done)
+     Sim_Run(F_CPU/100000);
+ start=Sim_GetCycles();
+ while(transaction.status==I2C_PENDING && Sim_GetCycles()-start<F_CPU/1000*(I2CQUEUETIMEOUT+10))
+  {
+   Sim_Run(F_CPU/100000);
+   I2C_CheckTimeout();
+  }
+ waited=(Sim_GetCycles()-start)/(F_CPU/1000.0);
+ printf("queued transaction ended %.2fms after the slave transfer\n",waited);
+ Sim_Check("read while queued",host.acked && data[0]==12 && data[1]==13 && data[2]==14);
+ Sim_Check("queued transaction sent",transaction.status==I2C_SUCCESS && revision==14);
+ Sim_Check("queued transaction not held",waited<1);
+ Sim_Check("no bus recovery",I2C_GetRecoveryCount()==recoveries);
+
+ /* A TWI interrupt with no transaction running ,e.g. after a bus error */
+ cli();
+ SIG_2WIRE_SERIAL();
+ sei();
+ memset(data,0,sizeof(data));
+ Sim_Check("slave answers after a stray interrupt",ReadRegisters(&host,data));
+ return Sim_GetFailures();
+}
@@ -0,0 +1,82 @@
+/****************************************************
+* Test: Sonar and Compass
+*
+* Reads an *SRF08* and a *CMPS03* model through the *I2C* and *I2C SENSORS* modules :blocking and background ranging
+* ,the light sensor ,a missing device ,the address change sequence and the recovery of a stuck bus .The bus statistics of
+* each transfer are printed for comparison .Returns the number of failed checks .
+*
+* Build and run from the repository root with
+*
+* gcc -I HostSim -o sonartest HostSim/sonartest.c HostSim/megasim.c && ./sonartest
+*
+****************************************************/
+
+#include "megasim.h"
+#include "../ATmega128Lib/interrupts.c"
+#include "../ATmega128Lib/i2c.c"
+#include "../MegaBoardLib/i2c_sensors.c"
+
+/* Variables */
+static SimSrf08 sonar;
+static SimCmps03 compass;
+static byte rangingDone;
+
+/* Completion function of the background ranging */
+static void RangingDone(Srf08_Ranging * ranging)
+{
+ (void)ranging;
+ rangingDone++;
+}
+
+int main()
+{
+ unsigned int echoes[2]={85,240};
+ unsigned long long start;
+ unsigned long polls=0;
+ Srf08_Ranging ranging;
+
+ Sim_Init();
+ Sim_AddSrf08(&sonar,0x70);
+ Sim_AddCmps03(&compass,0x60);
+ Sim_SetEchoes(&sonar,echoes,2);
+ compass.heading=1234;
+ I2C_Init();
+ sei();
+
+ Sim_ResetStats();
+ Sim_Check("compass bearing",Cmps03_GetReading(0x60)==1234);
+ Sim_PrintStats("compass read");
+
+ /* The blocking read waits in a delay loop ,which takes no simulated time */
+ sonar.instant=1;
+ Sim_ResetStats();
+ Sim_Check("blocking range",Srf08_ReadDistance(0x70,SRF08_CM)==85);
+ Sim_PrintStats("blocking range");
+ Sim_Check("light sensor",Srf08_ReadLightSensor(0x70)==128);
+ sonar.instant=0;
+
+ /* Background ranging takes the full 65ms echo window */
+ Srf08_InitRanging(&ranging);
+ Sim_ResetStats();
+ start=Sim_GetCycles();
+ Sim_Check("ranging started",Srf08_StartRanging(&ranging,0x70,SRF08_CM,RangingDone)==I2C_SUCCESS);
+ while(!Srf08_Poll(&ranging))
+  {
+   polls++;
+   Sim_Run(F_CPU/10000);
+  }
+ printf("background range %d after %.1fms and %lu polls\n",ranging.range,(Sim_GetCycles()-start)/(F_CPU/1000.0),polls);
+ Sim_Check("background range",ranging.range==85 && rangingDone==1);
+ Sim_Check("ranging time",Sim_GetCycles()-start>=F_CPU/1000*65);
+ Sim_PrintStats("background range");
+
+ Sim_Check("missing sonar",Srf08_ReadDistance(0x71,SRF08_CM)==I2C_SLAVEACK_ERROR);
+
+ /* A device holding SDA low is clocked free */
+ Sim_StickBus(5);
+ Sim_Check("stuck bus times out",Cmps03_GetReading(0x60)==I2C_TIMEOUT_ERROR);
+ Sim_Check("bus recovered",I2C_GetRecoveryCount()==1 && Cmps03_GetReading(0x60)==1234);
+
+ Sim_Check("address change",Srf08_ChangeAddress(0x70,0x72)==I2C_SUCCESS && sonar.device.address==0x72);
+ return Sim_GetFailures();
+}
@@ -0,0 +1,265 @@
+/****************************************************
+* Module: Compass
+*
+* The *COMPASS* module keeps an up to date heading from the *CMPS03* compass without making your program wait for the
+* bus .The compass is read every COMPASSPERIOD ms on the interrupt driven transfer queue of the *I2C* module and each
+* reading is smoothed by a fixed point filter .The filter knows that 3599 and 0 are neighbours ,so the heading does not
+* swing through south when the robot turns about north .Call /Compass_Update/ regularly ,e.g. every pass of your main
+* loop ,and read the heading with /Compass_GetHeading/ as often as you like ,it only copies the last value .Each heading
+* is stamped with the time it was read .
+*
+****************************************************/
+
+/* Compass Settings */
+#ifndef COMPASSPERIOD
+#define COMPASSPERIOD       50                      /* ms between readings */
+#endif
+#define COMPASS_FULLCIRCLE  3600                    /* tenths of a degree */
+#define COMPASS_NO_READING  -6
+
+/* Variables */
+static struct{
+I2C_Transaction transaction;
+I2C_Segment segments[2];
+byte reg;
+byte data[2];
+byte shift;                                         /* smoothing ,each reading moves the heading by 1/2^shift */
+byte running;
+unsigned long period;
+unsigned long readTime;                             /* Timer16_Time of the last read started */
+long filtered;                                      /* heading in tenths of a degree ,Q8 */
+volatile int heading;
+volatile int raw;
+volatile unsigned long time;
+volatile unsigned int samples;
+volatile unsigned int errors;
+}compass;
+
+/* Functions */
+
+/* Completion function of the compass reads ,filters the new heading */
+static void Compass_Next(I2C_Transaction * transaction)
+{
+ int raw,error;
+ long heading;
+ if(transaction->status!=I2C_SUCCESS || (raw=(compass.data[0]<<8)|compass.data[1])>=COMPASS_FULLCIRCLE)
+  {
+   compass.errors++;
+   return;
+  }
+ if(compass.samples==0)
+     compass.filtered=(long)raw<<8;
+ else
+  {
+   /* Difference taken the short way round the circle */
+   error=raw-(int)(compass.filtered>>8);
+   if(error>=COMPASS_FULLCIRCLE/2)
+       error-=COMPASS_FULLCIRCLE;
+   else if(error<-COMPASS_FULLCIRCLE/2)
+       error+=COMPASS_FULLCIRCLE;
+   compass.filtered+=((long)error<<8)>>compass.shift;
+   if(compass.filtered<0)
+       compass.filtered+=(long)COMPASS_FULLCIRCLE<<8;
+   else if(compass.filtered>=(long)COMPASS_FULLCIRCLE<<8)
+       compass.filtered-=(long)COMPASS_FULLCIRCLE<<8;
+  }
+ heading=(compass.filtered+128)>>8;
+ compass.heading=(heading>=COMPASS_FULLCIRCLE)?0:(int)heading;
+ compass.raw=raw;
+ compass.time=compass.readTime;
+ compass.samples++;
+}
+
+/*
+*
+* Name : Compass_Init
+*
+* Starts reading the *CMPS03* compass in the background .The heading is smoothed by moving it 1/2^smoothing of the way
+* towards each new reading ,0 gives the readings as they are .This function does not return a value .
+*
+* Parameters :
+*
+* /deviceAddress/ - address of *CMPS03* . Default factory set address is 0x60(96)
+*
+* /period/ - Range 1-65535 .Time between readings in ms ,COMPASSPERIOD if 0
+*
+* /smoothing/ - Range 0-7 .Filter strength
+*
+* E.g. Usage :
+*
+* /Compass_Init (0x60,20,2);/ - Reads the compass 50 times a second and smooths over about four readings
+*/
+void Compass_Init(byte deviceAddress,unsigned int period,byte smoothing)
+{
+ compass.running=0;
+ if(compass.transaction.segments!=NULL)
+     I2C_WaitFor(&compass.transaction);
+ compass.reg=2;
+ compass.segments[0].type=I2C_WRITE;
+ compass.segments[0].size=1;
+ compass.segments[0].data=&compass.reg;
+ compass.segments[1].type=I2C_READ;
+ compass.segments[1].size=2;
+ compass.segments[1].data=compass.data;
+ compass.transaction.address=deviceAddress;
+ compass.transaction.flags=0;
+ compass.transaction.segments=compass.segments;
+ compass.transaction.segmentCount=2;
+ compass.transaction.bitRate=0;
+ compass.transaction.callback=Compass_Next;
+ compass.transaction.status=I2C_SUCCESS;
+ compass.shift=(smoothing>7)?7:smoothing;
+ compass.period=TIMER16_MS(period?period:COMPASSPERIOD);
+ compass.samples=0;
+ compass.errors=0;
+ compass.heading=COMPASS_NO_READING;
+ compass.raw=COMPASS_NO_READING;
+ compass.time=0;
+ compass.readTime=Timer16_Time()-compass.period;    /* first reading at the first update */
+ compass.running=1;
+}
+
+/*
+*
+* Name : Compass_Stop
+*
+* Stops reading the compass after the transfer on the bus ,if any ,is complete .The last heading stays available .This
+* function does not return a value .
+*
+* E.g. Usage :
+*
+* /Compass_Stop ();/ - Stops the compass readings
+*/
+void Compass_Stop()
+{
+ compass.running=0;
+ if(compass.transaction.segments!=NULL)
+     I2C_WaitFor(&compass.transaction);
+}
+
+/*
+*
+* Name : Compass_Update
+*
+* Starts the next compass reading when it is due .Returns at once ,the transfer runs in the background .Call it
+* regularly ,at least every COMPASSPERIOD ms ,from one place only .A reading is skipped if the last one has not
+* finished .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /while (1) { Compass_Update (); ... }/ - Keeps the heading up to date from the main loop
+*/
+void Compass_Update()
+{
+ unsigned long now;
+ if(!compass.running || compass.transaction.status==I2C_PENDING)
+     return;
+ now=Timer16_Time();
+ if(now-compass.readTime<compass.period)
+     return;
+ compass.readTime+=compass.period;
+ if(now-compass.readTime>=compass.period)
+     compass.readTime=now;                          /* fell behind ,no catching up */
+ I2C_Submit(&compass.transaction);
+}
+
+/*
+*
+* Name : Compass_GetHeading
+*
+* Returns the smoothed heading in tenths of a degree from 0 to 3599 ,or COMPASS_NO_READING (-6) if there is no reading
+* yet .Only copies the last value so it can be called as often as needed .
+*
+* E.g. Usage :
+*
+* /heading=Compass_GetHeading ();/ - Reads the heading
+*/
+int Compass_GetHeading()
+{
+ int heading;
+ byte sreg=SREG;
+ cli();
+ heading=compass.heading;
+ SREG=sreg;
+ return heading;
+}
+
+/*
+*
+* Name : Compass_GetRawHeading
+*
+* Returns the last reading of the compass in tenths of a degree without smoothing ,or COMPASS_NO_READING (-6) .
+*
+* E.g. Usage :
+*
+* /raw=Compass_GetRawHeading ();/ - Reads the last compass reading
+*/
+int Compass_GetRawHeading()
+{
+ int raw;
+ byte sreg=SREG;
+ cli();
+ raw=compass.raw;
+ SREG=sreg;
+ return raw;
+}
+
+/*
+*
+* Name : Compass_GetTime
+*
+* Returns the time at which the last heading was read ,in ticks of /Timer16_Time/ (0.5us) .
+*
+* E.g. Usage :
+*
+* /age=Timer16_Time ()-Compass_GetTime ();/ - Works out how old the heading is
+*/
+unsigned long Compass_GetTime()
+{
+ unsigned long time;
+ byte sreg=SREG;
+ cli();
+ time=compass.time;
+ SREG=sreg;
+ return time;
+}
+
+/*
+*
+* Name : Compass_GetSampleCount
+*
+* Returns the number of good readings since /Compass_Init/ .Use it to wait for a new heading .
+*
+* E.g. Usage :
+*
+* /samples=Compass_GetSampleCount ();/ - Remembers the reading count
+*/
+unsigned int Compass_GetSampleCount()
+{
+ unsigned int samples;
+ byte sreg=SREG;
+ cli();
+ samples=compass.samples;
+ SREG=sreg;
+ return samples;
+}
+
+/*
+*
+* Name : Compass_GetErrorCount
+*
+* Returns the number of readings since /Compass_Init/ which failed or were out of range .
+*
+* E.g. Usage :
+*
+* /if (Compass_GetErrorCount ()>10) .../ - Checks the compass connection
+*/
+unsigned int Compass_GetErrorCount()
+{
+ unsigned int errors;
+ byte sreg=SREG;
+ cli();
+ errors=compass.errors;
+ SREG=sreg;
+ return errors;
+}
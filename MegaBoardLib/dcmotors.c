@@ -4,15 +4,40 @@
 * The *DCMOTORS* module can control upto 2 DC motors with current rating of upto 2 amperes per motor .
 * This module provides easy to use functions which control the speed and direction of rotation of the DC motors .  
 *
+* The PWM signals are generated on Timer3 channels B and C of the *16 BIT TIMER CHANNELS* module .The hardware sets and 
+* clears the motor pins at the compare events ,so the pulse edges are exact ,and the next edge is scheduled from the
+* compare interrupt .
+*
 */
 
+/* PWM Settings */
+#ifndef DCMOTORPERIOD
+#define DCMOTORPERIOD 1000
+#endif
+#define DCMOTORMINPULSE 40
+
+/* Variables */
+static struct{
+unsigned int duty;
+unsigned int periodStart;
+unsigned char risingEdge;
+}dcmotorStruct[2];
+static volatile unsigned char dcmotorsHalted;       /* set by DCmotors_Halt ,changes are refused */
+
+/* Local Functions */
+static void DCmotors_LeftUpdate();
+static void DCmotors_RightUpdate();
+static void DCmotors_SetDuty(unsigned char motor,unsigned int pwmValue);
+
 /* Functions */
 /*
 *
 * Name : DCmotors_Init
 * 
-* Initializes the *DCMOTORS* module .This function is already called by the /MegaBoardInit/ function so no need to call 
-* it explicitly unless you want to reinitialize the module .This function does not return any value.
+* Initializes the *DCMOTORS* module and starts the PWM on Timer3 channels B and C with both motors stopped .The PWM
+* period is DCMOTORPERIOD timer ticks (default 1000 ticks or 500us) .This function is already called by the
+* /MegaBoardInit/ function so no need to call it explicitly unless you want to reinitialize the module .This function
+* does not return any value.
 *
 * E.g. Usage :
 *
@@ -20,11 +45,24 @@
 */
 void DCmotors_Init()
 {
+ unsigned int start;
+ byte sreg;
  DDRD=0xF0;
- TCCR3A=_BV(COM3B1)|_BV(COM3C1)|_BV(WGM30);
- TCCR3B=_BV(WGM33);
- TCNT3=0;
- OCR3A=PWMREGISTER;
+ Timer16_Allocate(TIMER3_CHANNEL_B,DCmotors_LeftUpdate);
+ Timer16_Allocate(TIMER3_CHANNEL_C,DCmotors_RightUpdate);
+ sreg=SREG;
+ cli();
+ Timer16_SetPinMode(TIMER3_CHANNEL_B,TIMER16_PIN_CLEAR);
+ Timer16_SetPinMode(TIMER3_CHANNEL_C,TIMER16_PIN_CLEAR);
+ Timer16_ForcePin(TIMER3_CHANNEL_B);
+ Timer16_ForcePin(TIMER3_CHANNEL_C);
+ start=Timer16_Now(TIMER3_CHANNEL_B)+100;
+ dcmotorStruct[0].duty=dcmotorStruct[1].duty=0;
+ dcmotorStruct[0].periodStart=dcmotorStruct[1].periodStart=start;
+ dcmotorStruct[0].risingEdge=dcmotorStruct[1].risingEdge=1;
+ Timer16_ScheduleAt(TIMER3_CHANNEL_B,start);
+ Timer16_ScheduleAt(TIMER3_CHANNEL_C,start);
+ SREG=sreg;
  DDRE=_BV(4)|_BV(5);
 }
 
@@ -50,6 +88,8 @@ void DCmotors_Init()
 */
 void DCmotors_ChangeDir(byte leftMotorDir,byte rightMotorDir)
 {
+    if(dcmotorsHalted)
+        return;
     PORTD=((leftMotorDir<<6)&0xC0)|((rightMotorDir<<4)&0x30);
 }
 
@@ -78,8 +118,8 @@ void DCmotors_ChangeSpeed(unsigned int leftMotorSpeed,unsigned int rightMotorSpe
   {
    leftMotorSpeed=(unsigned int)((MAXPWM/100)*(float)leftMotorSpeed); 
    rightMotorSpeed=(unsigned int)((MAXPWM/100)*(float)rightMotorSpeed);  
-   OCR3B=leftMotorSpeed;
-   OCR3C=rightMotorSpeed;
+   DCmotors_SetDuty(0,leftMotorSpeed);
+   DCmotors_SetDuty(1,rightMotorSpeed);
   }
 }
 
@@ -101,10 +141,12 @@ void DCmotors_ChangeSpeed(unsigned int leftMotorSpeed,unsigned int rightMotorSpe
 */
 void DCmotors_SetLeftMotor(unsigned int motorSpeed,byte motorDir)
 {
+  if(dcmotorsHalted)
+   return;
   if(motorSpeed<=100)
   {
    motorSpeed=(unsigned int)((MAXPWM/100)*(float)motorSpeed);  
-   OCR3B=motorSpeed;
+   DCmotors_SetDuty(0,motorSpeed);
   }
    PORTD&=(motorDir<<6)&0xC0;
 }
@@ -127,10 +169,12 @@ void DCmotors_SetLeftMotor(unsigned int motorSpeed,byte motorDir)
 */
 void DCmotors_SetRightMotor(unsigned int motorSpeed,byte motorDir)
 {
+  if(dcmotorsHalted)
+   return;
   if(motorSpeed<=100)
   {
    motorSpeed=(unsigned int)((MAXPWM/100)*(float)motorSpeed);  
-   OCR3C=motorSpeed;
+   DCmotors_SetDuty(1,motorSpeed);
   }
   PORTD&=(motorDir<<4)&0x30;
 }
@@ -147,7 +191,93 @@ void DCmotors_SetRightMotor(unsigned int motorSpeed,byte motorDir)
 */
 void DCmotors_ApplyBrakes()
 {
- OCR3B=MAXPWM;
- OCR3C=MAXPWM;
+ DCmotors_SetDuty(0,MAXPWM);
+ DCmotors_SetDuty(1,MAXPWM);
  PORTD|=0xF0;
+}
+
+/*
+*
+* Name : DCmotors_Halt
+* 
+* Brakes both the motors like /DCmotors_ApplyBrakes/ and refuses any change of speed or direction until
+* /DCmotors_Release/ is called .It may be called from an interrupt handler .The brakes are fully on from the start of
+* the next PWM period ,at most DCMOTORPERIOD timer ticks later .
+* 
+* E.g. Usage :
+*
+* /DCmotors_Halt ();/ - Brakes both the motors and keeps them braked
+*/
+void DCmotors_Halt()
+{
+ byte sreg=SREG;
+ cli();
+ dcmotorsHalted=1;
+ dcmotorStruct[0].duty=DCMOTORPERIOD;
+ dcmotorStruct[1].duty=DCMOTORPERIOD;
+ PORTD|=0xF0;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : DCmotors_Release
+* 
+* Accepts changes of speed and direction again after /DCmotors_Halt/ .The motors stay braked until you set them .
+* 
+* E.g. Usage :
+*
+* /DCmotors_Release ();/ - Lets the motors be driven again
+*/
+void DCmotors_Release()
+{
+ dcmotorsHalted=0;
+}
+
+/* Converts a PWM register value (0-PWMREGISTER) to the pulse width in timer ticks */
+static void DCmotors_SetDuty(unsigned char motor,unsigned int pwmValue)
+{
+ unsigned long duty=((unsigned long)pwmValue*DCMOTORPERIOD)/PWMREGISTER;
+ byte sreg;
+ if(dcmotorsHalted)
+     return;
+ if(duty>DCMOTORPERIOD)
+     duty=DCMOTORPERIOD;
+ else if(duty>0 && duty<DCMOTORMINPULSE)
+     duty=DCMOTORMINPULSE;
+ else if(duty<DCMOTORPERIOD && duty>DCMOTORPERIOD-DCMOTORMINPULSE)
+     duty=DCMOTORPERIOD-DCMOTORMINPULSE;
+ sreg=SREG;
+ cli();
+ dcmotorStruct[motor].duty=(unsigned int)duty;
+ SREG=sreg;
+}
+
+/* Called at every compare event of a motor channel ,the hardware has just changed the pin */
+static void DCmotors_Update(unsigned char motor,unsigned char channel)
+{
+ unsigned int duty=dcmotorStruct[motor].duty;
+ if(dcmotorStruct[motor].risingEdge)
+  {
+   Timer16_SetPinMode(channel,(duty<DCMOTORPERIOD)?TIMER16_PIN_CLEAR:TIMER16_PIN_SET);
+   Timer16_ScheduleAt(channel,dcmotorStruct[motor].periodStart+((duty>0 && duty<DCMOTORPERIOD)?duty:DCMOTORPERIOD/2));
+   dcmotorStruct[motor].risingEdge=0;
+  }
+ else
+  {
+   dcmotorStruct[motor].periodStart+=DCMOTORPERIOD;
+   Timer16_SetPinMode(channel,(duty>0)?TIMER16_PIN_SET:TIMER16_PIN_CLEAR);
+   Timer16_ScheduleAt(channel,dcmotorStruct[motor].periodStart);
+   dcmotorStruct[motor].risingEdge=1;
+  }
+}
+
+static void DCmotors_LeftUpdate()
+{
+ DCmotors_Update(0,TIMER3_CHANNEL_B);
+}
+
+static void DCmotors_RightUpdate()
+{
+ DCmotors_Update(1,TIMER3_CHANNEL_C);
 }
\ No newline at end of file
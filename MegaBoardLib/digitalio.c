@@ -324,24 +324,40 @@ void IO_ResetExtInterrupt(byte interruptNumber)
 {
  if(interruptNumber<4)
       EIMSK&=~_BV(interruptNumber+4);
+ if(interruptNumber==0)
+      extInterrupt0=NULL;
+ else if(interruptNumber==1)
+      extInterrupt1=NULL;
+ else if(interruptNumber==2)
+      extInterrupt2=NULL;
+ else if(interruptNumber==3)
+      extInterrupt3=NULL;
 }
-SIGNAL(SIG_INTERRUPT4)
+ISR_DEFERRABLE(SIG_INTERRUPT4)
 {
+ PROFILE_BEGIN(PROFILE_EXTINT_ISR);
  if(extInterrupt0!=NULL)
-    extInterrupt0();
+    ISR_DEFER_CALL(EIMSK,4,extInterrupt0,extInterrupt0());
+ PROFILE_END(PROFILE_EXTINT_ISR);
 }
-SIGNAL(SIG_INTERRUPT5)
+ISR_DEFERRABLE(SIG_INTERRUPT5)
 {
+ PROFILE_BEGIN(PROFILE_EXTINT_ISR);
  if(extInterrupt1!=NULL)
-    extInterrupt1();
+    ISR_DEFER_CALL(EIMSK,5,extInterrupt1,extInterrupt1());
+ PROFILE_END(PROFILE_EXTINT_ISR);
 }
-SIGNAL(SIG_INTERRUPT6)
+ISR_DEFERRABLE(SIG_INTERRUPT6)
 {
+ PROFILE_BEGIN(PROFILE_EXTINT_ISR);
  if(extInterrupt2!=NULL)
-    extInterrupt2();
+    ISR_DEFER_CALL(EIMSK,6,extInterrupt2,extInterrupt2());
+ PROFILE_END(PROFILE_EXTINT_ISR);
 }
-SIGNAL(SIG_INTERRUPT7)
+ISR_DEFERRABLE(SIG_INTERRUPT7)
 {
+ PROFILE_BEGIN(PROFILE_EXTINT_ISR);
  if(extInterrupt3!=NULL)
-    extInterrupt3();
+    ISR_DEFER_CALL(EIMSK,7,extInterrupt3,extInterrupt3());
+ PROFILE_END(PROFILE_EXTINT_ISR);
 }
\ No newline at end of file
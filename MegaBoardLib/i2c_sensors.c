@@ -9,13 +9,106 @@
 * + SRF08 Ultrasonic Sensor
 * + CMPS03 Compass Module
 *
+* An *SRF08* ping takes up to 65ms ./Srf08_StartRanging/ starts one and returns at once ,the reading is collected in the
+* background on the transfer queue of the *I2C* module while your program does other work .The *CMPS03* calibration
+* runs the same way ,stepped by /Cmps03_CalibrationStep/ with its prompts shown by a function of your choice .
+*
 */
 
+/* Device Types */
+#define SRF08_DEVICE  2
+#define CMPS03_DEVICE 3
+
 /* Functions */
 
+/*
+*
+* Name : I2C_IdentifySensor
+*
+* Works out the type of a sensor from its address and registers ,for use with /I2C_Scan/ .An *SRF08* answers at
+* 0x70-0x7F with its software revision in register 0 and a *CMPS03* at 0x60-0x6F with a bearing of 0-3599 in registers
+* 2 and 3 .Returns SRF08_DEVICE ,CMPS03_DEVICE or I2C_DEVICE_UNKNOWN .
+*
+* Parameters :
+*
+* /deviceAddress/ - Address of the device
+*
+* E.g. Usage :
+*
+* /I2C_Scan (1,127,I2C_IdentifySensor);/ - Finds and identifies all the sensors
+*/
+byte I2C_IdentifySensor(byte deviceAddress)
+{
+ byte registers[4];
+ if(I2C_ReadRegister(deviceAddress,0,registers,4,1)<0)
+     return I2C_DEVICE_UNKNOWN;
+ if(deviceAddress>=0x70 && registers[0]!=0xFF)
+     return SRF08_DEVICE;
+ if(deviceAddress>=0x60 && deviceAddress<0x70 && ((registers[2]<<8)|registers[3])<3600)
+     return CMPS03_DEVICE;
+ return I2C_DEVICE_UNKNOWN;
+}
+
 /* SRF08 Functions */
 #define SRF08_INCHES 0x50
 #define SRF08_CM     0x51
+#define SRF08_US     0x52
+
+/* SRF08 Ranging */
+#ifndef SRF08RANGINGTIME
+#define SRF08RANGINGTIME 70                         /* ms ,deadline for a ping ,full range of 11m is 65ms */
+#endif
+#ifndef SRF08POLLTIME
+#define SRF08POLLTIME    5                          /* ms between polls ,0 to read once at the deadline */
+#endif
+#ifndef SRF08MARGINTIME
+#define SRF08MARGINTIME  3                          /* ms added to the ranging time of an adaptive range */
+#endif
+#ifndef SRF08ADAPTIVEMARGIN
+#define SRF08ADAPTIVEMARGIN 300                     /* mm kept beyond half as far again as the nearest echo */
+#endif
+#ifndef SRF08MINGAIN
+#define SRF08MINGAIN     8                          /* gain register at the shortest range ,31 at the full range */
+#endif
+#define SRF08_MAXRANGE   11008                      /* mm */
+#define SRF08_IDLE       0
+#define SRF08_FIRING     1
+#define SRF08_RANGING    2
+#define SRF08_READING    3
+#define SRF08_READY      4
+#define Srf08_IsReady(ranging) ((ranging)->state==SRF08_READY)
+#define SRF08_ECHOES     17
+
+typedef struct{
+byte light;
+byte count;                                         /* echoes heard ,the others are 0 */
+unsigned int echoes[SRF08_ECHOES];                  /* nearest first */
+}Srf08_Echoes;
+
+typedef struct Srf08_Ranging{
+I2C_Transaction transaction;                        /* first so the completion function finds the structure */
+volatile byte state;                                /* SRF08_IDLE after Srf08_InitRanging */
+volatile int range;                                 /* first echo ,or an error code */
+byte light;
+unsigned long fireTime;                             /* Timer16_Time of the ping */
+unsigned long rangingTicks;                         /* deadline after the ping */
+unsigned long pollTime;
+void (*callback)(struct Srf08_Ranging * ranging);
+Srf08_Echoes * echoes;                              /* set by Srf08_CollectEchoes ,else NULL */
+byte echoCount;
+unsigned int minimumRange;                          /* mm */
+unsigned int maximumRange;                          /* mm ,0 when the range is not adaptive */
+unsigned int rangeLimit;                            /* mm ,range the sonar is set to */
+byte settings[3];                                   /* register 1 ,gain and range */
+byte settingsChanged;                               /* settings to be written with the next ping */
+I2C_Segment segments[3];
+byte command[2];
+byte registers[4];
+}Srf08_Ranging;
+
+/* Local Functions */
+static void Srf08_Next(I2C_Transaction * transaction);
+static int Srf08_Wait(Srf08_Ranging * ranging,byte deviceAddress,byte readingUnit);
 /*
 *
 * Name : Srf08_Ping
@@ -39,13 +132,339 @@ int Srf08_Ping(byte deviceAddress,byte readingUnit)
 {
   return I2C_WriteRegister(deviceAddress,0,&readingUnit,1,1);
 }
+
+/* Turns the echo registers read into the echo array ,high byte first ,into numbers and counts the echoes ,the last
+   echo is done first so no register is overwritten before it is used */
+static void Srf08_OrderEchoes(Srf08_Echoes * echoes,byte count)
+{
+ byte i,* data=(byte *)echoes->echoes;
+ for(i=SRF08_ECHOES;i>0;i--)
+     echoes->echoes[i-1]=(i<=count)?(data[2*i-2]<<8)|data[2*i-1]:0;
+ for(i=0;i<SRF08_ECHOES && echoes->echoes[i]!=0;i++);
+ echoes->count=i;
+}
+
+/* Works out the range and gain registers for a range limit in mm ,the gain goes down with the range so the echoes of
+   the last ping ,which die away with time ,are not taken for echoes of the next one */
+static void Srf08_SetLimit(Srf08_Ranging * ranging,unsigned int limit)
+{
+ byte range=(limit<86)?0:(limit>=SRF08_MAXRANGE)?255:(limit-43)/43;
+ byte gain=SRF08MINGAIN+(unsigned int)range*(31-SRF08MINGAIN)/255;
+ ranging->rangeLimit=limit;
+ if(ranging->settings[1]!=gain || ranging->settings[2]!=range)
+  {
+   ranging->settings[0]=1;
+   ranging->settings[1]=gain;
+   ranging->settings[2]=range;
+   ranging->settingsChanged=1;
+  }
+}
+
+/* Fits the range to the nearest echo ,the range grows when there is no echo and shrinks towards the nearest obstacle */
+static void Srf08_Adapt(Srf08_Ranging * ranging,unsigned int echo)
+{
+ unsigned long target;
+ if(echo==0)
+     target=2UL*ranging->rangeLimit;
+ else
+  {
+   if(ranging->command[1]==SRF08_INCHES)
+       target=echo*254UL/10;
+   else if(ranging->command[1]==SRF08_CM)
+       target=echo*10UL;
+   else
+       target=echo*10UL/58;
+   target+=target/2+SRF08ADAPTIVEMARGIN;
+  }
+ if(target<ranging->minimumRange)
+     target=ranging->minimumRange;
+ if(target>ranging->maximumRange)
+     target=ranging->maximumRange;
+ if(target>ranging->rangeLimit || target<ranging->rangeLimit-ranging->rangeLimit/4)
+     Srf08_SetLimit(ranging,target);
+}
+
+/* Ends a reading and calls the callback */
+static void Srf08_Done(Srf08_Ranging * ranging,int range)
+{
+ ranging->range=range;
+ ranging->state=SRF08_READY;
+ if(ranging->callback!=NULL)
+     ranging->callback(ranging);
+}
+
+/* Completion function of the ranging transfers */
+static void Srf08_Next(I2C_Transaction * transaction)
+{
+ Srf08_Ranging * ranging=(Srf08_Ranging *)transaction;
+ unsigned long now=Timer16_Time();
+
+ if(ranging->state==SRF08_FIRING)
+  {
+   if(transaction->status!=I2C_SUCCESS)
+    {
+     Srf08_Done(ranging,transaction->status);
+     return;
+    }
+   ranging->settingsChanged=0;
+   ranging->state=SRF08_RANGING;
+   if(ranging->maximumRange!=0)                     /* first poll when the echo window closes */
+       ranging->pollTime=ranging->fireTime+ranging->rangingTicks-TIMER16_MS(SRF08MARGINTIME);
+   else
+       ranging->pollTime=ranging->fireTime+(SRF08POLLTIME?TIMER16_MS(SRF08POLLTIME):ranging->rangingTicks);
+   return;
+  }
+ /* An SRF08 does not answer while it is ranging and reads 0xFF as its revision just after */
+ if(transaction->status==I2C_SUCCESS && ranging->registers[0]!=0xFF)
+  {
+   unsigned int echo=(ranging->registers[2]<<8)|ranging->registers[3];
+   ranging->light=ranging->registers[1];
+   if(ranging->echoes!=NULL)
+    {
+     ranging->echoes->light=ranging->light;
+     Srf08_OrderEchoes(ranging->echoes,ranging->echoCount);
+     echo=ranging->echoes->echoes[0];
+    }
+   if(ranging->maximumRange!=0)
+       Srf08_Adapt(ranging,echo);
+   Srf08_Done(ranging,echo);
+  }
+ else if(now-ranging->fireTime>=ranging->rangingTicks)
+   Srf08_Done(ranging,(transaction->status==I2C_SUCCESS)?I2C_TIMEOUT_ERROR:transaction->status);
+ else
+  {
+   /* An adaptive range is polled first when its echo window closes ,the sonar is nearly done */
+   ranging->pollTime=now+((ranging->maximumRange!=0)?TIMER16_MS(1):TIMER16_MS(SRF08POLLTIME));
+   ranging->state=SRF08_RANGING;
+  }
+}
+/*
+*
+* Name : Srf08_InitRanging
+*
+* Clears a ranging structure before its first use with /Srf08_StartRanging/ .The range is not adaptive .This function
+* does not return a value .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure
+*
+* E.g. Usage :
+*
+* /Srf08_InitRanging (&front);/ - Gets the front ranging structure ready
+*/
+void Srf08_InitRanging(Srf08_Ranging * ranging)
+{
+ memset(ranging,0,sizeof(*ranging));
+}
+
+/*
+*
+* Name : Srf08_SetAdaptive
+*
+* Makes the range of a sonar follow the nearest obstacle .After each reading the range is set to half as far again as
+* the nearest echo plus SRF08ADAPTIVEMARGIN mm ,and doubled when nothing was heard ,within the limits given .The sonar
+* stops listening at that range ,ranging takes about 0.25ms for every 43mm instead of 65ms ,and the reading is collected
+* as soon as the shorter echo window closes ,so in a corridor the pings come several times faster .The gain is lowered
+* with the range so the fading echoes of the last ping are not heard .The range and gain registers are written in the
+* same transfer as the next ping and only when they change .A maximum of 0 ends adaptive ranging and puts the sonar
+* back to the full range and gain .This function does not return a value .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure ,cleared by /Srf08_InitRanging/
+*
+* /minimumRange/ - Range 43-11008 .Shortest range in mm
+*
+* /maximumRange/ - Range 0-11008 .Longest range in mm ,0 for a fixed full range
+*
+* E.g. Usage :
+*
+* /Srf08_SetAdaptive (&front,500,6000);/ - Lets the front sonar range between 0.5m and 6m
+*/
+void Srf08_SetAdaptive(Srf08_Ranging * ranging,unsigned int minimumRange,unsigned int maximumRange)
+{
+ if(maximumRange>SRF08_MAXRANGE)
+     maximumRange=SRF08_MAXRANGE;
+ if(minimumRange>maximumRange)
+     minimumRange=maximumRange;
+ ranging->minimumRange=minimumRange;
+ ranging->maximumRange=maximumRange;
+ Srf08_SetLimit(ranging,maximumRange?maximumRange:SRF08_MAXRANGE);
+}
+
+/*
+*
+* Name : Srf08_StartRanging
+*
+* Starts a ping of the *SRF08* sonar and returns at once ,the reading is collected in the background .Call /Srf08_Poll/
+* regularly ,e.g. every pass of your main loop ,until it returns 1 or use the callback .The sonar is polled every
+* SRF08POLLTIME ms and the reading is taken as soon as the sonar answers with a software revision other than 0xFF .If
+* SRF08POLLTIME is defined as 0 the reading is taken once at the ranging deadline instead ,with no bus traffic while the
+* sonar is ranging .The ranging structure must be cleared by /Srf08_InitRanging/ before its first use and stay valid
+* until the reading is ready .Returns 1 if the ping was started
+* ,I2C_BUSY_ERROR if the structure is still ranging or I2C_SLAVEACK_ERROR if the sonar is missing .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure which receives the reading
+*
+* /deviceAddress/ - address of *SRF08* . Default factory set address is 0x70(112)
+*
+* /readingUnit/ - Takes values SRF08_INCHES for readings in inches or SRF08_CM for readings in centimetres
+*
+* /callback/ - Function called with interrupts enabled when the reading is ready ,may be NULL
+*
+* E.g. Usage :
+*
+* /Srf08_StartRanging (&front,0x70,SRF08_CM,NULL);/ - Starts a ping of the front sonar
+*/
+int Srf08_StartRanging(Srf08_Ranging * ranging,byte deviceAddress,byte readingUnit,void (*callback)(Srf08_Ranging * ranging))
+{
+ if(ranging->state!=SRF08_IDLE && ranging->state!=SRF08_READY)
+     return I2C_BUSY_ERROR;
+ if(I2C_IsMissing(deviceAddress))
+     return I2C_SLAVEACK_ERROR;
+ ranging->callback=callback;
+ ranging->echoes=NULL;
+ if(ranging->maximumRange!=0)
+     ranging->rangingTicks=TIMER16_US(((unsigned long)ranging->settings[2]+1)*254)+TIMER16_MS(SRF08MARGINTIME);
+ else
+     ranging->rangingTicks=TIMER16_MS(SRF08RANGINGTIME);
+ ranging->command[0]=0;
+ ranging->command[1]=readingUnit;
+ ranging->segments[0].type=I2C_WRITE;
+ ranging->segments[0].size=2;
+ ranging->segments[0].data=ranging->command;
+ ranging->transaction.address=deviceAddress;
+ ranging->transaction.flags=0;
+ ranging->transaction.segments=ranging->segments;
+ ranging->transaction.segmentCount=1;
+ if(ranging->settingsChanged)                       /* gain and range first ,the ping after a repeated START */
+  {
+   ranging->segments[0].size=3;
+   ranging->segments[0].data=ranging->settings;
+   ranging->segments[1].type=I2C_WRITE|I2C_RESTART;
+   ranging->segments[1].size=2;
+   ranging->segments[1].data=ranging->command;
+   ranging->transaction.segmentCount=2;
+  }
+ ranging->transaction.bitRate=0;
+ ranging->transaction.callback=Srf08_Next;
+ ranging->state=SRF08_FIRING;
+ ranging->fireTime=Timer16_Time();
+ I2C_Submit(&ranging->transaction);
+ return I2C_SUCCESS;
+}
+
+/*
+*
+* Name : Srf08_Poll
+*
+* Moves a reading started by /Srf08_StartRanging/ on and returns 1 when it is ready else returns 0 .Returns at once ,the
+* transfers run in the background .When the reading is ready the /range/ field holds the first echo in the unit asked
+* for ,0 if there was no echo ,and the /light/ field the light sensor .If the sonar did not answer /range/ holds the
+* error code ,I2C_TIMEOUT_ERROR if it was still ranging at the deadline .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure given to /Srf08_StartRanging/
+*
+* E.g. Usage :
+*
+* /if (Srf08_Poll (&front)) distance=front.range;/ - Picks up the front range when it is ready
+*/
+byte Srf08_Poll(Srf08_Ranging * ranging)
+{
+ if(ranging->state==SRF08_RANGING && (long)(Timer16_Time()-ranging->pollTime)>=0)
+  {
+   ranging->state=SRF08_READING;
+   ranging->segments[0].type=I2C_WRITE;
+   ranging->segments[0].size=1;                     /* command[0] is register 0 */
+   ranging->segments[0].data=ranging->command;
+   ranging->segments[1].type=I2C_READ;
+   ranging->segments[1].size=4;
+   ranging->segments[1].data=ranging->registers;
+   ranging->transaction.segmentCount=2;
+   if(ranging->echoes!=NULL)
+    {
+     ranging->segments[1].size=2;                   /* revision and light ,the echoes follow in the same read */
+     ranging->segments[2].type=I2C_READ;
+     ranging->segments[2].size=2*ranging->echoCount;
+     ranging->segments[2].data=(byte *)ranging->echoes->echoes;
+     ranging->transaction.segmentCount=3;
+    }
+   I2C_Submit(&ranging->transaction);
+  }
+ return ranging->state==SRF08_READY;
+}
+
+/*
+*
+* Name : Srf08_CollectEchoes
+*
+* Makes a reading started by /Srf08_StartRanging/ collect several echoes .They are read in the same transfer as the
+* ready check ,so a burst of up to 35 bytes replaces the 4 byte read and no extra transaction is needed .Call it right
+* after /Srf08_StartRanging/ .The /range/ field still holds the first echo .This function does not return a value .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure given to /Srf08_StartRanging/
+*
+* /echoes/ - Pointer to the structure which receives the light sensor and the echoes ,must stay valid until the reading
+* is ready
+*
+* /count/ - Range 0-17 .Number of echoes wanted ,0 for all 17
+*
+* E.g. Usage :
+*
+* /Srf08_StartRanging (&front,0x70,SRF08_CM,NULL);Srf08_CollectEchoes (&front,&frontEchoes,4);/ - Pings the front sonar
+* and collects the four nearest echoes
+*/
+void Srf08_CollectEchoes(Srf08_Ranging * ranging,Srf08_Echoes * echoes,byte count)
+{
+ if(count==0 || count>SRF08_ECHOES)
+     count=SRF08_ECHOES;
+ ranging->echoCount=count;
+ ranging->echoes=echoes;
+}
+
+/*
+*
+* Name : Srf08_IsReady
+*
+* Returns 1 if the reading started by /Srf08_StartRanging/ is ready else returns 0 .Use it in place of /Srf08_Poll/
+* when something else calls /Srf08_Poll/ .
+*
+* Parameters :
+*
+* /ranging/ - Pointer to the ranging structure given to /Srf08_StartRanging/
+*
+* E.g. Usage :
+*
+* /while (!Srf08_IsReady (&front)) DoSomethingElse ();/ - Works until the front range is ready
+*
+* byte Srf08_IsReady(Srf08_Ranging * ranging)
+*/
+
+/* Pings a sonar and waits for the reading ,returns the range or an error code */
+static int Srf08_Wait(Srf08_Ranging * ranging,byte deviceAddress,byte readingUnit)
+{
+ int returnValue;
+ if((returnValue=Srf08_StartRanging(ranging,deviceAddress,readingUnit,NULL))<0)
+     return returnValue;
+ while(!Srf08_Poll(ranging))
+     I2C_WaitFor(&ranging->transaction);            /* runs the bus itself when interrupts are disabled */
+ return ranging->range;
+}
+
 /*
 *
 * Name : Srf08_ReadLightSensor
 * 
 * Takes reading from the light sensor present on *SRF08* sonar sensor .This function returns a negative value if there 
 * is some problem else returns the value of intensity of light ranging from 0-255 .For details on error codes see the 
-* *I2C* documentaion .
+* *I2C* documentaion .The function waits until the ping is over ,use /Srf08_StartRanging/ to do other work meanwhile .
 * 
 * /deviceAddress/ - address of *SRF08* . Default factory set address is 0x70(112) 
 *
@@ -55,22 +474,14 @@ int Srf08_Ping(byte deviceAddress,byte readingUnit)
 */
 int Srf08_ReadLightSensor(byte deviceAddress)
 {
-    byte reading=SRF08_CM;
-    volatile long int loopCount;
+    Srf08_Ranging ranging;
     int returnValue;
     
-    if((returnValue=I2C_WriteRegister(deviceAddress,0,&reading,1,1))<0)
-        return returnValue;
-    
-    for(loopCount=32000;loopCount>0;loopCount--);
-    
-    returnValue=I2C_ReadRegister(deviceAddress,1,&reading,1,0);
-    I2C_WriteData(deviceAddress,NULL,0,1);
-    
-    if(returnValue<0)
+    Srf08_InitRanging(&ranging);
+    if((returnValue=Srf08_Wait(&ranging,deviceAddress,SRF08_CM))<0)
         return returnValue;
     else
-        return (int)reading;         
+        return (int)ranging.light;         
 }
 
 /*
@@ -79,7 +490,8 @@ int Srf08_ReadLightSensor(byte deviceAddress)
 * 
 * Takes distance reading from the *SRF08* sonar sensor .This function returns a negative value if there 
 * is some problem else returns the value of distance in centimetres or inches .For details on error codes 
-* see the *I2C* documentaion .
+* see the *I2C* documentaion .The function waits until the ping is over ,use /Srf08_StartRanging/ to do other work
+* meanwhile .
 * 
 * /deviceAddress/ - address of *SRF08* . Default factory set address is 0x70(112) 
 *
@@ -91,22 +503,47 @@ int Srf08_ReadLightSensor(byte deviceAddress)
 */
 int Srf08_ReadDistance(byte deviceAddress,byte readingUnit)
 {
-    byte reading[2];
-    volatile long int loopCount;
-    int returnValue;
+    Srf08_Ranging ranging;
     
-     if((returnValue=I2C_WriteRegister(deviceAddress,0,&readingUnit,1,1))<0)
-        return returnValue;
+    Srf08_InitRanging(&ranging);
+    return Srf08_Wait(&ranging,deviceAddress,readingUnit);
+}
 
-    for(loopCount=32000;loopCount>0;loopCount--);
-  
-    returnValue=I2C_ReadRegister(deviceAddress,2,reading,2,0);
-    I2C_WriteData(deviceAddress,NULL,0,1);
-    
-    if(returnValue<0)
-        return returnValue;
-    else
-        return (int)(reading[0]<<8|reading[1]);           
+/*
+*
+* Name : Srf08_ReadEchoes
+*
+* Reads the light sensor and the echoes of the last ping of the *SRF08* in one burst transfer .Use it after
+* /Srf08_ReadDistance/ or /Srf08_Ping/ and a wait of 65ms ,or use /Srf08_CollectEchoes/ to get the echoes with the
+* reading .Echoes nearer than an obstacle ,e.g. seen through foliage ,come first .Returns the number of echoes heard or
+* a negative value if there is some problem ,see the *I2C* documentaion .
+*
+* Parameters :
+*
+* /deviceAddress/ - address of *SRF08* . Default factory set address is 0x70(112)
+*
+* /echoes/ - Pointer to the structure which receives the light sensor and the echoes
+*
+* /count/ - Range 0-17 .Number of echoes wanted ,0 for all 17 .Fewer echoes make a shorter transfer
+*
+* E.g. Usage :
+*
+* /Srf08_ReadEchoes (0x70,&echoes,0);/ - Reads all 17 echoes of the last ping
+*/
+int Srf08_ReadEchoes(byte deviceAddress,Srf08_Echoes * echoes,byte count)
+{
+ byte reg=1;
+ int returnValue;
+ I2C_Segment segments[3]={{I2C_WRITE,1,&reg},{I2C_READ,1,&echoes->light},{I2C_READ,0,(byte *)echoes->echoes}};
+ if(I2C_IsMissing(deviceAddress))
+     return I2C_SLAVEACK_ERROR;
+ if(count==0 || count>SRF08_ECHOES)
+     count=SRF08_ECHOES;
+ segments[2].size=2*count;
+ if((returnValue=I2C_Transfer(deviceAddress,segments,3,0))<0)
+     return returnValue;
+ Srf08_OrderEchoes(echoes,count);
+ return echoes->count;
 }
 
 /*
@@ -202,6 +639,38 @@ int Srf08_MaxGain(byte deviceAddress,byte gain)
  return I2C_WriteRegister(deviceAddress,1,&gain,1,1);
 }
 
+/* CMPS03 Calibration */
+#define CMPS03_CALIBRATING 0
+#define CMPS03_CANCELLED   -7
+
+static const struct{
+char * message;                                     /* two LCD lines ,a countdown goes on column 14 of the second */
+byte seconds;
+byte point;                                         /* 1 to take a calibration point at the end */
+}cmps03CalibrationSteps[]={
+{"CMPS03   Compass--Calibration--",2,0},
+{"Point Compass toNorth within 4s",4,1},
+{"North Direction Calibration Done",2,0},
+{"Point Compass toEast  within 4s",4,1},
+{"East Direction  Calibration Done",2,0},
+{"Point Compass toSouth within 4s",4,1},
+{"South Direction Calibration Done",2,0},
+{"Point Compass toWest  within 4s",4,1},
+{"West Direction  Calibration Done",2,0}};
+
+static struct{
+I2C_Transaction transaction;
+I2C_Segment segment;
+byte command[2];                                    /* 0xFF to register 15 */
+void (*prompt)(const char * message,byte countdown);
+byte step;
+byte secondsLeft;
+byte writing;
+volatile byte running;
+int status;
+unsigned long secondTime;                           /* Timer16_Time at the start of the second */
+}cmps03Calibration;
+
 /*
 *
 * Name : Cmps03_GetReading
@@ -223,18 +692,187 @@ int Cmps03_GetReading(byte deviceAddress)
 {
  byte highByte,lowByte,dataBytes[2];
  int returnValue;
- if((returnValue=I2C_ReadRegister(deviceAddress,2,dataBytes,2,0))<0) 
+ if(I2C_IsMissing(deviceAddress))
+     return I2C_SLAVEACK_ERROR;
+ if((returnValue=I2C_ReadRegister(deviceAddress,2,dataBytes,2,1))<0) 
      return returnValue;
- I2C_WriteData(deviceAddress,NULL,0,1);
  return ((dataBytes[0]<<8)|dataBytes[1]);
 }
 
+/* Ends the calibration and shows the result */
+static int Cmps03_EndCalibration(int status)
+{
+ cmps03Calibration.running=0;
+ cmps03Calibration.status=status;
+ if(cmps03Calibration.prompt!=NULL && status!=CMPS03_CANCELLED)
+     cmps03Calibration.prompt((status==I2C_SUCCESS)?"  Calibration      Complete!    ":"  Calibration      Failed!    ",0);
+ return status;
+}
+
+/* Shows the prompt of the current calibration step */
+static void Cmps03_ShowStep()
+{
+ cmps03Calibration.secondsLeft=cmps03CalibrationSteps[cmps03Calibration.step].seconds;
+ if(cmps03Calibration.prompt!=NULL)
+     cmps03Calibration.prompt(cmps03CalibrationSteps[cmps03Calibration.step].message,
+                              cmps03CalibrationSteps[cmps03Calibration.step].point?cmps03Calibration.secondsLeft:0);
+}
+
+/*
+*
+* Name : Cmps03_StartCalibration
+*
+* Starts the calibration of the *CMPS03* compass and returns at once .Calibration is important for *CMPS03* compass
+* module as the readings given out it are dependent upon the latitude of the of reading .Calibration just needs to be
+* done once for for your location .The compass has to be pointed north ,east ,south and west in turn ,4 seconds for each
+* ,and the prompts are shown through the prompt function .It is called with a message when a step starts and with NULL
+* and the seconds left while a countdown runs ,the message is 32 characters for the two lines of the *LCD* ./Cmps03_LcdPrompt/
+* shows them on the *LCD* .Call /Cmps03_CalibrationStep/ regularly to move the calibration on ,the rest of your program
+* keeps running .You will need to remove and reapply power to use the compass with new settings .Returns 1 if the
+* calibration was started or I2C_BUSY_ERROR if a calibration is running .
+*
+* Parameters :
+*
+* /deviceAddress/ - address of *CMPS03* . Default factory set address is 0x60(96)
+*
+* /prompt/ - Function which shows the prompts ,may be NULL
+*
+* E.g. Usage :
+*
+* /Cmps03_StartCalibration (0x60,Cmps03_LcdPrompt);/ - Starts calibrating the compass with the prompts on the *LCD*
+*/
+int Cmps03_StartCalibration(byte deviceAddress,void (*prompt)(const char * message,byte countdown))
+{
+ if(cmps03Calibration.running)
+     return I2C_BUSY_ERROR;
+ cmps03Calibration.prompt=prompt;
+ cmps03Calibration.command[0]=15;
+ cmps03Calibration.command[1]=0xFF;
+ cmps03Calibration.segment.type=I2C_WRITE;
+ cmps03Calibration.segment.size=2;
+ cmps03Calibration.segment.data=cmps03Calibration.command;
+ cmps03Calibration.transaction.address=deviceAddress;
+ cmps03Calibration.transaction.flags=0;
+ cmps03Calibration.transaction.segments=&cmps03Calibration.segment;
+ cmps03Calibration.transaction.segmentCount=1;
+ cmps03Calibration.transaction.bitRate=0;
+ cmps03Calibration.transaction.callback=NULL;
+ cmps03Calibration.transaction.status=I2C_SUCCESS;
+ cmps03Calibration.step=0;
+ cmps03Calibration.writing=0;
+ cmps03Calibration.status=CMPS03_CALIBRATING;
+ cmps03Calibration.secondTime=Timer16_Time();
+ cmps03Calibration.running=1;
+ Cmps03_ShowStep();
+ return I2C_SUCCESS;
+}
+
+/*
+*
+* Name : Cmps03_CalibrationStep
+*
+* Moves a calibration started by /Cmps03_StartCalibration/ on and returns at once .Call it regularly ,at least every
+* 100ms ,from your main loop or from an interrupt function ,e.g. one set with /RTC_SetInterrupt/ .The prompt function is
+* called from here .Returns CMPS03_CALIBRATING (0) while the calibration runs ,1 when it is complete ,CMPS03_CANCELLED
+* (-7) if it was cancelled or a negative *I2C* error code if the compass did not answer .
+*
+* E.g. Usage :
+*
+* /if (Cmps03_CalibrationStep ()!=CMPS03_CALIBRATING) .../ - Checks whether the calibration is over
+*/
+int Cmps03_CalibrationStep()
+{
+ unsigned long now;
+ if(!cmps03Calibration.running)
+     return cmps03Calibration.status;
+ if(cmps03Calibration.writing)
+  {
+   if(cmps03Calibration.transaction.status==I2C_PENDING)
+       return CMPS03_CALIBRATING;
+   cmps03Calibration.writing=0;
+   if(cmps03Calibration.transaction.status!=I2C_SUCCESS)
+       return Cmps03_EndCalibration(cmps03Calibration.transaction.status);
+  }
+ else
+  {
+   now=Timer16_Time();
+   if(now-cmps03Calibration.secondTime<TIMER16_MS(1000))
+       return CMPS03_CALIBRATING;
+   cmps03Calibration.secondTime+=TIMER16_MS(1000);
+   if(--cmps03Calibration.secondsLeft!=0)
+    {
+     if(cmps03CalibrationSteps[cmps03Calibration.step].point && cmps03Calibration.prompt!=NULL)
+         cmps03Calibration.prompt(NULL,cmps03Calibration.secondsLeft);
+     return CMPS03_CALIBRATING;
+    }
+   if(cmps03CalibrationSteps[cmps03Calibration.step].point)
+    {
+     cmps03Calibration.writing=1;                   /* the compass takes the point it faces now */
+     I2C_Submit(&cmps03Calibration.transaction);
+     return CMPS03_CALIBRATING;
+    }
+  }
+ if(++cmps03Calibration.step>=sizeof(cmps03CalibrationSteps)/sizeof(cmps03CalibrationSteps[0]))
+     return Cmps03_EndCalibration(I2C_SUCCESS);
+ cmps03Calibration.secondTime=Timer16_Time();
+ Cmps03_ShowStep();
+ return CMPS03_CALIBRATING;
+}
+
+/*
+*
+* Name : Cmps03_CancelCalibration
+*
+* Stops a calibration started by /Cmps03_StartCalibration/ ,the points already taken stay in the compass .This function
+* does not return a value .
+*
+* E.g. Usage :
+*
+* /Cmps03_CancelCalibration ();/ - Stops the calibration
+*/
+void Cmps03_CancelCalibration()
+{
+ byte sreg=SREG;
+ cli();
+ if(cmps03Calibration.running)
+     Cmps03_EndCalibration(CMPS03_CANCELLED);
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Cmps03_LcdPrompt
+*
+* Prompt function for /Cmps03_StartCalibration/ which shows the prompts on the *LCD* and the countdown at the end of the
+* second line .This function does not return a value .
+*
+* Parameters :
+*
+* /message/ - 32 character message for the two lines ,or NULL to update the countdown
+*
+* /countdown/ - Seconds left ,0 for no countdown
+*
+* E.g. Usage :
+*
+* /Cmps03_StartCalibration (0x60,Cmps03_LcdPrompt);/ - Starts calibrating the compass with the prompts on the *LCD*
+*/
+void Cmps03_LcdPrompt(const char * message,byte countdown)
+{
+ if(message!=NULL)
+     Lcd_printf("%s",message);
+ if(countdown!=0)
+  {
+   Lcd_GotoXY(2,14);
+   Lcd_putchar('0'+countdown);
+  }
+}
+
 /*
 *
 * Name : Cmps03_Calibrate
 * 
-* Calibration is important for *CMPS03* compass module as the readings given out it are dependent upon the latitude of 
-* the of reading .Calibration just needs to be done once for for your location .This function returns a negative value
+* Calibrates the *CMPS03* compass with the prompts on the *LCD* and waits until it is done ,about 25 seconds .Use
+* /Cmps03_StartCalibration/ to keep the rest of your program running meanwhile .This function returns a negative value
 * if not successful and 1 is successful along with providing visual feedback on the *LCD* .You will need to remove and 
 * reapply power to use the compass with new settings .
 *
@@ -249,92 +887,10 @@ int Cmps03_GetReading(byte deviceAddress)
 */
 int Cmps03_Calibrate(byte deviceAddress)
 {
- byte highByte,lowByte,dataBytes[2];
- volatile unsigned long loopCount;
  int returnValue;
- Lcd_printf("CMPS03   Compass--Calibration--");
- for(loopCount=900000;loopCount>0;loopCount--);
- 
- Lcd_printf("Point Compass toNorth within 4s");
- Lcd_GotoXY(2,15);
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,14);
- Lcd_putchar('3');
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,14);
- Lcd_putchar('2');
- for(loopCount=500000;loopCount>0;loopCount--);
-  Lcd_GotoXY(2,14);
- Lcd_putchar('1');
- for(loopCount=500000;loopCount>0;loopCount--);
- if((returnValue=I2C_WriteRegister(deviceAddress,15,"\xFF",1,1))<0) 
- {
-     Lcd_printf("  Calibration      Failed!    ");
-     return returnValue;
- }
- Lcd_printf("North Direction Calibration Done");
- for(loopCount=900000;loopCount>0;loopCount--);
- 
- Lcd_printf("Point Compass toEast within 4s");
- Lcd_GotoXY(2,14);
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,13);
- Lcd_putchar('3');
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,13);
- Lcd_putchar('2');
- for(loopCount=500000;loopCount>0;loopCount--);
-  Lcd_GotoXY(2,13);
- Lcd_putchar('1');
- for(loopCount=500000;loopCount>0;loopCount--);
-  if((returnValue=I2C_WriteRegister(deviceAddress,15,"\xFF",1,1))<0) 
- {
-     Lcd_printf("  Calibration      Failed!    ");
-     return returnValue;
- }
- Lcd_printf("East Direction  Calibration Done");
- for(loopCount=900000;loopCount>0;loopCount--);
- 
- Lcd_printf("Point Compass toSouth within 4s");
- Lcd_GotoXY(2,15);
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,14);
- Lcd_putchar('3');
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,14);
- Lcd_putchar('2');
- for(loopCount=500000;loopCount>0;loopCount--);
-  Lcd_GotoXY(2,14);
- Lcd_putchar('1');
- for(loopCount=500000;loopCount>0;loopCount--);
-  if((returnValue=I2C_WriteRegister(deviceAddress,15,"\xFF",1,1))<0) 
- {
-     Lcd_printf("  Calibration      Failed!    ");
+ if((returnValue=Cmps03_StartCalibration(deviceAddress,Cmps03_LcdPrompt))<0)
      return returnValue;
- }
- Lcd_printf("South Direction Calibration Done");
- for(loopCount=900000;loopCount>0;loopCount--);
- 
- Lcd_printf("Point Compass toWest within 4s");
- Lcd_GotoXY(2,14);
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,13);
- Lcd_putchar('3');
- for(loopCount=500000;loopCount>0;loopCount--);
- Lcd_GotoXY(2,13);
- Lcd_putchar('2');
- for(loopCount=500000;loopCount>0;loopCount--);
-  Lcd_GotoXY(2,13);
- Lcd_putchar('1');
- for(loopCount=500000;loopCount>0;loopCount--);
- if((returnValue=I2C_WriteRegister(deviceAddress,15,"\xFF",1,1))<0) 
- {
-     Lcd_printf("  Calibration      Failed!    ");
-     return returnValue;
- }
- Lcd_printf("West Direction  Calibration Done");
- for(loopCount=900000;loopCount>0;loopCount--);
- Lcd_printf("  Calibration      Complete!    ");
- return I2C_SUCCESS;
+ while((returnValue=Cmps03_CalibrationStep())==CMPS03_CALIBRATING)
+     I2C_WaitFor(&cmps03Calibration.transaction);   /* runs the bus itself when interrupts are disabled */
+ return returnValue;
 }
-
@@ -0,0 +1,262 @@
+/****************************************************
+* Module: Interlock
+*
+* The *INTERLOCK* module stops the robot as soon as a sensor sees something it should not ,without waiting for the next
+* pass of your main loop .Readings are checked where they arrive :*SRF08* and *CMPS03* readings of the *SENSORS* module
+* in the completion function of their transfer ,*ADC* channels in the *ADC* interrupt and the bumpers or other switches
+* in their external interrupt .The first check which fails trips the interlock ,which halts the stepper motors ,brakes
+* the DC motors and holds the servos where they are ,all from the interrupt which saw the reading .
+*
+* The interlock stays tripped ,and the motors refuse new moves ,until /Interlock_Reset/ is called .The steppers slow
+* down through their ramp so they do not lose steps ,the DC motor brakes are fully on within one PWM period and the
+* servos keep their last position .The time /Interlock_Trip/ takes to command the actuators is measured so you can
+* check the worst case ,the motors themselves stop later ,see HostSim/interlocktest.c for the time from a reading to
+* the steppers stopped and the brakes on .Note that *SRF08* readings are only started by /Sensors_Update/ ,so the time
+* between two pings of a watched sonar still depends on the period given to /Sensors_Add/ .
+*
+****************************************************/
+
+/* Interlock Sources */
+#define INTERLOCK_SOFTWARE 0x01
+#define INTERLOCK_SENSOR   0x02
+#define INTERLOCK_ADC      0x04
+#define INTERLOCK_INPUT    0x08
+
+/* Variables */
+static struct{
+volatile byte tripped;                              /* sources which tripped since the last reset */
+volatile unsigned long tripTime;                    /* Timer16_Time of the first trip */
+volatile unsigned int maxCommandTime;               /* Timer1 ticks taken to command the actuators to stop */
+}interlock;
+
+/* Functions */
+
+/*
+*
+* Name : Interlock_Trip
+*
+* Trips the interlock :halts the stepper motors ,brakes the DC motors and holds the servos .Only the first trip after
+* /Interlock_Reset/ halts the actuators ,later ones only add their source .It may be called from an interrupt handler
+* .This function does not return a value .
+*
+* Parameters :
+*
+* /source/ - INTERLOCK_SOFTWARE ,INTERLOCK_SENSOR ,INTERLOCK_ADC or INTERLOCK_INPUT
+*
+* E.g. Usage :
+*
+* /Interlock_Trip (INTERLOCK_SOFTWARE);/ - Stops the robot from your program
+*/
+void Interlock_Trip(byte source)
+{
+ unsigned int start,commandTime;
+ byte sreg=SREG;
+ cli();
+ if(interlock.tripped)
+  {
+   interlock.tripped|=source;
+   SREG=sreg;
+   return;
+  }
+ start=Timer16_Now(TIMER1_CHANNEL_A);
+ interlock.tripped=source;
+ Stepper_Halt();
+ DCmotors_Halt();
+ Servo_Hold();
+ commandTime=Timer16_Now(TIMER1_CHANNEL_A)-start;
+ interlock.tripTime=Timer16_Time();
+ if(commandTime>interlock.maxCommandTime)
+     interlock.maxCommandTime=commandTime;
+ SREG=sreg;
+}
+
+/* Limit function of the watched sensors */
+static void Interlock_SensorTrip(Sensor * sensor,int value)
+{
+ (void)sensor;
+ (void)value;
+ Interlock_Trip(INTERLOCK_SENSOR);
+}
+
+/* Window function of the watched ADC channels */
+static void Interlock_AdcTrip(byte channelNumber,unsigned short int reading)
+{
+ (void)channelNumber;
+ (void)reading;
+ Interlock_Trip(INTERLOCK_ADC);
+}
+
+/* Handler of the watched external interrupts */
+static void Interlock_InputTrip()
+{
+ Interlock_Trip(INTERLOCK_INPUT);
+}
+
+/*
+*
+* Name : Interlock_WatchSensor
+*
+* Trips the interlock as soon as a reading of a sensor of the *SENSORS* module is below /minimum/ or above /maximum/ ,see
+* /Sensors_SetLimits/ .The sensor must have been added with /Sensors_Add/ .This function does not return a value .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* /minimum/ - Lowest reading allowed
+*
+* /maximum/ - Highest reading allowed
+*
+* E.g. Usage :
+*
+* /Interlock_WatchSensor (&front,15,32767);/ - Stops the robot when the front sonar sees something nearer than 15cm
+*/
+void Interlock_WatchSensor(Sensor * sensor,int minimum,int maximum)
+{
+ Sensors_SetLimits(sensor,minimum,maximum,Interlock_SensorTrip);
+}
+
+/*
+*
+* Name : Interlock_WatchAdc
+*
+* Trips the interlock from the *ADC* interrupt as soon as a conversion of a channel is below /low/ or above /high/ ,see
+* /Adc_SetWindow/ .The *ADC* must be in interrupt mode ,see /Adc_TakeContinousReadings/ .This function does not return a
+* value .
+*
+* Parameters :
+*
+* /channelNumber/ - Range 0-7 .Channel to watch
+*
+* /low/ - Range 0-1023 .Lowest reading allowed
+*
+* /high/ - Range 0-1023 .Highest reading allowed
+*
+* E.g. Usage :
+*
+* /Interlock_WatchAdc (3,0,700);/ - Stops the robot when the IR sensor on channel 3 reads over 700
+*/
+void Interlock_WatchAdc(byte channelNumber,unsigned short int low,unsigned short int high)
+{
+ Adc_SetWindow(channelNumber,low,high,Interlock_AdcTrip);
+}
+
+/*
+*
+* Name : Interlock_WatchInput
+*
+* Trips the interlock from an external interrupt ,e.g. a bumper switch ,see /IO_SetExtInterrupt/ .This function does
+* not return a value .
+*
+* Parameters :
+*
+* /interruptNumber/ - Range 1-4 .Pin of the external interrupt
+*
+* /interruptMode/ - INT_POS_EDGE ,INT_NEG_EDGE or INT_LOW_LEVEL
+*
+* E.g. Usage :
+*
+* /Interlock_WatchInput (1,INT_NEG_EDGE);/ - Stops the robot when the bumper on pin 1 pulls it low
+*/
+void Interlock_WatchInput(byte interruptNumber,byte interruptMode)
+{
+ IO_SetExtInterrupt(interruptNumber,interruptMode,Interlock_InputTrip);
+}
+
+/*
+*
+* Name : Interlock_Reset
+*
+* Clears the interlock and lets the motors and the servos be driven again .They stay stopped until you set them .The
+* watches stay in place ,so a sensor which is still outside its limits trips the interlock again at its next reading
+* .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /Interlock_Reset ();/ - Lets the robot move again
+*/
+void Interlock_Reset()
+{
+ byte sreg=SREG;
+ cli();
+ interlock.tripped=0;
+ Stepper_Release();
+ DCmotors_Release();
+ Servo_Release();
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Interlock_GetStatus
+*
+* Returns 0 if the interlock is clear ,else the sources which tripped it since /Interlock_Reset/ ORed together .
+*
+* E.g. Usage :
+*
+* /if (Interlock_GetStatus ()&INTERLOCK_INPUT) .../ - Checks whether a bumper stopped the robot
+*/
+byte Interlock_GetStatus()
+{
+ return interlock.tripped;
+}
+
+/*
+*
+* Name : Interlock_GetTripTime
+*
+* Returns the time of the first trip since /Interlock_Reset/ in ticks of /Timer16_Time/ (0.5us) .
+*
+* E.g. Usage :
+*
+* /stopped=Timer16_Time ()-Interlock_GetTripTime ();/ - Works out how long ago the robot was stopped
+*/
+unsigned long Interlock_GetTripTime()
+{
+ unsigned long time;
+ byte sreg=SREG;
+ cli();
+ time=interlock.tripTime;
+ SREG=sreg;
+ return time;
+}
+
+/*
+*
+* Name : Interlock_GetMaxCommandTime
+*
+* Returns the longest time /Interlock_Trip/ took to command the stepper motors ,the DC motors and the servos to stop
+* since /Interlock_ResetMaxCommandTime/ ,in ticks of Timer1 (0.5us) .This is only the time spent in the interrupt ,the
+* steppers still ramp down and the DC motor brakes come fully on at the next PWM period .
+*
+* E.g. Usage :
+*
+* /Uart0_printf ("%u\n",Interlock_GetMaxCommandTime ());/ - Sends the worst case
+*/
+unsigned int Interlock_GetMaxCommandTime()
+{
+ unsigned int commandTime;
+ byte sreg=SREG;
+ cli();
+ commandTime=interlock.maxCommandTime;
+ SREG=sreg;
+ return commandTime;
+}
+
+/*
+*
+* Name : Interlock_ResetMaxCommandTime
+*
+* Clears the longest command time .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /Interlock_ResetMaxCommandTime ();/ - Starts measuring again
+*/
+void Interlock_ResetMaxCommandTime()
+{
+ byte sreg=SREG;
+ cli();
+ interlock.maxCommandTime=0;
+ SREG=sreg;
+}
@@ -172,6 +172,7 @@ void Lcd_ClearDisplay()
 void Lcd_PrintString(char * lcdString)
 {
  int i;
+ PROFILE_BEGIN(PROFILE_LCD);
  Lcd_ClearDisplay(); 
  for(i=0;i<strlen(lcdString);i++)
   {
@@ -181,6 +182,7 @@ void Lcd_PrintString(char * lcdString)
       Lcd_ClearDisplay();
      Lcd_putchar(lcdString[i]);
   }
+ PROFILE_END(PROFILE_LCD);
 }
 /*
 *
@@ -0,0 +1,358 @@
+/****************************************************
+* Module: Occupancy Grid
+*
+* The *OCCUPANCY GRID* module keeps a map of the obstacles round the robot from the ranges of its *SRF08* sonars .The
+* floor is cut into square cells of OCCGRIDCELL mm ,OCCGRIDSIZE cells a side ,and each cell keeps in 2 bits how sure
+* the robot is that something is there :OCCGRID_FREE (0) ,OCCGRID_UNKNOWN (1) which every cell starts with ,2 and
+* OCCGRID_OCCUPIED (3) .Every range is traced from the sonar along its heading one cell at a time ,the cells the ping
+* passed through move one step towards free and the cell it came back from one step towards occupied ,so a single
+* wrong reading does not change the map much but a few good ones do .With the default settings the map covers 4.8m
+* square in 256 bytes .
+*
+* The positions are those of the *ODOMETRY* module ,mm in Q16.16 with the heading in radians clockwise from the y
+* axis .The grid does not move with the robot ,call /OccGrid_Recenter/ when the robot gets near its edge .Ask the map
+* which way is clear with /OccGrid_GetClearance/ .
+*
+****************************************************/
+
+/* Occupancy Grid Settings */
+#ifndef OCCGRIDSIZE
+#define OCCGRIDSIZE     32                          /* cells a side ,a multiple of 4 */
+#endif
+#ifndef OCCGRIDCELL
+#define OCCGRIDCELL     150                         /* mm a side */
+#endif
+#ifndef OCCGRIDMAXRANGE
+#define OCCGRIDMAXRANGE 3000                        /* mm ,longer ranges only clear the cells up to here */
+#endif
+#define OCCGRID_FREE     0
+#define OCCGRID_UNKNOWN  1
+#define OCCGRID_OCCUPIED 3
+
+/* Variables */
+static byte occGridCells[OCCGRIDSIZE*OCCGRIDSIZE/4];   /* 4 cells a byte ,row after row */
+
+static struct{
+long originX;                                       /* mm at the middle of the grid */
+long originY;
+int hitX;                                           /* occupied cell found by a trace */
+int hitY;
+}occGrid;
+
+/* Local Functions */
+
+/* Value of a cell ,the cells outside the grid are unknown */
+static byte OccGrid_Get(int x,int y)
+{
+ unsigned int index;
+ if(x<0 || y<0 || x>=OCCGRIDSIZE || y>=OCCGRIDSIZE)
+     return OCCGRID_UNKNOWN;
+ index=(unsigned int)y*OCCGRIDSIZE+x;
+ return (occGridCells[index>>2]>>((index&3)<<1))&3;
+}
+
+/* Sets a cell inside the grid */
+static void OccGrid_Set(int x,int y,byte value)
+{
+ unsigned int index=(unsigned int)y*OCCGRIDSIZE+x;
+ byte shift=(index&3)<<1;
+ occGridCells[index>>2]=(occGridCells[index>>2]&~(3<<shift))|(value<<shift);
+}
+
+/* Cell of a position in mm ,rounded down */
+static int OccGrid_Cell(long position,long origin)
+{
+ position-=origin-(long)OCCGRIDCELL*(OCCGRIDSIZE/2);
+ if(position<0)
+     return -1-(int)((-1-position)/OCCGRIDCELL);
+ return (int)(position/OCCGRIDCELL);
+}
+
+/* Converts a reading of the sonar to mm */
+static unsigned int OccGrid_ToMm(unsigned int reading,byte readingUnit)
+{
+ if(readingUnit==SRF08_INCHES)
+     return (unsigned int)((unsigned long)reading*254/10);
+ if(readingUnit==SRF08_US)
+     return (unsigned int)((unsigned long)reading*343/2000);   /* there and back at 343m/s */
+ return reading*10;
+}
+
+/* Walks the cells from (x,y) up to (x1,y1) with Bresenham's line ,the last cell is left out .Clears the cells ,or with
+   query set stops at the first occupied cell and returns 1 */
+static byte OccGrid_Trace(int x,int y,int x1,int y1,byte query)
+{
+ int dx=(x1>x)?x1-x:x-x1;
+ int dy=(y1>y)?y-y1:y1-y;                           /* minus the distance */
+ int sx=(x1>x)?1:-1;
+ int sy=(y1>y)?1:-1;
+ int error=dx+dy,twice;
+ byte value;
+ while(x!=x1 || y!=y1)
+  {
+   if(x<0 || y<0 || x>=OCCGRIDSIZE || y>=OCCGRIDSIZE)
+       return 0;                                    /* left the grid */
+   value=OccGrid_Get(x,y);
+   if(query)
+    {
+     if(value>=2)
+      {
+       occGrid.hitX=x;
+       occGrid.hitY=y;
+       return 1;
+      }
+    }
+   else if(value!=OCCGRID_FREE)
+       OccGrid_Set(x,y,value-1);
+   twice=2*error;
+   if(twice>=dy)
+    {
+     error+=dy;
+     x+=sx;
+    }
+   if(twice<=dx)
+    {
+     error+=dx;
+     y+=sy;
+    }
+  }
+ return 0;
+}
+
+/* Traces a ray from the sonar out to distance mm ,clearing the cells on the way and marking the last one if hit */
+static void OccGrid_Ray(int x,int y,long sine,long cosine,Odometry_Pose * pose,unsigned int distance,byte hit)
+{
+ int x1=OccGrid_Cell((pose->x>>16)+((long)distance*sine>>16),occGrid.originX);
+ int y1=OccGrid_Cell((pose->y>>16)+((long)distance*cosine>>16),occGrid.originY);
+ byte value;
+ OccGrid_Trace(x,y,x1,y1,0);
+ if(hit && x1>=0 && y1>=0 && x1<OCCGRIDSIZE && y1<OCCGRIDSIZE && (value=OccGrid_Get(x1,y1))!=OCCGRID_OCCUPIED)
+     OccGrid_Set(x1,y1,value+1);
+}
+
+/* Functions */
+
+/*
+*
+* Name : OccGrid_Init
+*
+* Marks every cell of the grid unknown and puts the middle of the grid at a position ,usually where the robot is .This
+* function does not return a value .
+*
+* Parameters :
+*
+* /x/ - Position across of the middle of the grid in mm
+*
+* /y/ - Position along of the middle of the grid in mm
+*
+* E.g. Usage :
+*
+* /OccGrid_Init (0,0);/ - Starts an empty map round the point where /Odometry_Init/ started the robot
+*/
+void OccGrid_Init(long x,long y)
+{
+ memset(occGridCells,0x55,sizeof(occGridCells));   /* OCCGRID_UNKNOWN in each 2 bits */
+ occGrid.originX=x;
+ occGrid.originY=y;
+}
+
+/*
+*
+* Name : OccGrid_Recenter
+*
+* Moves the grid by whole cells so that its middle is as close to a position as it can be .The cells which stay on the
+* grid keep their values ,the new ones are unknown .This function does not return a value .
+*
+* Parameters :
+*
+* /x/ - Position across of the new middle in mm
+*
+* /y/ - Position along of the new middle in mm
+*
+* E.g. Usage :
+*
+* /OccGrid_Recenter (pose.x>>16,pose.y>>16);/ - Moves the map with the robot
+*/
+void OccGrid_Recenter(long x,long y)
+{
+ int dx=OccGrid_Cell(x,occGrid.originX)-OCCGRIDSIZE/2;
+ int dy=OccGrid_Cell(y,occGrid.originY)-OCCGRIDSIZE/2;
+ int i,j,fromX,fromY,stepX,stepY;
+ if(dx==0 && dy==0)
+     return;
+ /* Copy in the direction which never overwrites a cell before it is moved */
+ stepX=(dx>0)?1:-1;
+ stepY=(dy>0)?1:-1;
+ for(j=(dy>0)?0:OCCGRIDSIZE-1;j>=0 && j<OCCGRIDSIZE;j+=stepY)
+     for(i=(dx>0)?0:OCCGRIDSIZE-1;i>=0 && i<OCCGRIDSIZE;i+=stepX)
+      {
+       fromX=i+dx;
+       fromY=j+dy;
+       OccGrid_Set(i,j,OccGrid_Get(fromX,fromY));
+      }
+ occGrid.originX+=(long)dx*OCCGRIDCELL;
+ occGrid.originY+=(long)dy*OCCGRIDCELL;
+}
+
+/*
+*
+* Name : OccGrid_AddRange
+*
+* Adds a range of a sonar to the map .The cells from the sonar up to the echo become more likely free and the cell of
+* the echo more likely occupied .A range of 0 ,no echo ,or beyond OCCGRIDMAXRANGE only clears the cells up to
+* OCCGRIDMAXRANGE .The sonar is taken to be at the middle of the robot .This function does not return a value .
+*
+* Parameters :
+*
+* /pose/ - Pointer to the pose of the robot when the ping was sent ,see /Odometry_GetPose/
+*
+* /bearing/ - Direction the sonar points in radians clockwise from the front of the robot ,Q16.16
+*
+* /range/ - Range read from the sonar ,e.g. by /Srf08_ReadDistance/
+*
+* /readingUnit/ - Unit of the range ,SRF08_INCHES ,SRF08_CM or SRF08_US
+*
+* E.g. Usage :
+*
+* /OccGrid_AddRange (&pose,ODOMETRY_PI/2,Srf08_ReadDistance (0x71,SRF08_CM),SRF08_CM);/ - Maps the range of the sonar
+* which looks right
+*/
+void OccGrid_AddRange(Odometry_Pose * pose,long bearing,unsigned int range,byte readingUnit)
+{
+ long heading=pose->theta+bearing;
+ unsigned int distance=OccGrid_ToMm(range,readingUnit);
+ OccGrid_Ray(OccGrid_Cell(pose->x>>16,occGrid.originX),OccGrid_Cell(pose->y>>16,occGrid.originY),Odometry_Sin(heading),
+             Odometry_Cos(heading),pose,(distance==0 || distance>OCCGRIDMAXRANGE)?OCCGRIDMAXRANGE:distance,
+             distance!=0 && distance<=OCCGRIDMAXRANGE);
+}
+
+/*
+*
+* Name : OccGrid_AddEchoes
+*
+* Adds all the echoes of a ping read by /Srf08_ReadEchoes/ or /Srf08_CollectEchoes/ to the map .The cells up to the
+* first echo become more likely free and the cell of every echo within OCCGRIDMAXRANGE more likely occupied ,the cells
+* between the echoes are left alone as the sonar cannot tell what is there .This function does not return a value .
+*
+* Parameters :
+*
+* /pose/ - Pointer to the pose of the robot when the ping was sent ,see /Odometry_GetPose/
+*
+* /bearing/ - Direction the sonar points in radians clockwise from the front of the robot ,Q16.16
+*
+* /echoes/ - Pointer to the echoes of the ping
+*
+* /readingUnit/ - Unit of the echoes ,SRF08_INCHES ,SRF08_CM or SRF08_US
+*
+* E.g. Usage :
+*
+* /OccGrid_AddEchoes (&pose,0,&frontEchoes,SRF08_CM);/ - Maps every object the front sonar heard
+*/
+void OccGrid_AddEchoes(Odometry_Pose * pose,long bearing,Srf08_Echoes * echoes,byte readingUnit)
+{
+ long heading=pose->theta+bearing;
+ long sine=Odometry_Sin(heading);
+ long cosine=Odometry_Cos(heading);
+ int x=OccGrid_Cell(pose->x>>16,occGrid.originX);
+ int y=OccGrid_Cell(pose->y>>16,occGrid.originY);
+ unsigned int distance;
+ byte i,value;
+ if(echoes->count==0)
+  {
+   OccGrid_Ray(x,y,sine,cosine,pose,OCCGRIDMAXRANGE,0);
+   return;
+  }
+ for(i=0;i<echoes->count;i++)
+  {
+   if((distance=OccGrid_ToMm(echoes->echoes[i],readingUnit))>OCCGRIDMAXRANGE)
+       break;
+   if(i==0)
+       OccGrid_Ray(x,y,sine,cosine,pose,distance,1);
+   else
+    {
+     int x1=OccGrid_Cell((pose->x>>16)+((long)distance*sine>>16),occGrid.originX);
+     int y1=OccGrid_Cell((pose->y>>16)+((long)distance*cosine>>16),occGrid.originY);
+     if(x1>=0 && y1>=0 && x1<OCCGRIDSIZE && y1<OCCGRIDSIZE && (value=OccGrid_Get(x1,y1))!=OCCGRID_OCCUPIED)
+         OccGrid_Set(x1,y1,value+1);
+    }
+  }
+ if(i==0)
+     OccGrid_Ray(x,y,sine,cosine,pose,OCCGRIDMAXRANGE,0);   /* first echo out of range */
+}
+
+/*
+*
+* Name : OccGrid_GetCell
+*
+* Returns the value of the cell at a position ,from OCCGRID_FREE (0) to OCCGRID_OCCUPIED (3) .Positions off the grid
+* are OCCGRID_UNKNOWN (1) .
+*
+* Parameters :
+*
+* /x/ - Position across in mm
+*
+* /y/ - Position along in mm
+*
+* E.g. Usage :
+*
+* /if (OccGrid_GetCell (1000,2000)>=2) .../ - Checks whether something is at x=1m ,y=2m
+*/
+byte OccGrid_GetCell(long x,long y)
+{
+ return OccGrid_Get(OccGrid_Cell(x,occGrid.originX),OccGrid_Cell(y,occGrid.originY));
+}
+
+/*
+*
+* Name : OccGrid_GetClearance
+*
+* Returns how far the robot can go in a sector before the map has an occupied cell ,cells at 2 or 3 ,in mm rounded down
+* to whole cells .Rays are traced across the sector close enough together not to miss a cell out to /distance/ .Returns
+* /distance/ if the sector is clear that far ,unknown cells count as clear .
+*
+* Parameters :
+*
+* /pose/ - Pointer to the pose of the robot ,see /Odometry_GetPose/
+*
+* /bearing/ - Middle of the sector in radians clockwise from the front of the robot ,Q16.16
+*
+* /halfWidth/ - Range 0-pi .Angle from the middle of the sector to each side in radians ,Q16.16
+*
+* /distance/ - Range 1-32767 .How far to look in mm
+*
+* E.g. Usage :
+*
+* /if (OccGrid_GetClearance (&pose,0,ODOMETRY_PI/8,1000)<1000) .../ - Checks 22.5 degrees either side of straight
+* ahead for 1m
+*/
+unsigned int OccGrid_GetClearance(Odometry_Pose * pose,long bearing,long halfWidth,unsigned int distance)
+{
+ int x=OccGrid_Cell(pose->x>>16,occGrid.originX);
+ int y=OccGrid_Cell(pose->y>>16,occGrid.originY);
+ int x1,y1;
+ long heading,sine,cosine,step,along;
+ unsigned int clearance=distance;
+ step=((long)OCCGRIDCELL<<16)/distance;             /* a cell apart at the far end */
+ if(step==0)
+     step=1;
+ for(heading=pose->theta+bearing-halfWidth;heading<=pose->theta+bearing+halfWidth;heading+=step)
+  {
+   sine=Odometry_Sin(heading);
+   cosine=Odometry_Cos(heading);
+   x1=OccGrid_Cell((pose->x>>16)+((long)distance*sine>>16),occGrid.originX);
+   y1=OccGrid_Cell((pose->y>>16)+((long)distance*cosine>>16),occGrid.originY);
+   if(!OccGrid_Trace(x,y,x1,y1,1))
+    {
+     if(OccGrid_Get(x1,y1)<2)
+         continue;
+     occGrid.hitX=x1;
+     occGrid.hitY=y1;
+    }
+   /* Distance to the near edge of the cell along the ray */
+   along=((long)(occGrid.hitX-x)*sine+(long)(occGrid.hitY-y)*cosine+0x8000)>>16;
+   along=(along>0)?(along-1)*OCCGRIDCELL:0;
+   if(along<clearance)
+       clearance=(unsigned int)along;
+  }
+ return clearance;
+}
@@ -0,0 +1,312 @@
+/****************************************************
+* Module: Odometry
+*
+* The *ODOMETRY* module keeps track of where the robot is from the steps of its two stepper wheels and the heading of
+* the *CMPS03* compass .The steps are counted by the *STEPPER* module in its interrupt function so none are missed ,and
+* /Odometry_Update/ turns the steps taken since the last update into a move along the current heading .The wheels are
+* good at measuring short moves but slip a little on every turn ,the compass never drifts but is noisy and disturbed
+* near motors and steel .So the heading is worked out from the wheels and pulled a little towards each new compass
+* reading ,a complementary filter ,which keeps the best of both .
+*
+* All the numbers are fixed point Q16.16 ,a long holding the value times 65536 ,and sine and cosine come from a table
+* so no floating point is needed .The pose is /x/ and /y/ in mm ,good to 32m either way ,and /theta/ in radians from 0
+* to 2pi .Like the compass /theta/ is 0 along the y axis and grows clockwise ,so with the compass in use y points north
+* and x points east .Call /Odometry_Update/ regularly ,e.g. every pass of your main loop ,it only works on the steps
+* taken since the last call so it takes very little time .
+*
+****************************************************/
+
+/* Odometry Settings */
+#define ODOMETRY_ONE    65536L                      /* 1 in Q16.16 */
+#define ODOMETRY_PI     205887L                     /* pi in Q16.16 */
+#define ODOMETRY_TWOPI  411775L
+
+typedef struct{
+long x;                                             /* mm ,Q16.16 */
+long y;
+long theta;                                         /* radians from 0 to 2pi ,Q16.16 */
+}Odometry_Pose;
+
+/* Sine Table ,a quarter circle in 256 steps ,Q1.15 with 32768 for 1 */
+static const unsigned int odometrySine[257] PROGMEM={
+0,201,402,603,804,1005,1206,1407,1608,1809,2009,2210,2411,2611,2811,3012,
+3212,3412,3612,3812,4011,4211,4410,4609,4808,5007,5205,5404,5602,5800,5998,6195,
+6393,6590,6787,6983,7180,7376,7571,7767,7962,8157,8351,8546,8740,8933,9127,9319,
+9512,9704,9896,10088,10279,10469,10660,10850,11039,11228,11417,11605,11793,11980,12167,12354,
+12540,12725,12910,13095,13279,13463,13646,13828,14010,14192,14373,14553,14733,14912,15091,15269,
+15447,15624,15800,15976,16151,16326,16500,16673,16846,17018,17190,17361,17531,17700,17869,18037,
+18205,18372,18538,18703,18868,19032,19195,19358,19520,19681,19841,20001,20160,20318,20475,20632,
+20788,20943,21097,21251,21403,21555,21706,21856,22006,22154,22302,22449,22595,22740,22884,23028,
+23170,23312,23453,23593,23732,23870,24008,24144,24279,24414,24548,24680,24812,24943,25073,25202,
+25330,25457,25583,25708,25833,25956,26078,26199,26320,26439,26557,26674,26791,26906,27020,27133,
+27246,27357,27467,27576,27684,27791,27897,28002,28106,28209,28311,28411,28511,28610,28707,28803,
+28899,28993,29086,29178,29269,29359,29448,29535,29622,29707,29792,29875,29957,30038,30118,30196,
+30274,30350,30425,30499,30572,30644,30715,30784,30853,30920,30986,31050,31114,31177,31238,31298,
+31357,31415,31471,31527,31581,31634,31686,31737,31786,31834,31881,31927,31972,32015,32058,32099,
+32138,32177,32214,32251,32286,32319,32352,32383,32413,32442,32470,32496,32522,32546,32568,32590,
+32610,32629,32647,32664,32679,32693,32706,32718,32729,32738,32746,32753,32758,32762,32766,32767,
+32768
+};
+
+/* Variables */
+static struct{
+Odometry_Pose pose;
+long stepLength;                                    /* mm ,Q16.16 */
+long wheelBase;                                     /* mm */
+long turnRemainder;                                 /* part of a turn too small for theta yet */
+unsigned int maxSteps;                              /* steps per wheel worked out in one go */
+int left;                                           /* step counts at the last update */
+int right;
+byte compassShift;                                  /* 0 when the compass is not used */
+unsigned int compassSamples;
+}odometry;
+
+/* Local Functions */
+
+/* Sine of an angle in 1024ths of a circle ,Q16.16 */
+static long Odometry_Sine(unsigned int index)
+{
+ long sine;
+ index&=1023;
+ if(index&256)
+     sine=(long)pgm_read_word(&odometrySine[256-(index&255)])<<1;
+ else
+     sine=(long)pgm_read_word(&odometrySine[index&255])<<1;
+ return (index&512)?-sine:sine;
+}
+
+/* Angle from 0 to 2pi in 1024ths of a circle ,rounded */
+static unsigned int Odometry_Index(long angle)
+{
+ return (unsigned int)(((unsigned long)angle*5215UL+(1UL<<20))>>21);
+}
+
+/* Brings an angle which is less than 2pi out back between 0 and 2pi */
+static long Odometry_Wrap(long angle)
+{
+ if(angle<0)
+     return angle+ODOMETRY_TWOPI;
+ if(angle>=ODOMETRY_TWOPI)
+     return angle-ODOMETRY_TWOPI;
+ return angle;
+}
+
+/* Multiplies a Q16.16 value by a Q16.16 sine without overflow */
+static long Odometry_Scale(long value,long sine)
+{
+ byte negative=0;
+ long result;
+ if(value<0)
+  {
+   value=-value;
+   negative=1;
+  }
+ if(sine<0)
+  {
+   sine=-sine;
+   negative^=1;
+  }
+ result=(value>>16)*sine;
+ result+=((unsigned long)(value&0xFFFF)*(unsigned long)sine)>>16;
+ return negative?-result:result;
+}
+
+/* Moves the pose on by a part of the steps small enough that no product overflows and the turn is at most half a
+   circle */
+static void Odometry_Move(long leftSteps,long rightSteps)
+{
+ long turn,distance;
+ unsigned int index;
+ /* The turn is worked out exactly ,what does not make a whole Q16.16 unit waits for the next update */
+ turn=(leftSteps-rightSteps)*odometry.stepLength+odometry.turnRemainder;
+ odometry.turnRemainder=turn%odometry.wheelBase;
+ turn/=odometry.wheelBase;
+ distance=(leftSteps+rightSteps)*odometry.stepLength/2;
+ index=Odometry_Index(Odometry_Wrap(odometry.pose.theta+turn/2));   /* heading half way through the move */
+ odometry.pose.x+=Odometry_Scale(distance,Odometry_Sine(index));
+ odometry.pose.y+=Odometry_Scale(distance,Odometry_Sine(index+256));
+ odometry.pose.theta=Odometry_Wrap(odometry.pose.theta+turn);
+}
+
+/* Functions */
+
+/*
+*
+* Name : Odometry_Init
+*
+* Starts tracking the robot at x=0 ,y=0 .The heading starts at the compass heading if the compass is used and has a
+* reading ,else at 0 .Start the compass first with /Compass_Init/ .This function does not return a value .
+*
+* Parameters :
+*
+* /stepLength/ - Range 1-65535 .Distance a wheel rolls in one step in micrometres ,the wheel circumference divided by
+* the steps per turn ,remember half stepping halves it
+*
+* /wheelBase/ - Range 1-32767 .Distance between the middles of the two wheels in mm
+*
+* /compassWeight/ - Range 0-8 .0 does not use the compass ,else each compass reading moves the heading 1/2^compassWeight
+* of the way towards it ,e.g. 4 for a sixteenth
+*
+* E.g. Usage :
+*
+* /Odometry_Init (1178,150,4);/ - 75mm wheels with 200 steps a turn ,150mm apart ,with the compass
+*/
+void Odometry_Init(unsigned int stepLength,unsigned int wheelBase,byte compassWeight)
+{
+ int heading;
+ unsigned long limit=0x3FFF0000UL;                  /* steps times stepLength ,twice that fits a long */
+ if(wheelBase==0)
+     wheelBase=1;
+ odometry.stepLength=(long)(((unsigned long)stepLength<<16)/1000);
+ if(odometry.stepLength==0)
+     odometry.stepLength=1;
+ if(wheelBase<limit/(ODOMETRY_PI/2))
+     limit=(ODOMETRY_PI/2)*wheelBase;               /* a quarter circle when one wheel stands */
+ limit/=odometry.stepLength;
+ odometry.maxSteps=(limit>32767)?32767:(limit==0)?1:(unsigned int)limit;
+ odometry.wheelBase=wheelBase;
+ odometry.turnRemainder=0;
+ odometry.compassShift=(compassWeight>8)?8:compassWeight;
+ odometry.compassSamples=Compass_GetSampleCount();
+ odometry.pose.x=0;
+ odometry.pose.y=0;
+ odometry.pose.theta=0;
+ heading=Compass_GetHeading();
+ if(odometry.compassShift && heading>=0)
+     odometry.pose.theta=((long)heading*29282)>>8;
+ Stepper_GetStepCounts(&odometry.left,&odometry.right);
+}
+
+/*
+*
+* Name : Odometry_SetPose
+*
+* Moves the tracked robot to a known place ,e.g. when it reaches a landmark .This function does not return a value .
+*
+* Parameters :
+*
+* /x/ - Position across in mm ,Q16.16
+*
+* /y/ - Position along in mm ,Q16.16
+*
+* /theta/ - Heading in radians from 0 to 2pi ,Q16.16
+*
+* E.g. Usage :
+*
+* /Odometry_SetPose (500*ODOMETRY_ONE,0,ODOMETRY_PI/2);/ - Puts the robot 500mm along the x axis facing along it
+*/
+void Odometry_SetPose(long x,long y,long theta)
+{
+ odometry.pose.x=x;
+ odometry.pose.y=y;
+ odometry.pose.theta=Odometry_Wrap(theta%ODOMETRY_TWOPI);
+ odometry.turnRemainder=0;
+}
+
+/*
+*
+* Name : Odometry_Update
+*
+* Moves the pose on by the steps taken since the last update and pulls the heading towards a new compass reading if
+* there is one .Call it often enough that no wheel takes more than 32767 steps between calls ,as the step counts wrap
+* round ,and the more often the closer a curved path is followed .Many steps are worked out in equal parts of at most
+* 0x3FFF0000/stepLength steps ,about 13900 for a step of 1178um ,and half a circle of turn ,so nothing overflows .This
+* function does not return a value .
+*
+* E.g. Usage :
+*
+* /while (1) { Compass_Update (); Odometry_Update (); ... }/ - Keeps the pose up to date from the main loop
+*/
+void Odometry_Update()
+{
+ int left,right,heading;
+ long leftSteps,rightSteps,leftDone=0,rightDone=0,error;
+ unsigned int samples,parts,part,most;
+
+ Stepper_GetStepCounts(&left,&right);
+ leftSteps=(int)((unsigned int)left-(unsigned int)odometry.left);   /* the counts wrap round */
+ rightSteps=(int)((unsigned int)right-(unsigned int)odometry.right);
+ odometry.left=left;
+ odometry.right=right;
+ most=(unsigned int)((leftSteps<0)?-leftSteps:leftSteps);
+ if((unsigned int)((rightSteps<0)?-rightSteps:rightSteps)>most)
+     most=(unsigned int)((rightSteps<0)?-rightSteps:rightSteps);
+ parts=(most+odometry.maxSteps-1)/odometry.maxSteps;
+ for(part=1;part<=parts;part++)                     /* the steps spread evenly over the parts */
+  {
+   long leftPart=leftSteps*(long)part/(long)parts;
+   long rightPart=rightSteps*(long)part/(long)parts;
+   Odometry_Move(leftPart-leftDone,rightPart-rightDone);
+   leftDone=leftPart;
+   rightDone=rightPart;
+  }
+ if(odometry.compassShift==0 || (samples=Compass_GetSampleCount())==odometry.compassSamples)
+     return;
+ odometry.compassSamples=samples;
+ if((heading=Compass_GetHeading())<0)
+     return;
+ error=(((long)heading*29282)>>8)-odometry.pose.theta;
+ if(error>ODOMETRY_PI)
+     error-=ODOMETRY_TWOPI;
+ else if(error<=-ODOMETRY_PI)
+     error+=ODOMETRY_TWOPI;
+ odometry.pose.theta=Odometry_Wrap(odometry.pose.theta+(error>>odometry.compassShift));
+}
+
+/*
+*
+* Name : Odometry_GetPose
+*
+* Copies the pose worked out by the last /Odometry_Update/ .This function does not return a value .
+*
+* Parameters :
+*
+* /pose/ - Pointer to the structure which receives /x/ ,/y/ and /theta/
+*
+* E.g. Usage :
+*
+* /Odometry_GetPose (&pose); Lcd_printf ("%d",(int)(pose.x>>16));/ - Shows how far across the robot is in mm
+*/
+void Odometry_GetPose(Odometry_Pose * pose)
+{
+ *pose=odometry.pose;
+}
+
+/*
+*
+* Name : Odometry_Sin
+*
+* Returns the sine of an angle from the table of the module ,good to about 0.3 degree .Both the angle in radians and
+* the result are Q16.16 .Use it with /Odometry_Cos/ instead of the floating point functions in your navigation code .
+*
+* Parameters :
+*
+* /angle/ - Angle in radians ,Q16.16
+*
+* E.g. Usage :
+*
+* /dx=(distance*Odometry_Sin (pose.theta))>>16;/ - Works out how far across a move of distance mm goes
+*/
+long Odometry_Sin(long angle)
+{
+ return Odometry_Sine(Odometry_Index(Odometry_Wrap(angle%ODOMETRY_TWOPI)));
+}
+
+/*
+*
+* Name : Odometry_Cos
+*
+* Returns the cosine of an angle from the table of the module .Both the angle in radians and the result are Q16.16 .
+*
+* Parameters :
+*
+* /angle/ - Angle in radians ,Q16.16
+*
+* E.g. Usage :
+*
+* /dy=(distance*Odometry_Cos (pose.theta))>>16;/ - Works out how far along a move of distance mm goes
+*/
+long Odometry_Cos(long angle)
+{
+ return Odometry_Sine(Odometry_Index(Odometry_Wrap(angle%ODOMETRY_TWOPI))+256);
+}
@@ -0,0 +1,285 @@
+/****************************************************
+* Module: Sensor Cache
+*
+* The *SENSOR CACHE* module lets several parts of your program ask for the same reading without each paying for a
+* transfer on the bus ,or a 65ms ping of an *SRF08* .A reading is looked up by the device address and the quantity ,a
+* driver of the *SENSORS* module with its parameter ,and the caller says how old a reading it accepts .A reading which
+* is young enough is returned at once from the cache .Otherwise a new reading is started ,or if one is already on its
+* way the request joins it ,so there is never more than one reading in progress for the same quantity .
+*
+* The age of a reading is counted from the time it was stored .Up to SENSORCACHESIZE quantities are cached ,when the
+* cache is full the one which was stored longest ago makes room .Each entry keeps only the driver state and the last
+* reading ,not the samples and schedule of a /Sensor/ .The hits ,misses and joins are counted once per request so you
+* can see how many transfers the cache saves .
+*
+****************************************************/
+
+/* Sensor Cache Settings */
+#ifndef SENSORCACHESIZE
+#define SENSORCACHESIZE 4
+#endif
+
+/* Cache Entry ,starts like a Sensor so the drivers can use it */
+typedef struct{
+Sensor_State state;
+const Sensor_Driver * driver;
+byte address;
+byte parameter;
+void (*limit)(Sensor * sensor,int value);           /* always NULL */
+byte busy;                                          /* reading in progress */
+int value;                                          /* last reading */
+int status;                                         /* I2C_SUCCESS ,the last error code or SENSOR_NO_READING */
+unsigned long doneTime;                             /* Timer16_Time at which the last reading was stored */
+}SensorCache_Entry;
+
+/* Variables */
+static SensorCache_Entry sensorCacheEntries[SENSORCACHESIZE];
+
+static struct{
+unsigned int hits;                                  /* answered from the cache */
+unsigned int misses;                                /* new reading started */
+unsigned int joins;                                 /* waited for a reading already in progress */
+}sensorCache;
+
+/* Local Functions */
+
+/* Finds the entry of a quantity or makes one if make is 1 ,returns NULL if every entry has a reading in progress */
+static SensorCache_Entry * SensorCache_Find(const Sensor_Driver * driver,byte address,byte parameter,byte make)
+{
+ SensorCache_Entry * entry;
+ SensorCache_Entry * oldest=NULL;
+ for(entry=sensorCacheEntries;entry<sensorCacheEntries+SENSORCACHESIZE;entry++)
+  {
+   if(entry->driver==driver && entry->address==address && entry->parameter==parameter)
+       return entry;
+   if(!make || entry->busy)
+       continue;
+   if(oldest==NULL || entry->driver==NULL || (oldest->driver!=NULL && (long)(entry->doneTime-oldest->doneTime)<0))
+       oldest=entry;
+  }
+ if(oldest!=NULL)
+  {
+   memset(oldest,0,sizeof(*oldest));
+   oldest->driver=driver;
+   oldest->address=address;
+   oldest->parameter=parameter;
+   oldest->status=SENSOR_NO_READING;
+  }
+ return oldest;
+}
+
+/* Stores the reading in progress when it is done ,returns 1 with the reading or its error code in status if it was
+   done */
+static byte SensorCache_Collect(SensorCache_Entry * entry,int * status)
+{
+ int value;
+ if(!entry->busy || !Sensors_Poll((Sensor *)entry))
+     return 0;
+ entry->busy=0;
+ value=Sensors_Read((Sensor *)entry);
+ entry->doneTime=Timer16_Time();
+ if(value<0)
+     entry->status=value;
+ else
+  {
+   entry->status=I2C_SUCCESS;
+   entry->value=value;
+  }
+ *status=value;
+ return 1;
+}
+
+/* Functions */
+
+/*
+*
+* Name : SensorCache_Request
+*
+* Asks for a reading without waiting .Returns 1 and puts the reading in /value/ if there is one no older than /maxAge/
+* or one has just been finished for this request .Returns 0 if a reading has been started or is still in progress
+* ,then call /SensorCache_Poll/ until the reading is done .Returns a negative value if the reading failed ,see the *I2C*
+* documentation ,or I2C_BUSY_ERROR if the cache is full of readings in progress ,call again later .Each call counts as
+* one hit ,miss or join unless it returns I2C_BUSY_ERROR .
+*
+* Parameters :
+*
+* /driver/ - &sensorSrf08 ,&sensorCmps03 ,&sensorAdc or your own driver table ,see the *SENSORS* module
+*
+* /address/ - I2C address of the sensor ,or the *ADC* channel
+*
+* /parameter/ - SRF08_INCHES ,SRF08_CM or SRF08_US for &sensorSrf08 ,else passed on to the driver
+*
+* /maxAge/ - Range 0-65535 .Oldest reading accepted in ms ,0 always takes a new reading
+*
+* /value/ - Pointer to the variable which receives the reading
+*
+* E.g. Usage :
+*
+* /if (SensorCache_Request (&sensorCmps03,0x60,0,100,&heading)==1) .../ - Uses a heading no older than 100ms when
+* there is one
+*/
+int SensorCache_Request(const Sensor_Driver * driver,byte address,byte parameter,unsigned int maxAge,int * value)
+{
+ int status;
+ SensorCache_Entry * entry=SensorCache_Find(driver,address,parameter,1);
+ if(entry==NULL)
+     return I2C_BUSY_ERROR;
+ if(entry->busy)
+  {
+   sensorCache.joins++;
+   if(!SensorCache_Collect(entry,&status))
+       return 0;
+   if(status<0)
+       return status;
+   *value=status;                                   /* just finished ,as new as a reading can be */
+   return 1;
+  }
+ if(maxAge!=0 && entry->status==I2C_SUCCESS && Timer16_Time()-entry->doneTime<=TIMER16_MS(maxAge))
+  {
+   sensorCache.hits++;
+   *value=entry->value;
+   return 1;
+  }
+ if((status=Sensors_Start((Sensor *)entry))==I2C_BUSY_ERROR)
+     return status;
+ sensorCache.misses++;
+ if(status<0)
+  {
+   entry->status=status;
+   return status;
+  }
+ entry->busy=1;
+ return 0;
+}
+
+/*
+*
+* Name : SensorCache_Poll
+*
+* Waits without blocking for the reading a call of /SensorCache_Request/ returned 0 for .Returns 1 and puts the reading
+* in /value/ when it is done ,0 while it is still in progress or a negative value if it failed ,see the *I2C*
+* documentation .Polls are not counted as joins .
+*
+* Parameters :
+*
+* /driver/ - The driver given to /SensorCache_Request/
+*
+* /address/ - The address given to /SensorCache_Request/
+*
+* /parameter/ - The parameter given to /SensorCache_Request/
+*
+* /value/ - Pointer to the variable which receives the reading
+*
+* E.g. Usage :
+*
+* /if (SensorCache_Poll (&sensorCmps03,0x60,0,&heading)==1) .../ - Uses the heading once it has been read
+*/
+int SensorCache_Poll(const Sensor_Driver * driver,byte address,byte parameter,int * value)
+{
+ int status;
+ SensorCache_Entry * entry=SensorCache_Find(driver,address,parameter,0);
+ if(entry==NULL)
+     return SENSOR_NO_READING;
+ if(entry->busy && !SensorCache_Collect(entry,&status))
+     return 0;
+ if(entry->status!=I2C_SUCCESS)
+     return entry->status;
+ *value=entry->value;
+ return 1;
+}
+
+/*
+*
+* Name : SensorCache_Read
+*
+* Returns a reading no older than /maxAge/ ,waiting for a new one only if the cache has none young enough .Returns a
+* negative value if the reading failed ,see the *I2C* documentation .Call it with interrupts enabled .
+*
+* Parameters :
+*
+* /driver/ - &sensorSrf08 ,&sensorCmps03 ,&sensorAdc or your own driver table ,see the *SENSORS* module
+*
+* /address/ - I2C address of the sensor ,or the *ADC* channel
+*
+* /parameter/ - SRF08_INCHES ,SRF08_CM or SRF08_US for &sensorSrf08 ,else passed on to the driver
+*
+* /maxAge/ - Range 0-65535 .Oldest reading accepted in ms ,0 always takes a new reading
+*
+* E.g. Usage :
+*
+* /SensorCache_Read (&sensorSrf08,0x70,SRF08_CM,200);/ - Returns the front range ,pinging only if the last range is
+* older than 200ms
+*/
+int SensorCache_Read(const Sensor_Driver * driver,byte address,byte parameter,unsigned int maxAge)
+{
+ int value;
+ int status;
+ while((status=SensorCache_Request(driver,address,parameter,maxAge,&value))==I2C_BUSY_ERROR)
+     I2C_CheckTimeout();
+ while(status==0 && (status=SensorCache_Poll(driver,address,parameter,&value))==0)
+     I2C_CheckTimeout();
+ return (status<0)?status:value;
+}
+
+/*
+*
+* Name : SensorCache_GetHitCount
+*
+* Returns the number of requests answered from the cache since /SensorCache_ResetCounts/ .
+*
+* E.g. Usage :
+*
+* /hits=SensorCache_GetHitCount ();/ - Reads the hit count
+*/
+unsigned int SensorCache_GetHitCount()
+{
+ return sensorCache.hits;
+}
+
+/*
+*
+* Name : SensorCache_GetMissCount
+*
+* Returns the number of requests which had to start a new reading since /SensorCache_ResetCounts/ .
+*
+* E.g. Usage :
+*
+* /misses=SensorCache_GetMissCount ();/ - Reads the miss count
+*/
+unsigned int SensorCache_GetMissCount()
+{
+ return sensorCache.misses;
+}
+
+/*
+*
+* Name : SensorCache_GetJoinCount
+*
+* Returns the number of requests which found their reading already in progress since /SensorCache_ResetCounts/ .Each
+* request counts once ,however long it waits .
+*
+* E.g. Usage :
+*
+* /joins=SensorCache_GetJoinCount ();/ - Reads the join count
+*/
+unsigned int SensorCache_GetJoinCount()
+{
+ return sensorCache.joins;
+}
+
+/*
+*
+* Name : SensorCache_ResetCounts
+*
+* Clears the hit ,miss and join counts .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /SensorCache_ResetCounts ();/ - Starts counting again
+*/
+void SensorCache_ResetCounts()
+{
+ sensorCache.hits=0;
+ sensorCache.misses=0;
+ sensorCache.joins=0;
+}
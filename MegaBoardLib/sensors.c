@@ -0,0 +1,474 @@
+/****************************************************
+* Module: Sensors
+*
+* The *SENSORS* module reads any number of sensors at their own rates without your program waiting for any of them .Each
+* sensor has a driver ,a table of three functions kept in flash :/start/ begins a reading and returns at once ,/poll/
+* returns 1 when the reading is done and /read/ returns the value ,or a negative error code .Drivers are provided for
+* the *SRF08* sonar ,the *CMPS03* compass and the *ADC* channels ,and you can write your own in the same way .A driver
+* may only use the /state/ ,/address/ and /parameter/ fields of the sensor ,so the *SENSOR CACHE* module can hand it a
+* smaller structure .
+*
+* Give each sensor a /Sensor/ structure and add it with /Sensors_Add/ .Call /Sensors_Update/ regularly ,e.g. every pass
+* of your main loop ,it polls the readings in progress and starts the readings which are due .Each reading is stamped
+* with the /Timer16_Time/ at which it was started and put in a ring buffer of the last SENSORSAMPLES readings of the
+* sensor ,read them with /Sensors_GetValue/ and /Sensors_GetSample/ .The readings are stored by /Sensors_Update/ so
+* read them from the main loop ,not from an interrupt .
+*
+* The *SRF08* and *CMPS03* drivers use the interrupt driven transfer queue of the *I2C* module .The *ADC* driver starts
+* a single conversion ,do not use it together with /Adc_TakeContinousReadings/ .
+*
+****************************************************/
+
+/* Sensors Settings */
+#ifndef SENSORSAMPLES
+#define SENSORSAMPLES  4                            /* readings kept per sensor ,a power of 2 */
+#endif
+#define SENSOR_NO_READING -6
+
+/* Driver Functions */
+struct Sensor;
+
+typedef struct{
+int (*start)(struct Sensor * sensor);               /* I2C_SUCCESS ,I2C_BUSY_ERROR to try again later or an error code */
+byte (*poll)(struct Sensor * sensor);               /* 1 when the reading is done */
+int (*read)(struct Sensor * sensor);                /* the value or an error code */
+}Sensor_Driver;
+
+typedef struct{
+int value;
+unsigned long time;                                 /* Timer16_Time at which the reading was started */
+}Sensor_Sample;
+
+typedef union{
+Srf08_Ranging ranging;
+struct{
+I2C_Transaction transaction;
+I2C_Segment segments[2];
+byte reg;
+byte data[2];
+}i2c;
+}Sensor_State;
+
+/* A driver only uses the fields up to limit ,the SENSOR CACHE module keeps entries which stop there */
+typedef struct Sensor{
+Sensor_State state;                                 /* used by the driver ,first so its completion functions find the sensor */
+const Sensor_Driver * driver;                       /* in flash */
+byte address;                                       /* I2C address or ADC channel */
+byte parameter;                                     /* reading unit of the SRF08 */
+void (*limit)(struct Sensor * sensor,int value);    /* called when a reading is outside ,NULL for no check */
+byte busy;                                          /* reading in progress */
+unsigned long period;
+unsigned long dueTime;
+unsigned long startTime;
+Sensor_Sample samples[SENSORSAMPLES];
+byte head;                                          /* index of the next sample */
+unsigned int count;                                 /* readings stored since Sensors_Add */
+unsigned int errors;
+int status;                                         /* last error code */
+unsigned long doneTime;                             /* Timer16_Time at which the last reading was stored */
+int minimum;                                        /* limits checked as soon as a reading is done */
+int maximum;
+struct Sensor * next;
+}Sensor;
+
+/* Variables */
+static struct{
+Sensor * first;
+byte adcBusy;                                       /* an ADC sensor owns the converter */
+}sensors;
+
+/* Local Functions */
+
+/* Calls the limit function of the sensor if a reading is outside its limits */
+static void Sensors_Check(Sensor * sensor,int value)
+{
+ if(sensor->limit!=NULL && value>=0 && (value<sensor->minimum || value>sensor->maximum))
+     sensor->limit(sensor,value);
+}
+
+/* Starts a read of size bytes from register reg of the sensor */
+static int Sensors_ReadRegisters(Sensor * sensor,byte reg,byte size,void (*callback)(I2C_Transaction * transaction))
+{
+ if(I2C_IsMissing(sensor->address))
+     return I2C_SLAVEACK_ERROR;
+ sensor->state.i2c.reg=reg;
+ sensor->state.i2c.segments[0].type=I2C_WRITE;
+ sensor->state.i2c.segments[0].size=1;
+ sensor->state.i2c.segments[0].data=&sensor->state.i2c.reg;
+ sensor->state.i2c.segments[1].type=I2C_READ;
+ sensor->state.i2c.segments[1].size=size;
+ sensor->state.i2c.segments[1].data=sensor->state.i2c.data;
+ sensor->state.i2c.transaction.address=sensor->address;
+ sensor->state.i2c.transaction.flags=0;
+ sensor->state.i2c.transaction.segments=sensor->state.i2c.segments;
+ sensor->state.i2c.transaction.segmentCount=2;
+ sensor->state.i2c.transaction.bitRate=0;
+ sensor->state.i2c.transaction.callback=callback;
+ I2C_Submit(&sensor->state.i2c.transaction);
+ return I2C_SUCCESS;
+}
+
+static byte Sensors_ReadDone(Sensor * sensor)
+{
+ return sensor->state.i2c.transaction.status!=I2C_PENDING;
+}
+
+/* SRF08 ,the first echo in the unit given as parameter ,0 when there is no echo is not checked */
+static void Sensors_Srf08Done(Srf08_Ranging * ranging)
+{
+ if(ranging->range>0)
+     Sensors_Check((Sensor *)ranging,ranging->range);
+}
+
+static int Sensors_Srf08Start(Sensor * sensor)
+{
+ return Srf08_StartRanging(&sensor->state.ranging,sensor->address,sensor->parameter,Sensors_Srf08Done);
+}
+
+static byte Sensors_Srf08Poll(Sensor * sensor)
+{
+ return Srf08_Poll(&sensor->state.ranging);
+}
+
+static int Sensors_Srf08Read(Sensor * sensor)
+{
+ return sensor->state.ranging.range;
+}
+
+/* CMPS03 ,the heading in tenths of a degree */
+static int Sensors_Cmps03Read(Sensor * sensor)
+{
+ int heading;
+ if(sensor->state.i2c.transaction.status!=I2C_SUCCESS)
+     return sensor->state.i2c.transaction.status;
+ heading=(sensor->state.i2c.data[0]<<8)|sensor->state.i2c.data[1];
+ return (heading<3600)?heading:SENSOR_NO_READING;
+}
+
+static void Sensors_Cmps03Done(I2C_Transaction * transaction)
+{
+ Sensors_Check((Sensor *)transaction,Sensors_Cmps03Read((Sensor *)transaction));
+}
+
+static int Sensors_Cmps03Start(Sensor * sensor)
+{
+ return Sensors_ReadRegisters(sensor,2,2,Sensors_Cmps03Done);
+}
+
+/* ADC ,one conversion of the channel given as address */
+static int Sensors_AdcStart(Sensor * sensor)
+{
+ if(sensor->address>7)
+     return -1;
+ if(sensors.adcBusy || (ADCSRA&_BV(ADIE)))
+     return I2C_BUSY_ERROR;
+ sensors.adcBusy=1;
+ ADCSRA=_BV(ADEN)|_BV(ADPS2)|_BV(ADPS1);
+ ADMUX=sensor->address;
+ ADCSRA|=_BV(ADSC);
+ return I2C_SUCCESS;
+}
+
+static byte Sensors_AdcPoll(Sensor * sensor)
+{
+ (void)sensor;
+ return !(ADCSRA&_BV(ADSC));
+}
+
+/* The conversion is only seen by Sensors_Update so it is checked there ,use Adc_SetWindow to check in the interrupt */
+static int Sensors_AdcRead(Sensor * sensor)
+{
+ int reading=ADCL;                                  /* ADCL first ,it locks ADCH */
+ reading|=ADCH<<8;
+ sensors.adcBusy=0;
+ Sensors_Check(sensor,reading);
+ return reading;
+}
+
+/* Drivers */
+const Sensor_Driver sensorSrf08 PROGMEM={Sensors_Srf08Start,Sensors_Srf08Poll,Sensors_Srf08Read};
+const Sensor_Driver sensorCmps03 PROGMEM={Sensors_Cmps03Start,Sensors_ReadDone,Sensors_Cmps03Read};
+const Sensor_Driver sensorAdc PROGMEM={Sensors_AdcStart,Sensors_AdcPoll,Sensors_AdcRead};
+
+/* Functions */
+
+/* Calls the functions of the driver table in flash */
+static int Sensors_Start(Sensor * sensor)
+{
+ return ((int (*)(Sensor *))pgm_read_word(&sensor->driver->start))(sensor);
+}
+
+static byte Sensors_Poll(Sensor * sensor)
+{
+ return ((byte (*)(Sensor *))pgm_read_word(&sensor->driver->poll))(sensor);
+}
+
+static int Sensors_Read(Sensor * sensor)
+{
+ return ((int (*)(Sensor *))pgm_read_word(&sensor->driver->read))(sensor);
+}
+
+/* Starts a reading with the driver ,returns I2C_SUCCESS ,I2C_BUSY_ERROR or the error code */
+static int Sensors_Begin(Sensor * sensor)
+{
+ unsigned long now=Timer16_Time();
+ int status=Sensors_Start(sensor);
+ if(status==I2C_BUSY_ERROR)
+     return status;
+ if(status<0)
+  {
+   sensor->status=status;
+   sensor->errors++;
+   return status;
+  }
+ sensor->startTime=now;
+ sensor->busy=1;
+ return I2C_SUCCESS;
+}
+
+/* Stores the reading in progress in the ring buffer of the sensor when it is done ,returns 1 if it was done */
+static byte Sensors_Collect(Sensor * sensor)
+{
+ int value;
+ if(!sensor->busy || !Sensors_Poll(sensor))
+     return 0;
+ sensor->busy=0;
+ value=Sensors_Read(sensor);
+ sensor->doneTime=Timer16_Time();
+ if(value<0)
+  {
+   sensor->status=value;
+   sensor->errors++;
+   return 1;
+  }
+ sensor->samples[sensor->head].value=value;
+ sensor->samples[sensor->head].time=sensor->startTime;
+ sensor->head=(sensor->head+1)&(SENSORSAMPLES-1);
+ sensor->count++;
+ return 1;
+}
+
+/*
+*
+* Name : Sensors_Add
+*
+* Adds a sensor to the ones read by /Sensors_Update/ .The first reading is started by the next update .The sensor
+* structure must stay valid while the sensor is read ,e.g. make it a global variable .This function does not return a
+* value .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure
+*
+* /driver/ - &sensorSrf08 ,&sensorCmps03 ,&sensorAdc or the address of your own driver table in flash
+*
+* /address/ - I2C address of the sensor ,or the channel 0-7 for &sensorAdc
+*
+* /parameter/ - SRF08_INCHES ,SRF08_CM or SRF08_US for &sensorSrf08 ,else passed on to your driver
+*
+* /period/ - Range 1-65535 .Time between readings in ms ,a reading which falls due while the last one is still in
+* progress is started as soon as the last one is done
+*
+* E.g. Usage :
+*
+* /Sensors_Add (&front,&sensorSrf08,0x70,SRF08_CM,100);/ - Ranges with the front sonar ten times a second
+*
+* /Sensors_Add (&battery,&sensorAdc,3,0,1000);/ - Reads the ADC channel 3 once a second
+*/
+void Sensors_Add(Sensor * sensor,const Sensor_Driver * driver,byte address,byte parameter,unsigned int period)
+{
+ Sensor * other;
+ memset(sensor,0,sizeof(*sensor));
+ sensor->driver=driver;
+ sensor->address=address;
+ sensor->parameter=parameter;
+ sensor->period=TIMER16_MS(period);
+ sensor->dueTime=Timer16_Time();
+ sensor->status=SENSOR_NO_READING;
+ if(sensors.first==NULL)
+     sensors.first=sensor;
+ else
+  {
+   for(other=sensors.first;other->next!=NULL;other=other->next);
+   other->next=sensor;
+  }
+}
+
+/*
+*
+* Name : Sensors_Remove
+*
+* Stops reading a sensor after the reading in progress ,if any ,is complete .The sensor structure can be used again
+* once this function returns .This function does not return a value .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* E.g. Usage :
+*
+* /Sensors_Remove (&front);/ - Stops ranging with the front sonar
+*/
+void Sensors_Remove(Sensor * sensor)
+{
+ Sensor ** link;
+ for(link=&sensors.first;*link!=NULL;link=&(*link)->next)
+     if(*link==sensor)
+      {
+       *link=sensor->next;
+       break;
+      }
+ while(sensor->busy && !Sensors_Collect(sensor))
+     I2C_CheckTimeout();
+}
+
+/*
+*
+* Name : Sensors_Update
+*
+* Polls the readings in progress ,stores the finished ones and starts the readings which are due .Returns at once ,the
+* readings run in the background .Call it regularly ,at least as often as the fastest sensor is read ,from one place
+* only .A sensor which falls behind skips readings rather than catching up .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /while (1) { Sensors_Update (); ... }/ - Keeps all the sensors read from the main loop
+*/
+void Sensors_Update()
+{
+ Sensor * sensor;
+ unsigned long now;
+ for(sensor=sensors.first;sensor!=NULL;sensor=sensor->next)
+  {
+   if(sensor->busy && !Sensors_Collect(sensor))
+       continue;
+   now=Timer16_Time();
+   if((long)(now-sensor->dueTime)<0)
+       continue;
+   if(Sensors_Begin(sensor)==I2C_BUSY_ERROR)
+       continue;                                    /* still due ,tried again at the next update */
+   sensor->dueTime+=sensor->period;
+   if((long)(now-sensor->dueTime)>=0)
+       sensor->dueTime=now+sensor->period;          /* fell behind ,no catching up */
+  }
+}
+
+/*
+*
+* Name : Sensors_SetLimits
+*
+* Makes a function be called as soon as a reading of the sensor is below /minimum/ or above /maximum/ .The *SRF08* and
+* *CMPS03* readings are checked in the completion function of their last transfer ,from the *I2C* interrupt with
+* interrupts enabled ,without waiting for /Sensors_Update/ .The *ADC* readings are checked by /Sensors_Update/ .Errors
+* and an *SRF08* range of 0 ,no echo ,are not checked .This function does not return a value .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* /minimum/ - Lowest reading allowed
+*
+* /maximum/ - Highest reading allowed
+*
+* /fptr/ - Function called with the sensor and the reading ,NULL to stop checking
+*
+* E.g. Usage :
+*
+* /Sensors_SetLimits (&front,20,32767,TooClose);/ - Calls TooClose when the front sonar sees something nearer than 20cm
+*/
+void Sensors_SetLimits(Sensor * sensor,int minimum,int maximum,void (*fptr)(Sensor * sensor,int value))
+{
+ byte sreg=SREG;
+ cli();
+ sensor->minimum=minimum;
+ sensor->maximum=maximum;
+ sensor->limit=fptr;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Sensors_GetValue
+*
+* Returns the last reading of a sensor ,or SENSOR_NO_READING (-6) if it has no reading yet .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* E.g. Usage :
+*
+* /distance=Sensors_GetValue (&front);/ - Reads the last front range
+*/
+int Sensors_GetValue(Sensor * sensor)
+{
+ if(sensor->count==0)
+     return SENSOR_NO_READING;
+ return sensor->samples[(sensor->head-1)&(SENSORSAMPLES-1)].value;
+}
+
+/*
+*
+* Name : Sensors_GetSample
+*
+* Copies one of the last SENSORSAMPLES readings of a sensor with the time it was started .Returns 1 if the reading is
+* there else returns 0 .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* /age/ - Range 0-SENSORSAMPLES-1 .0 for the last reading ,1 for the one before and so on
+*
+* /sample/ - Pointer to the structure which receives the reading
+*
+* E.g. Usage :
+*
+* /if (Sensors_GetSample (&front,1,&last)) .../ - Gets the range before the last one to work out the speed
+*/
+byte Sensors_GetSample(Sensor * sensor,byte age,Sensor_Sample * sample)
+{
+ if(age>=SENSORSAMPLES || age>=sensor->count)
+     return 0;
+ *sample=sensor->samples[(sensor->head-1-age)&(SENSORSAMPLES-1)];
+ return 1;
+}
+
+/*
+*
+* Name : Sensors_GetSampleCount
+*
+* Returns the number of readings stored since /Sensors_Add/ .Use it to wait for a new reading .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* E.g. Usage :
+*
+* /count=Sensors_GetSampleCount (&front);/ - Remembers the reading count
+*/
+unsigned int Sensors_GetSampleCount(Sensor * sensor)
+{
+ return sensor->count;
+}
+
+/*
+*
+* Name : Sensors_GetErrorCount
+*
+* Returns the number of readings of a sensor which failed since /Sensors_Add/ .The /status/ field holds the error code
+* of the last one ,see the *I2C* documentation .
+*
+* Parameters :
+*
+* /sensor/ - Pointer to the sensor structure given to /Sensors_Add/
+*
+* E.g. Usage :
+*
+* /if (Sensors_GetErrorCount (&front)>10) .../ - Checks the front sonar connection
+*/
+unsigned int Sensors_GetErrorCount(Sensor * sensor)
+{
+ return sensor->errors;
+}
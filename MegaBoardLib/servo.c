@@ -10,6 +10,22 @@
  unsigned int servoValues[8]={(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2,(END_VALUE-START_VALUE)/2};
  byte servoFlag;
  byte servoNumber;
+ unsigned int servoMaxLatency;
+ unsigned int servoFrameStart;
+ unsigned int servoNextEdge;
+ volatile byte servoHeld;
+
+#ifdef _SERVO_TIMER1_
+ #define SERVO_CHANNEL TIMER1_CHANNEL_B
+#elif defined _SERVO_TIMER3_
+ #define SERVO_CHANNEL TIMER3_CHANNEL_A
+#else 
+ #error No timer available for servo motor controller
+#endif
+#define SERVO_FRAMETICKS 40501
+
+/* Local Functions */
+static void Servo_Update();
 
 
 /* Functions */
@@ -18,9 +34,9 @@
 *
 * Name : Servo_Init
 *
-* Initalizes the *SERVOS* port and timer which controls the servos .No need to call this function unless you want to 
-* reset the *SERVO* port and timer .This function is implicitly called by the /MegaBoard_Init()/ function . This 
-* function does not return a value . 
+* Initalizes the *SERVOS* port and takes the timer channel which controls the servos (Timer1 channel B with _SERVO_TIMER1_
+* or Timer3 channel A with _SERVO_TIMER3_) .No need to call this function unless you want to reset the *SERVO* port .
+* This function is implicitly called by the /MegaBoard_Init()/ function . This function does not return a value . 
 *
 * E.g. Usage :
 *
@@ -28,30 +44,12 @@
 */
 void Servo_Init(void)
 {
- byte count;
+ Timer16_Cancel(SERVO_CHANNEL);
  _SERVO_DIR_PORT_=0xFF;
  _SERVO_PORT_=0;
  servoFlag=1;
  servoNumber=0;
-#ifdef _SERVO_TIMER1_
-  TIMSK|=_BV(OCIE1B);
-  TCNT1=0x0;
-  TCCR1A=0x0;
-  TCCR1B=_BV(WGM12);
-  TCCR1C=0x0;
-  OCR1A=40500;
-  OCR1B=200;	
-#elif defined _SERVO_TIMER3_
-  ETIMSK|=_BV(OCIE3B);
-  TCNT3=0x0;
-  TCCR3A=0x0;
-  TCCR3B=_BV(WGM12);
-  TCCR3C=0x0;
-  OCR3A=40500;
-  OCR3B=200; 
-#else 
- #error No timer available for servo motor controller
-#endif
+ Timer16_Allocate(SERVO_CHANNEL,Servo_Update);
 }
 
 /* Functions */
@@ -70,11 +68,12 @@ void Servo_Init(void)
 */
 void Servo_Start()
 {
-    #ifdef _SERVO_TIMER1_
-     TCCR1B|=_BV(CS11); 
-    #elif defined _SERVO_TIMER3_
-      TCCR3B|=_BV(CS11); 
-    #endif
+    byte sreg=SREG;
+    cli();
+    servoFrameStart=Timer16_Now(SERVO_CHANNEL)+100;
+    servoNextEdge=servoFrameStart+servoTimerConstants[servoNumber];
+    Timer16_ScheduleAt(SERVO_CHANNEL,servoNextEdge);
+    SREG=sreg;
 }
 
 
@@ -103,6 +102,8 @@ void Servo_Start()
 */
 void Servo_SetAngles(float servoAngle1,float servoAngle2,float servoAngle3,float servoAngle4,float servoAngle5,float servoAngle6,float servoAngle7,float servoAngle8)
 {
+ if(servoHeld)
+     return;
  servoValues[0]=START_VALUE+(((float)(END_VALUE-START_VALUE)/180)*servoAngle1);   
  servoValues[1]=START_VALUE+(((float)(END_VALUE-START_VALUE)/180)*servoAngle2);
  servoValues[2]=START_VALUE+(((float)(END_VALUE-START_VALUE)/180)*servoAngle3);
@@ -128,6 +129,8 @@ void Servo_SetAngles(float servoAngle1,float servoAngle2,float servoAngle3,float
 void Servo_CenterAll()
 {
  byte i;
+ if(servoHeld)
+     return;
  for(i=0;i<8;i++)
      servoValues[i]=(END_VALUE-START_VALUE)/2;
 }
@@ -152,46 +155,108 @@ void Servo_CenterAll()
 */
 void Servo_SetAngle(float servoAngle,byte servoMotorNumber)
 {
+ if(servoHeld)
+     return;
  if(servoMotorNumber>0 && servoMotorNumber<9) 
  servoValues[servoMotorNumber]=START_VALUE+(((float)(END_VALUE-START_VALUE)/180)*servoAngle);
 }
 
 
 
-#ifdef _SERVO_TIMER1_
- SIGNAL(SIG_OUTPUT_COMPARE1B)
- {
- if(servoFlag==0)
-   {
-    _SERVO_PORT_&=~_BV(servoNumber);
-    servoFlag=1;
-    servoNumber++;
-    servoNumber%=8;
-    OCR1B=servoTimerConstants[servoNumber];
-   }
-  else
-   {
-    OCR1B+=servoValues[servoNumber];
-    _SERVO_PORT_|=_BV(servoNumber);
-    servoFlag=0;
-  }
- }	  	
-#elif defined _SERVO_TIMER3_
- SIGNAL(SIG_OUTPUT_COMPARE3B)
- {
+/*
+*
+* Name : Servo_Hold
+*
+* Keeps all the *SERVO* motors where they are :the pulses go on unchanged so the servos hold their position against a
+* load ,and new angles are refused until /Servo_Release/ is called .It may be called from an interrupt handler .This
+* function does not return any value .
+*
+* E.g. Usage :
+*
+* /Servo_Hold ();/ - Freezes the servo positions
+*/
+void Servo_Hold()
+{
+ servoHeld=1;
+}
+
+/*
+*
+* Name : Servo_Release
+*
+* Accepts new angles again after /Servo_Hold/ .This function does not return any value .
+*
+* E.g. Usage :
+*
+* /Servo_Release ();/ - Lets the servos move again
+*/
+void Servo_Release()
+{
+ servoHeld=0;
+}
+
+/*
+*
+* Name : Servo_GetMaxLatency
+*
+* Returns the longest delay in timer ticks (0.5us each) between the moment a servo pulse edge was due and the moment the
+* servo interrupt changed the pin .This is the worst case jitter of the servo pulse widths since the last call to
+* /Servo_ResetMaxLatency/ .Use it to check how much the other interrupts of your program disturb the servos ,see the
+* *INTERRUPT PRIORITIES* module .
+*
+* E.g. Usage :
+*
+* /Uart1_printf ("%u",Servo_GetMaxLatency ()/2);/ - Prints the worst servo pulse jitter in microseconds
+*/
+unsigned int Servo_GetMaxLatency()
+{
+ unsigned int latency;
+ byte sreg=SREG;
+ cli();
+ latency=servoMaxLatency;
+ SREG=sreg;
+ return latency;
+}
+
+/*
+*
+* Name : Servo_ResetMaxLatency
+*
+* Starts a new worst case jitter measurement for /Servo_GetMaxLatency/ .
+*
+* E.g. Usage :
+*
+* /Servo_ResetMaxLatency ();/ - Clears the worst servo pulse jitter measured so far
+*/
+void Servo_ResetMaxLatency()
+{
+ byte sreg=SREG;
+ cli();
+ servoMaxLatency=0;
+ SREG=sreg;
+}
+
+/* Called from the timer channel interrupt at every servo pulse edge */
+static void Servo_Update()
+{
+ unsigned int latency=Timer16_Now(SERVO_CHANNEL)-servoNextEdge;
+ if(latency>servoMaxLatency)
+     servoMaxLatency=latency;
  if(servoFlag==0)
    {
     _SERVO_PORT_&=~_BV(servoNumber);
     servoFlag=1;
     servoNumber++;
     servoNumber%=8;
-    OCR3B=servoTimerConstants[servoNumber];
+    if(servoNumber==0)
+        servoFrameStart+=SERVO_FRAMETICKS;
+    servoNextEdge=servoFrameStart+servoTimerConstants[servoNumber];
    }
   else
    {
-    OCR3B+=servoValues[servoNumber];
+    servoNextEdge+=servoValues[servoNumber];
     _SERVO_PORT_|=_BV(servoNumber);
     servoFlag=0;
   }
- }
-#endif
\ No newline at end of file
+ Timer16_ScheduleAt(SERVO_CHANNEL,servoNextEdge);
+}
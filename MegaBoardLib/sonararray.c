@@ -0,0 +1,365 @@
+/****************************************************
+* Module: Sonar Array
+*
+* The *SONAR ARRAY* module runs several *SRF08* sonars without waiting for each reading in turn .The sonars are put in
+* groups ,the sonars of one group are fired together and the groups are fired one after the other so a sonar never
+* hears the ping of its neighbour .Put sonars which point in clearly different directions in the same group ,e.g. with
+* six sonars round the robot the groups {0,2,4} and {1,3,5} give two pings per scan instead of six .
+*
+* Everything runs on the interrupt driven transfer queue of the *I2C* module .Each sonar of the group is polled after
+* SONARARRAYPOLLTIME and its reading is collected as soon as it answers ,the next group is fired when all the sonars of
+* the group have answered or SONARARRAYRANGETIME has passed .Call /SonarArray_Update/ regularly ,e.g. every pass of
+* your main loop ,and read the ranges with /SonarArray_GetRange/ .Each range is stamped with the time its ping was sent .
+*
+****************************************************/
+
+/* Sonar Array Settings */
+#ifndef SONARARRAYMAX
+#define SONARARRAYMAX        8
+#endif
+#if SONARARRAYMAX>8
+ #error SONARARRAYMAX is limited to 8 by the pending bitmask
+#endif
+#ifndef SONARARRAYRANGETIME
+#define SONARARRAYRANGETIME  70                     /* ms ,full range of 11m is 65ms */
+#endif
+#ifndef SONARARRAYPOLLTIME
+#define SONARARRAYPOLLTIME   5                      /* ms between polls of a group */
+#endif
+#define SONARARRAY_NO_READING -6
+
+/* Phases */
+#define SONARARRAY_STOPPED  0
+#define SONARARRAY_FIRING   1
+#define SONARARRAY_RANGING  2
+#define SONARARRAY_READING  3
+
+/* Variables */
+static struct{
+byte address;
+byte group;
+volatile int range;
+volatile unsigned long time;
+}sonarArraySonars[SONARARRAYMAX];
+
+static struct{
+I2C_Transaction transaction;
+I2C_Segment segments[2];
+byte command[2];
+byte registers[4];
+byte count;
+byte groups;
+byte group;                                         /* group being ranged */
+byte member;                                        /* sonar being fired or read */
+byte pending;                                       /* bit for each sonar of the group not read yet */
+volatile byte phase;
+unsigned long fireTime;
+unsigned long pollTime;
+volatile unsigned int scans;
+}sonarArray;
+
+/* Local Functions */
+static void SonarArray_Next(I2C_Transaction * transaction);
+
+/* Functions */
+
+/* Finds the next sonar of the group from member on which still has to be fired or read ,returns count if none */
+static byte SonarArray_FindMember(byte member)
+{
+ for(;member<sonarArray.count;member++)
+     if(sonarArray.pending&_BV(member))
+         return member;
+ return sonarArray.count;
+}
+
+/* Sends the ranging command to a sonar */
+static void SonarArray_Fire(byte member)
+{
+ sonarArray.member=member;
+ sonarArray.transaction.address=sonarArraySonars[member].address;
+ sonarArray.segments[0].type=I2C_WRITE;
+ sonarArray.segments[0].size=2;
+ sonarArray.segments[0].data=sonarArray.command;
+ sonarArray.transaction.segmentCount=1;
+ I2C_Submit(&sonarArray.transaction);
+}
+
+/* Reads the software revision ,light and first echo registers of a sonar */
+static void SonarArray_Read(byte member)
+{
+ sonarArray.member=member;
+ sonarArray.transaction.address=sonarArraySonars[member].address;
+ sonarArray.segments[0].type=I2C_WRITE;
+ sonarArray.segments[0].size=1;
+ sonarArray.segments[0].data=sonarArray.command;    /* command[0] is register 0 */
+ sonarArray.segments[1].type=I2C_READ;
+ sonarArray.segments[1].size=4;
+ sonarArray.segments[1].data=sonarArray.registers;
+ sonarArray.transaction.segmentCount=2;
+ I2C_Submit(&sonarArray.transaction);
+}
+
+/* Fires all the sonars of the next group */
+static void SonarArray_FireGroup()
+{
+ byte i;
+ if(++sonarArray.group>=sonarArray.groups)
+  {
+   sonarArray.group=0;
+   sonarArray.scans++;
+  }
+ sonarArray.pending=0;
+ for(i=0;i<sonarArray.count;i++)
+     if(sonarArraySonars[i].group==sonarArray.group && !I2C_IsMissing(sonarArraySonars[i].address))
+         sonarArray.pending|=_BV(i);
+ sonarArray.phase=SONARARRAY_FIRING;
+ sonarArray.fireTime=Timer16_Time();
+ sonarArray.member=SonarArray_FindMember(0);
+ if(sonarArray.member<sonarArray.count)
+     SonarArray_Fire(sonarArray.member);
+ else
+     sonarArray.phase=SONARARRAY_RANGING;           /* empty group ,moves on at the next update */
+}
+
+/* Completion function of the transfers ,fires the rest of the group or collects the readings */
+static void SonarArray_Next(I2C_Transaction * transaction)
+{
+ byte member=sonarArray.member;
+
+ if(sonarArray.phase==SONARARRAY_FIRING)
+  {
+   if(transaction->status!=I2C_SUCCESS)
+    {
+     sonarArraySonars[member].range=transaction->status;
+     sonarArray.pending&=~_BV(member);
+    }
+   member=SonarArray_FindMember(member+1);
+   if(member<sonarArray.count)
+       SonarArray_Fire(member);
+   else
+    {
+     sonarArray.pollTime=Timer16_Time();
+     sonarArray.phase=SONARARRAY_RANGING;
+    }
+   return;
+  }
+
+ if(sonarArray.phase!=SONARARRAY_READING)
+     return;
+ /* An SRF08 does not answer while it is ranging and reads 0xFF as its revision just after */
+ if(transaction->status==I2C_SUCCESS && sonarArray.registers[0]!=0xFF)
+  {
+   sonarArraySonars[member].range=(sonarArray.registers[2]<<8)|sonarArray.registers[3];
+   sonarArraySonars[member].time=sonarArray.fireTime;
+   sonarArray.pending&=~_BV(member);
+  }
+ member=SonarArray_FindMember(member+1);
+ if(member<sonarArray.count)
+     SonarArray_Read(member);
+ else if(sonarArray.pending==0)
+     SonarArray_FireGroup();
+ else
+  {
+   sonarArray.pollTime=Timer16_Time();
+   sonarArray.phase=SONARARRAY_RANGING;
+  }
+}
+
+/*
+*
+* Name : SonarArray_Init
+*
+* Sets up the sonars of the array .The group numbers should start at 0 and have no gaps .The sonars are not fired
+* until /SonarArray_Start/ is called .This function does not return a value .
+*
+* Parameters :
+*
+* /addresses/ - Array of the *SRF08* addresses
+*
+* /groups/ - Array of the group number of each sonar ,sonars with the same number are fired together
+*
+* /count/ - Range 1-SONARARRAYMAX .Number of sonars
+*
+* /readingUnit/ - Takes values SRF08_INCHES for readings in inches or SRF08_CM for readings in centimetres
+*
+* E.g. Usage :
+*
+* /SonarArray_Init ("\x70\x71\x72\x73\x74\x75","\x00\x01\x00\x01\x00\x01",6,SRF08_CM);/ - Six sonars fired three at a
+* time
+*/
+void SonarArray_Init(byte * addresses,byte * groups,byte count,byte readingUnit)
+{
+ byte i;
+ sonarArray.phase=SONARARRAY_STOPPED;
+ if(sonarArray.transaction.segments!=NULL)
+     I2C_WaitFor(&sonarArray.transaction);
+ if(count>SONARARRAYMAX)
+     count=SONARARRAYMAX;
+ sonarArray.count=count;
+ sonarArray.groups=0;
+ for(i=0;i<count;i++)
+  {
+   sonarArraySonars[i].address=addresses[i];
+   sonarArraySonars[i].group=groups[i];
+   sonarArraySonars[i].range=SONARARRAY_NO_READING;
+   sonarArraySonars[i].time=0;
+   if(groups[i]>=sonarArray.groups)
+       sonarArray.groups=groups[i]+1;
+  }
+ sonarArray.command[0]=0;
+ sonarArray.command[1]=readingUnit;
+ sonarArray.transaction.flags=0;
+ sonarArray.transaction.bitRate=0;
+ sonarArray.transaction.segments=sonarArray.segments;
+ sonarArray.transaction.callback=SonarArray_Next;
+ sonarArray.transaction.status=I2C_SUCCESS;
+}
+
+/*
+*
+* Name : SonarArray_Start
+*
+* Starts ranging with the sonar array ,the groups are fired one after the other without a break until
+* /SonarArray_Stop/ is called .This function does not return a value .
+*
+* E.g. Usage :
+*
+* /SonarArray_Start ();/ - Starts the sonar array
+*/
+void SonarArray_Start()
+{
+ if(sonarArray.phase!=SONARARRAY_STOPPED || sonarArray.count==0)
+     return;
+ sonarArray.group=sonarArray.groups-1;              /* the first group fired is 0 */
+ sonarArray.scans=0;
+ SonarArray_FireGroup();
+}
+
+/*
+*
+* Name : SonarArray_Stop
+*
+* Stops the sonar array after the transfer on the bus ,if any ,is complete .The last ranges stay available .This
+* function does not return a value .
+*
+* E.g. Usage :
+*
+* /SonarArray_Stop ();/ - Stops the sonar array
+*/
+void SonarArray_Stop()
+{
+ sonarArray.phase=SONARARRAY_STOPPED;
+ if(sonarArray.transaction.segments!=NULL)
+     I2C_WaitFor(&sonarArray.transaction);
+}
+
+/*
+*
+* Name : SonarArray_Update
+*
+* Polls the sonars of the group being ranged and moves on to the next group when they are done .Returns at once ,the
+* transfers run in the background .Call it regularly ,at least every SONARARRAYPOLLTIME ms ,from one place only .This
+* function does not return a value .
+*
+* E.g. Usage :
+*
+* /while (1) { SonarArray_Update (); ... }/ - Keeps the sonar array running from the main loop
+*/
+void SonarArray_Update()
+{
+ unsigned long now;
+ if(sonarArray.phase!=SONARARRAY_RANGING)
+     return;
+ now=Timer16_Time();
+ if(sonarArray.pending==0 || now-sonarArray.fireTime>=TIMER16_MS(SONARARRAYRANGETIME))
+  {
+   byte i;
+   for(i=0;i<sonarArray.count;i++)
+       if(sonarArray.pending&_BV(i))
+           sonarArraySonars[i].range=SONARARRAY_NO_READING;
+   SonarArray_FireGroup();
+   return;
+  }
+ if(now-sonarArray.pollTime<TIMER16_MS(SONARARRAYPOLLTIME))
+     return;
+ sonarArray.phase=SONARARRAY_READING;
+ SonarArray_Read(SonarArray_FindMember(0));
+}
+
+/*
+*
+* Name : SonarArray_GetRange
+*
+* Returns the last range measured by a sonar of the array in the unit given to /SonarArray_Init/ ,0 if there was no
+* echo .Returns a negative value if the sonar did not answer ,see the *I2C* documentation ,or SONARARRAY_NO_READING (-6)
+* if it has no reading yet ,did not finish ranging in time or is not in the array .
+*
+* Parameters :
+*
+* /sonar/ - Index of the sonar in the arrays given to /SonarArray_Init/
+*
+* E.g. Usage :
+*
+* /SonarArray_GetRange (2);/ - Returns the range of the third sonar
+*/
+int SonarArray_GetRange(byte sonar)
+{
+ int range;
+ byte sreg;
+ if(sonar>=sonarArray.count)
+     return SONARARRAY_NO_READING;
+ sreg=SREG;
+ cli();
+ range=sonarArraySonars[sonar].range;
+ SREG=sreg;
+ return range;
+}
+
+/*
+*
+* Name : SonarArray_GetTime
+*
+* Returns the time at which the ping of the last range of a sonar was sent ,in ticks of /Timer16_Time/ (0.5us) ,0 if the
+* sonar is not in the array .
+*
+* Parameters :
+*
+* /sonar/ - Index of the sonar in the arrays given to /SonarArray_Init/
+*
+* E.g. Usage :
+*
+* /age=Timer16_Time ()-SonarArray_GetTime (2);/ - Works out how old the range of the third sonar is
+*/
+unsigned long SonarArray_GetTime(byte sonar)
+{
+ unsigned long time;
+ byte sreg;
+ if(sonar>=sonarArray.count)
+     return 0;
+ sreg=SREG;
+ cli();
+ time=sonarArraySonars[sonar].time;
+ SREG=sreg;
+ return time;
+}
+
+/*
+*
+* Name : SonarArray_GetScanCount
+*
+* Returns the number of complete scans ,all the groups fired once ,since /SonarArray_Start/ .Use it to measure the scan
+* rate or to wait for a new set of ranges .
+*
+* E.g. Usage :
+*
+* /scans=SonarArray_GetScanCount ();/ - Remembers the scan count
+*/
+unsigned int SonarArray_GetScanCount()
+{
+ unsigned int scans;
+ byte sreg=SREG;
+ cli();
+ scans=sonarArray.scans;
+ SREG=sreg;
+ return scans;
+}
@@ -10,22 +10,37 @@
 
 /* Stepper Ramping Array */
  const int rampArray[RAMPSTAGES]= RAMPARRAY;
+
+/* Ramping array values are in ticks of a timer clocked at mainclock/STEPPERPRESCALAR */
+#ifndef STEPPERPRESCALAR
+#define STEPPERPRESCALAR 8
+#endif
+#define STEPPER_TICKS(rampValue) ((unsigned int)(((unsigned long)(rampValue)+1)*STEPPERPRESCALAR/TIMER16_DIVISOR))
+
 /* Variables */
 static struct{
 unsigned int stepsToTake;
 unsigned int stepsTaken;
 unsigned char rampStage;
 unsigned char stepperFilter;
+volatile unsigned char running;
+volatile int leftSteps;                             /* steps since Stepper_Init ,negative backwards */
+volatile int rightSteps;
+volatile unsigned char halted;                      /* set by Stepper_Halt ,moves are refused */
 }stepperStruct;
 
+/* Local Functions */
+static void Stepper_Update();
+static void Stepper_StartTimer();
+
 /* Functions */
 /*
 *
 * Name : Stepper_Init
 * 
-* Initializes the *STEPPER* drivers,port and the stepping mode .This function is already called by the /MegaBoardInit/  
-* function so no need to call it explicitly unless you want to change the stepping mode .This function does not return 
-* any value.
+* Initializes the *STEPPER* drivers,port and the stepping mode .The steps are timed by Timer1 channel A of the *16 BIT
+* TIMER CHANNELS* module .This function is already called by the /MegaBoardInit/ function so no need to call it
+* explicitly unless you want to change the stepping mode .This function does not return any value.
 *
 * Parameters :
 *
@@ -49,12 +64,12 @@ void Stepper_Init(byte steppingMode)
  stepperStruct.rampStage=0;
  stepperStruct.stepsTaken=0;
  stepperStruct.stepperFilter=0xff;
- ICR1=rampArray[0];
- OCR1A=ICR1/2;
- TCNT1=0;
- TCCR1A=0;
- TCCR1B=_BV(WGM13)|_BV(WGM12);
- TIMSK|=_BV(OCIE1A);
+ stepperStruct.running=0;
+ stepperStruct.leftSteps=0;
+ stepperStruct.rightSteps=0;
+ stepperStruct.halted=0;
+ Timer16_Cancel(TIMER1_CHANNEL_A);
+ Timer16_Allocate(TIMER1_CHANNEL_A,Stepper_Update);
  sei();
 }
 
@@ -81,6 +96,8 @@ void Stepper_Init(byte steppingMode)
 */
 void Stepper_MoveStraight(unsigned int steps,byte dir)
 {
+  if(stepperStruct.halted)
+   return;
   if(dir==FORWARD)
  {
      PORTA|=_BV(5);
@@ -94,7 +111,7 @@ void Stepper_MoveStraight(unsigned int steps,byte dir)
  stepperStruct.stepperFilter=0xFF;
  stepperStruct.stepsTaken=0;
  stepperStruct.stepsToTake=steps;
- StartSteppers();
+ Stepper_StartTimer();
 }
 
 /*
@@ -120,6 +137,8 @@ void Stepper_MoveStraight(unsigned int steps,byte dir)
 */
 void Stepper_RotateAboutCenter(unsigned int steps,byte dir)
 {
+  if(stepperStruct.halted)
+   return;
   if(dir==0)
   PORTA|=_BV(5)|_BV(2);
   else
@@ -127,7 +146,7 @@ void Stepper_RotateAboutCenter(unsigned int steps,byte dir)
  stepperStruct.stepperFilter=0xFF;
  stepperStruct.stepsTaken=0;
  stepperStruct.stepsToTake=steps;
- StartSteppers();
+ Stepper_StartTimer();
 }
 
 /*
@@ -156,6 +175,8 @@ void Stepper_RotateAboutCenter(unsigned int steps,byte dir)
 */
 void Stepper_RotateAboutWheel(unsigned int steps,byte wheel,byte dir)
 {
+  if(stepperStruct.halted)
+   return;
   if(dir==0)
   PORTA|=_BV(5)|_BV(2);
   else
@@ -168,7 +189,7 @@ void Stepper_RotateAboutWheel(unsigned int steps,byte wheel,byte dir)
 
  stepperStruct.stepsTaken=0;
  stepperStruct.stepsToTake=steps;
- StartSteppers();
+ Stepper_StartTimer();
 }
 
 /*
@@ -182,34 +203,118 @@ void Stepper_RotateAboutWheel(unsigned int steps,byte wheel,byte dir)
 */
 void Stepper_WaitForStop()
 {
-    while( TCCR1B&(_BV(CS11)|_BV(CS10)));
+    while(stepperStruct.running);
 }
 
-SIGNAL(SIG_OUTPUT_COMPARE1A)
+/*
+*
+* Name : Stepper_GetStepCounts
+* Reads the steps each wheel has taken since /Stepper_Init/ ,counting up when the wheel turns the way it does for
+* /Stepper_MoveStraight/ with *FORWARD* and down when it turns the other way .Unlike the steps of a move the counts are
+* kept from move to move .They wrap round after 32767 steps so use the difference between two readings .This function
+* does not return any value .
+*
+* Parameters :
+*
+* /left/ - Pointer to the variable which receives the steps of the left wheel
+*
+* /right/ - Pointer to the variable which receives the steps of the right wheel
+*
+* E.g. Usage :
+*
+* /Stepper_GetStepCounts (&left,&right);/ - Reads the step counts of both wheels
+*/
+void Stepper_GetStepCounts(int * left,int * right)
 {
+ byte sreg=SREG;
+ cli();
+ *left=stepperStruct.leftSteps;
+ *right=stepperStruct.rightSteps;
+ SREG=sreg;
+}
 
+/*
+*
+* Name : Stepper_Halt
+* Stops the robot as quickly as the motors allow without losing steps :the move in progress is cut short and the motors
+* slow down through the ramp from the speed they have reached .The moves asked for after this are refused until
+* /Stepper_Release/ is called .It may be called from an interrupt handler .This function does not return any value .
+*
+* E.g. Usage :
+*
+* /Stepper_Halt ();/ - Brings the robot to a stop
+*/
+void Stepper_Halt()
+{
+ unsigned int rampSteps;
+ byte sreg=SREG;
+ cli();
+ stepperStruct.halted=1;
+ rampSteps=(unsigned int)stepperStruct.rampStage*RAMPINTERVAL;
+ if(stepperStruct.stepsToTake>rampSteps)
+  stepperStruct.stepsToTake=rampSteps;
+ SREG=sreg;
+}
+
+/*
+*
+* Name : Stepper_Release
+* Accepts moves again after /Stepper_Halt/ .This function does not return any value .
+*
+* E.g. Usage :
+*
+* /Stepper_Release ();/ - Lets the robot move again
+*/
+void Stepper_Release()
+{
+ stepperStruct.halted=0;
+}
+
+/* Starts the step interrupts unless the motors are already moving */
+static void Stepper_StartTimer()
+{
+ byte sreg=SREG;
+ cli();
+ if(!stepperStruct.running)
+  {
+   stepperStruct.running=1;
+   stepperStruct.rampStage=0;
+   Timer16_Schedule(TIMER1_CHANNEL_A,STEPPER_TICKS(rampArray[0]));
+  }
+ SREG=sreg;
+}
+
+/* Called from the timer channel interrupt twice per step */
+static void Stepper_Update()
+{
  if(stepperStruct.stepsToTake==0)
-  StopSteppers();
- 
+ {
+  PORTA&=~(_BV(6)|_BV(3));
+  Timer16_Cancel(TIMER1_CHANNEL_A);
+  stepperStruct.running=0;
+  return;
+ }
+
  if(PORTA & 0x48)
   PORTA&=~(_BV(6)|_BV(3));
  else
  {
   PORTA|=(0x48 & stepperStruct.stepperFilter);
+  if(stepperStruct.stepperFilter & _BV(3))
+   stepperStruct.leftSteps+=(PORTA & _BV(2))?-1:1;
+  if(stepperStruct.stepperFilter & _BV(6))
+   stepperStruct.rightSteps+=(PORTA & _BV(5))?1:-1;
   stepperStruct.stepsToTake--;
   stepperStruct.stepsTaken++;
  }
  if(stepperStruct.stepsTaken<RAMPDURATION && stepperStruct.stepsTaken<stepperStruct.stepsToTake)
  {
   stepperStruct.rampStage=stepperStruct.stepsTaken/RAMPINTERVAL;
-  ICR1=rampArray[stepperStruct.rampStage];
-  OCR1A=ICR1/2;
  }
  else if(stepperStruct.stepsToTake<RAMPDURATION && stepperStruct.stepsToTake<=stepperStruct.stepsTaken)
  {
   stepperStruct.rampStage=stepperStruct.stepsToTake/RAMPINTERVAL;
-  ICR1=rampArray[stepperStruct.rampStage];
-  OCR1A=ICR1/2;
  }
+ Timer16_ScheduleNext(TIMER1_CHANNEL_A,STEPPER_TICKS(rampArray[stepperStruct.rampStage]));
 }
 